@@ -0,0 +1,136 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "alarm-log.h"
+
+double AlarmTrigger::now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+bool AlarmTrigger::update(bool condition)
+{
+	if (!condition) {
+		m_since = -1;
+		return reset();
+	}
+	if (m_since < 0)
+		m_since = now();
+	if (m_active || now() - m_since < m_hold)
+		return false;
+	m_active = true;
+	return true;
+}
+
+bool AlarmTrigger::reset()
+{
+	bool active = m_active;
+
+	m_since = -1;
+	m_active = false;
+	return active;
+}
+
+double AlarmTrigger::duration() const
+{
+	return m_since < 0 ? 0 : now() - m_since;
+}
+
+bool AlarmLog::open(const QString &target)
+{
+	close();
+	if (!target.startsWith("udp:")) {
+		m_file = fopen(target.toLocal8Bit().data(), "a");
+		return m_file != NULL;
+	}
+
+	QString host = target.section(':', 1, 1);
+	QString port = target.section(':', 2, 2);
+	struct addrinfo hints, *res;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	if (getaddrinfo(host.toLocal8Bit().data(), port.toLocal8Bit().data(), &hints, &res))
+		return false;
+	m_sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	// connected, so that a plain send() will do
+	if (m_sock >= 0 && ::connect(m_sock, res->ai_addr, res->ai_addrlen)) {
+		::close(m_sock);
+		m_sock = -1;
+	}
+	freeaddrinfo(res);
+	return m_sock >= 0;
+}
+
+void AlarmLog::close()
+{
+	if (m_file)
+		fclose(m_file);
+	if (m_sock >= 0)
+		::close(m_sock);
+	m_file = NULL;
+	m_sock = -1;
+}
+
+void AlarmLog::raise(const char *source, const QString &text)
+{
+	write("ALARM", source, text);
+}
+
+void AlarmLog::clear(const char *source, const QString &text)
+{
+	write("CLEAR", source, text);
+}
+
+void AlarmLog::write(const char *what, const char *source, const QString &text)
+{
+	struct timeval tv;
+	struct tm tm;
+	char stamp[32];
+	char line[512];
+	int len;
+
+	if (!isOpen())
+		return;
+	gettimeofday(&tv, NULL);
+	localtime_r(&tv.tv_sec, &tm);
+	strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+	len = snprintf(line, sizeof(line), "%s %s %s: %s\n", stamp, what, source,
+			text.toLocal8Bit().data());
+	if (len >= (int)sizeof(line))
+		len = sizeof(line) - 1;
+	if (m_file) {
+		fputs(line, m_file);
+		fflush(m_file);
+	}
+	// nobody listening is not our problem
+	if (m_sock >= 0)
+		send(m_sock, line, len, MSG_DONTWAIT);
+}
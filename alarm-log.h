@@ -0,0 +1,74 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef ALARM_LOG_H
+#define ALARM_LOG_H
+
+#include <QString>
+#include <stdio.h>
+
+// Turns a condition that is checked over and over into an alarm that is
+// raised once the condition held for a while and cleared as soon as it
+// is gone.
+class AlarmTrigger
+{
+public:
+	AlarmTrigger(double hold = 2.0) : m_hold(hold), m_since(-1), m_active(false) {}
+
+	void setHold(double seconds) { m_hold = seconds; }
+	// Returns true if the alarm was raised or cleared by this update.
+	bool update(bool condition);
+	// Forgets the condition, returns true if the alarm was active.
+	bool reset();
+	bool active() const { return m_active; }
+	// Seconds the condition has held so far.
+	double duration() const;
+
+	// Monotonic time in seconds.
+	static double now();
+
+private:
+	double m_hold;
+	double m_since;
+	bool m_active;
+};
+
+// Where alarms go besides the status bar: appended to a file, or sent as
+// one UDP datagram per line if the target is udp:host:port.
+class AlarmLog
+{
+public:
+	AlarmLog() : m_file(NULL), m_sock(-1) {}
+	~AlarmLog() { close(); }
+
+	bool open(const QString &target);
+	void close();
+	bool isOpen() const { return m_file || m_sock >= 0; }
+
+	void raise(const char *source, const QString &text);
+	void clear(const char *source, const QString &text);
+
+private:
+	void write(const char *what, const char *source, const QString &text);
+
+	FILE *m_file;
+	int m_sock;
+};
+
+#endif
@@ -0,0 +1,410 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "caption.h"
+
+// The characters 0x20-0x7f, as Unicode. Most are ASCII.
+const unsigned short CaptionDecoder::basic[96] = {
+	0x0020, 0x0021, 0x0022, 0x0023, 0x0024, 0x0025, 0x0026, 0x0027,
+	0x0028, 0x0029, 0x00e1, 0x002b, 0x002c, 0x002d, 0x002e, 0x002f,
+	0x0030, 0x0031, 0x0032, 0x0033, 0x0034, 0x0035, 0x0036, 0x0037,
+	0x0038, 0x0039, 0x003a, 0x003b, 0x003c, 0x003d, 0x003e, 0x003f,
+	0x0040, 0x0041, 0x0042, 0x0043, 0x0044, 0x0045, 0x0046, 0x0047,
+	0x0048, 0x0049, 0x004a, 0x004b, 0x004c, 0x004d, 0x004e, 0x004f,
+	0x0050, 0x0051, 0x0052, 0x0053, 0x0054, 0x0055, 0x0056, 0x0057,
+	0x0058, 0x0059, 0x005a, 0x005b, 0x00e9, 0x005d, 0x00ed, 0x00f3,
+	0x00fa, 0x0061, 0x0062, 0x0063, 0x0064, 0x0065, 0x0066, 0x0067,
+	0x0068, 0x0069, 0x006a, 0x006b, 0x006c, 0x006d, 0x006e, 0x006f,
+	0x0070, 0x0071, 0x0072, 0x0073, 0x0074, 0x0075, 0x0076, 0x0077,
+	0x0078, 0x0079, 0x007a, 0x00e7, 0x00f7, 0x00d1, 0x00f1, 0x2588
+};
+
+// 0x11 0x30-0x3f, the transparent space shows as a non-breaking one.
+const unsigned short CaptionDecoder::special[16] = {
+	0x00ae, 0x00b0, 0x00bd, 0x00bf, 0x2122, 0x00a2, 0x00a3, 0x266a,
+	0x00e0, 0x00a0, 0x00e8, 0x00e2, 0x00ea, 0x00ee, 0x00f4, 0x00fb
+};
+
+// 0x12 0x20-0x3f, then 0x13 0x20-0x3f.
+const unsigned short CaptionDecoder::extended[64] = {
+	0x00c1, 0x00c9, 0x00d3, 0x00da, 0x00dc, 0x00fc, 0x2018, 0x00a1,
+	0x002a, 0x2019, 0x2014, 0x00a9, 0x2120, 0x2022, 0x201c, 0x201d,
+	0x00c0, 0x00c2, 0x00c7, 0x00c8, 0x00ca, 0x00cb, 0x00eb, 0x00ce,
+	0x00cf, 0x00ef, 0x00d4, 0x00d9, 0x00f9, 0x00db, 0x00ab, 0x00bb,
+	0x00c3, 0x00e3, 0x00cd, 0x00cc, 0x00ec, 0x00d2, 0x00f2, 0x00d5,
+	0x00f5, 0x007b, 0x007d, 0x005c, 0x005e, 0x005f, 0x007c, 0x007e,
+	0x00c4, 0x00e4, 0x00d6, 0x00f6, 0x00df, 0x00a5, 0x00a4, 0x00a6,
+	0x00c5, 0x00e5, 0x00d8, 0x00f8, 0x250c, 0x2510, 0x2514, 0x2518
+};
+
+// Row of a preamble address code, by bits 0-2 of the first byte and
+// bit 5 of the second one.
+const signed char CaptionDecoder::pacRow[16] = {
+	10, -1, 0, 1, 2, 3, 11, 12, 13, 14, 4, 5, 6, 7, 8, 9
+};
+
+static double now()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+CaptionDecoder::CaptionDecoder() :
+	m_channel(1),
+	m_updates(0),
+	m_log(NULL)
+{
+	reset();
+}
+
+CaptionDecoder::~CaptionDecoder()
+{
+	closeLog();
+}
+
+void CaptionDecoder::reset()
+{
+	memset(m_mem, 0, sizeof(m_mem));
+	m_shown = 0;
+	m_mode = ccNone;
+	m_rollRows = 2;
+	m_row = CC_ROWS - 1;
+	m_col = 0;
+	m_updates++;
+	m_rowTime = 0;
+	m_last[0] = m_last[1] = 0;
+	m_current[0] = 1;
+	m_current[1] = 3;
+	m_xds = false;
+	memset(m_text, 0, sizeof(m_text));
+}
+
+void CaptionDecoder::setChannel(unsigned channel)
+{
+	if (channel < 1 || channel > 4 || channel == m_channel)
+		return;
+	endRow();
+	m_channel = channel;
+	reset();
+}
+
+bool CaptionDecoder::openLog(const QString &fileName)
+{
+	FILE *f = fopen(fileName.toLocal8Bit().data(), "a");
+
+	if (f == NULL)
+		return false;
+	fseek(f, 0, SEEK_END);
+	if (ftell(f) == 0)
+		fprintf(f, "time,channel,text\n");
+	closeLog();
+	m_log = f;
+	return true;
+}
+
+void CaptionDecoder::closeLog()
+{
+	if (m_log)
+		fclose(m_log);
+	m_log = NULL;
+}
+
+void CaptionDecoder::decode(const v4l2_sliced_vbi_data *data, unsigned lines)
+{
+	for (unsigned i = 0; i < lines; i++)
+		if (data[i].id & V4L2_SLICED_CAPTION_525)
+			pair(data[i].field, data[i].data[0], data[i].data[1]);
+}
+
+void CaptionDecoder::pair(unsigned field, unsigned char c1, unsigned char c2)
+{
+	bool ok1 = __builtin_parity(c1);
+	bool ok2 = __builtin_parity(c2);
+	unsigned channel;
+
+	field &= 1;
+	c1 &= 0x7f;
+	c2 &= 0x7f;
+	if (c1 >= 0x10 && c1 < 0x20) {
+		unsigned code = (c1 << 8) | c2;
+
+		// a control code in error is dropped, its copy will do
+		if (!ok1 || !ok2 || c2 < 0x20) {
+			m_last[field] = 0;
+			return;
+		}
+		// control codes are sent twice, the copy does nothing
+		if (code == m_last[field]) {
+			m_last[field] = 0;
+			return;
+		}
+		m_last[field] = code;
+		if (field)
+			m_xds = false;
+		m_current[field] = field * 2 + ((c1 >> 3) & 1) + 1;
+		if (m_current[field] == m_channel)
+			control(c1, c2);
+		return;
+	}
+	m_last[field] = 0;
+	if (field && ok1 && c1 && c1 < 0x10) {
+		// a packet runs until the end code, which comes with the checksum
+		m_xds = c1 != 0x0f;
+		return;
+	}
+	channel = m_current[field];
+	if ((field && m_xds) || channel != m_channel || m_text[channel - 1])
+		return;
+	// characters in error show as a solid block
+	if (c1 >= 0x20)
+		put(basic[ok1 ? c1 - 0x20 : 0x5f]);
+	if (c2 >= 0x20)
+		put(basic[ok2 ? c2 - 0x20 : 0x5f]);
+}
+
+void CaptionDecoder::control(unsigned char c1, unsigned char c2)
+{
+	if (c2 >= 0x40) {
+		preamble(c1, c2);
+		return;
+	}
+	switch (c1 & 0x17) {
+	case 0x11:
+		// mid-row codes change the style and show as a space
+		put(c2 < 0x30 ? ' ' : special[c2 & 0x0f]);
+		break;
+	case 0x12:
+	case 0x13:
+		// these replace the standard character sent before them
+		if (m_col > 0)
+			m_col--;
+		put(extended[(c1 & 1) * 32 + c2 - 0x20]);
+		break;
+	case 0x14:
+	case 0x15:
+		if (c2 < 0x30)
+			misc(c2);
+		break;
+	case 0x17:
+		// tab offsets
+		if (c2 >= 0x21 && c2 <= 0x23) {
+			m_col += c2 & 3;
+			if (m_col >= CC_COLS)
+				m_col = CC_COLS - 1;
+		}
+		break;
+	}
+}
+
+void CaptionDecoder::misc(unsigned char c2)
+{
+	unsigned short (*mem)[CC_COLS] = m_mem[m_shown];
+	unsigned top;
+
+	switch (c2) {
+	case 0x20:	// resume caption loading
+		endRow();
+		m_mode = ccPopOn;
+		m_text[m_channel - 1] = false;
+		break;
+	case 0x21:	// backspace
+		if (m_mode == ccNone || m_col == 0)
+			break;
+		target()[m_row][--m_col] = 0;
+		m_updates++;
+		break;
+	case 0x24:	// delete to end of row
+		if (m_mode == ccNone)
+			break;
+		memset(target()[m_row] + m_col, 0, (CC_COLS - m_col) * sizeof(mem[0][0]));
+		m_updates++;
+		break;
+	case 0x25:	// roll-up with 2, 3 or 4 rows
+	case 0x26:
+	case 0x27:
+		m_text[m_channel - 1] = false;
+		if (m_mode != ccRollUp) {
+			endRow();
+			erase(0);
+			erase(1);
+			m_mode = ccRollUp;
+			m_row = CC_ROWS - 1;
+			m_col = 0;
+		}
+		m_rollRows = c2 - 0x23;
+		if (m_row + 1 < m_rollRows)
+			m_row = m_rollRows - 1;
+		break;
+	case 0x29:	// resume direct captioning
+		endRow();
+		m_mode = ccPaintOn;
+		m_text[m_channel - 1] = false;
+		break;
+	case 0x2a:	// text restart
+	case 0x2b:	// resume text display
+		endRow();
+		m_text[m_channel - 1] = true;
+		break;
+	case 0x2c:	// erase displayed memory
+		endRow();
+		erase(m_shown);
+		break;
+	case 0x2d:	// carriage return
+		if (m_mode != ccRollUp)
+			break;
+		endRow();
+		// rows above the window are gone, the window moves up a row
+		top = m_row + 1 - m_rollRows;
+		memset(mem, 0, top * sizeof(mem[0]));
+		memmove(mem[top], mem[top + 1], (m_rollRows - 1) * sizeof(mem[0]));
+		memset(mem[m_row], 0, sizeof(mem[0]));
+		m_col = 0;
+		m_updates++;
+		break;
+	case 0x2e:	// erase non-displayed memory
+		erase(!m_shown);
+		break;
+	case 0x2f:	// end of caption, flip memories
+		endRow();
+		m_shown = !m_shown;
+		m_mode = ccPopOn;
+		m_updates++;
+		log(now(), 0, CC_ROWS - 1);
+		break;
+	}
+}
+
+void CaptionDecoder::preamble(unsigned char c1, unsigned char c2)
+{
+	int row = pacRow[((c1 << 1) & 14) | ((c2 >> 5) & 1)];
+
+	if (row < 0)
+		return;
+	endRow();
+	if (m_mode == ccRollUp) {
+		unsigned short (*mem)[CC_COLS] = m_mem[m_shown];
+		unsigned short window[4][CC_COLS];
+		unsigned rows = m_rollRows;
+
+		// the window moves along with its base row
+		if ((unsigned)row + 1 < rows)
+			row = rows - 1;
+		if ((unsigned)row != m_row) {
+			memcpy(window, mem[m_row + 1 - rows], rows * sizeof(mem[0]));
+			erase(m_shown);
+			memcpy(mem[row + 1 - rows], window, rows * sizeof(mem[0]));
+		}
+	}
+	m_row = row;
+	// indents are in steps of 4 columns, the other codes set a style
+	m_col = (c2 & 0x10) ? ((c2 >> 1) & 7) * 4 : 0;
+}
+
+void CaptionDecoder::put(unsigned short c)
+{
+	if (m_mode == ccNone)
+		return;
+	if (m_mode != ccPopOn) {
+		if (m_rowTime == 0)
+			m_rowTime = now();
+		m_updates++;
+	}
+	target()[m_row][m_col] = c;
+	if (m_col < CC_COLS - 1)
+		m_col++;
+}
+
+void CaptionDecoder::erase(unsigned mem)
+{
+	memset(m_mem[mem], 0, sizeof(m_mem[mem]));
+	if (mem == m_shown)
+		m_updates++;
+}
+
+// A roll-up or paint-on row is done when the cursor leaves it.
+void CaptionDecoder::endRow()
+{
+	if (m_rowTime == 0)
+		return;
+	log(m_rowTime, m_row, m_row);
+	m_rowTime = 0;
+}
+
+// The shown rows first to last that are not blank, as one line of UTF-8.
+void CaptionDecoder::log(double time, unsigned first, unsigned last)
+{
+	// 3 bytes per character at most, a quote is 2
+	char line[64 + CC_ROWS * (CC_COLS * 3 + 3)];
+	time_t secs = (time_t)time;
+	unsigned ms = (unsigned)((time - secs) * 1000);
+	unsigned rows = 0;
+	struct tm tm;
+	int len;
+
+	if (m_log == NULL)
+		return;
+	localtime_r(&secs, &tm);
+	len = strftime(line, 32, "%Y-%m-%d %H:%M:%S", &tm);
+	len += sprintf(line + len, ".%03u,CC%u,\"", ms, m_channel);
+	for (unsigned r = first; r <= last; r++) {
+		const unsigned short *text = m_mem[m_shown][r];
+		unsigned begin = 0, end = CC_COLS;
+
+		while (begin < end && (text[begin] == 0 || text[begin] == ' '))
+			begin++;
+		while (end > begin && (text[end - 1] == 0 || text[end - 1] == ' '))
+			end--;
+		if (begin == end)
+			continue;
+		if (rows++) {
+			memcpy(line + len, " | ", 3);
+			len += 3;
+		}
+		for (unsigned c = begin; c < end; c++) {
+			unsigned short u = text[c] ? text[c] : ' ';
+
+			if (u == '"') {
+				line[len++] = '"';
+				line[len++] = '"';
+			} else if (u < 0x80) {
+				line[len++] = u;
+			} else if (u < 0x800) {
+				line[len++] = 0xc0 | (u >> 6);
+				line[len++] = 0x80 | (u & 0x3f);
+			} else {
+				line[len++] = 0xe0 | (u >> 12);
+				line[len++] = 0x80 | ((u >> 6) & 0x3f);
+				line[len++] = 0x80 | (u & 0x3f);
+			}
+		}
+	}
+	// a caption that clears the screen
+	if (rows == 0)
+		return;
+	line[len++] = '"';
+	line[len++] = '\n';
+	fwrite(line, 1, len, m_log);
+	fflush(m_log);
+}
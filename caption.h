@@ -0,0 +1,100 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef CAPTION_H
+#define CAPTION_H
+
+#include <QString>
+#include <stdio.h>
+#include <linux/videodev2.h>
+
+#define CC_ROWS		15
+#define CC_COLS		32
+
+// Decodes one channel, CC1 to CC4, of the CEA-608 captions on line 21
+// into a screen of 15 rows of 32 characters. The screen and the memory
+// pop-on captions are loaded into are fixed arrays, nothing is allocated
+// while decoding.
+class CaptionDecoder
+{
+public:
+	enum Mode { ccNone, ccPopOn, ccRollUp, ccPaintOn };
+
+	CaptionDecoder();
+	~CaptionDecoder();
+
+	void reset();
+	void setChannel(unsigned channel);
+	unsigned channel() const { return m_channel; }
+
+	// The lines of one frame, as vbi_parse() fills them in.
+	void decode(const v4l2_sliced_vbi_data *data, unsigned lines);
+	// The two bytes of line 21 of field 0 or 1, parity bits included.
+	void pair(unsigned field, unsigned char c1, unsigned char c2);
+
+	// The row of the screen as shown, 0 where nothing is shown.
+	const unsigned short *row(unsigned r) const { return m_mem[m_shown][r]; }
+	Mode mode() const { return m_mode; }
+	// Counts the changes of the screen.
+	unsigned updates() const { return m_updates; }
+
+	// Each caption is appended to this CSV file when it is shown, with
+	// the time it appeared. Roll-up and paint-on captions are written a
+	// row at a time, once the row is complete.
+	bool openLog(const QString &fileName);
+	void closeLog();
+
+private:
+	void control(unsigned char c1, unsigned char c2);
+	void misc(unsigned char c2);
+	void preamble(unsigned char c1, unsigned char c2);
+	void put(unsigned short c);
+	void erase(unsigned mem);
+	void endRow();
+	void log(double time, unsigned first, unsigned last);
+
+	unsigned short (*target())[CC_COLS]
+	{
+		return m_mem[m_mode == ccPopOn ? !m_shown : m_shown];
+	}
+
+	static const unsigned short basic[96];
+	static const unsigned short special[16];
+	static const unsigned short extended[64];
+	static const signed char pacRow[16];
+
+	unsigned m_channel;		// 1 to 4
+	unsigned short m_mem[2][CC_ROWS][CC_COLS];
+	unsigned m_shown;		// memory on screen, the other one is loaded
+	Mode m_mode;
+	unsigned m_rollRows;
+	unsigned m_row, m_col;		// cursor
+	unsigned m_updates;
+	double m_rowTime;		// first character of a direct row, or 0
+
+	// by field
+	unsigned m_last[2];		// control code to ignore if sent again
+	unsigned m_current[2];		// channel the data belongs to
+	bool m_xds;			// extended data services on field 1
+	bool m_text[4];			// by channel, text mode rather than captions
+
+	FILE *m_log;
+};
+
+#endif
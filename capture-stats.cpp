@@ -0,0 +1,178 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <string.h>
+#include <sys/time.h>
+
+#include "capture-stats.h"
+
+static QString ms(unsigned usecs)
+{
+	return QString::number(usecs / 1000.0, 'f', 1);
+}
+
+QString CapStats::toString() const
+{
+	return QString("Dropped: %1 Errors: %2 Skipped: %3 Buffers: %4 "
+		       "Interval: %5/%6/%7/%8 ms Hold: %9/%10/%11 ms")
+		.arg(dropped).arg(corrupted).arg(skipped).arg(buffers)
+		.arg(ms(intervalMin)).arg(ms(intervalAvg))
+		.arg(ms(intervalMax)).arg(ms(intervalP99))
+		.arg(ms(holdAvg)).arg(ms(holdMax)).arg(ms(holdP99));
+}
+
+void StatsHistogram::reset()
+{
+	memset(m_bins, 0, sizeof(m_bins));
+	m_count = 0;
+	m_min = ~0U;
+	m_max = 0;
+	m_sum = 0;
+}
+
+unsigned StatsHistogram::bin(unsigned units)
+{
+	unsigned shift;
+
+	if (units < 128)
+		return units;
+	// the top seven bits of the value pick the bin
+	shift = 31 - __builtin_clz(units) - 6;
+	return shift * 64 + (units >> shift);
+}
+
+// First value in units past the given bin
+unsigned long long StatsHistogram::upper(unsigned bin)
+{
+	unsigned shift;
+
+	if (bin < 128)
+		return bin + 1;
+	shift = bin / 64 - 1;
+	return (unsigned long long)(bin % 64 + 65) << shift;
+}
+
+void StatsHistogram::add(unsigned v)
+{
+	m_bins[bin(v / m_unit)]++;
+	m_count++;
+	m_sum += v;
+	if (v < m_min)
+		m_min = v;
+	if (v > m_max)
+		m_max = v;
+}
+
+// Upper edge of the bin holding the given percentile, but never more
+// than the largest value seen.
+unsigned StatsHistogram::percentile(unsigned pct) const
+{
+	unsigned long long target = ((unsigned long long)m_count * pct + 99) / 100;
+	unsigned long long seen = 0;
+
+	if (m_count == 0)
+		return 0;
+	for (unsigned i = 0; i < STATS_BINS; i++) {
+		seen += m_bins[i];
+		if (seen >= target) {
+			unsigned long long v = upper(i) * m_unit;
+
+			return v < m_max ? v : m_max;
+		}
+	}
+	return m_max;
+}
+
+CaptureStats::CaptureStats() :
+	m_interval(100),
+	m_hold(10)
+{
+	reset(0);
+}
+
+void CaptureStats::reset(unsigned buffers)
+{
+	QMutexLocker locker(&m_lock);
+
+	memset(&m_stats, 0, sizeof(m_stats));
+	m_stats.buffers = buffers;
+	m_haveLast = false;
+	m_interval.reset();
+	m_hold.reset();
+}
+
+unsigned CaptureStats::frame(const v4l2_buffer &buf, bool hasSequence)
+{
+	QMutexLocker locker(&m_lock);
+	unsigned lost = 0;
+
+	m_stats.frames++;
+	if (buf.flags & V4L2_BUF_FLAG_ERROR)
+		m_stats.corrupted++;
+	if (m_haveLast) {
+		struct timeval res;
+
+		// a sequence number going back means the driver restarted
+		if (hasSequence && buf.sequence > m_lastSequence + 1)
+			lost = buf.sequence - m_lastSequence - 1;
+		timersub(&buf.timestamp, &m_lastTimestamp, &res);
+		if (res.tv_sec >= 0)
+			m_interval.add(res.tv_sec * 1000000 + res.tv_usec);
+	}
+	m_haveLast = true;
+	m_lastSequence = buf.sequence;
+	m_lastTimestamp = buf.timestamp;
+	m_stats.dropped += lost;
+	return lost;
+}
+
+void CaptureStats::hold(unsigned usecs)
+{
+	QMutexLocker locker(&m_lock);
+
+	m_hold.add(usecs);
+}
+
+void CaptureStats::skipped()
+{
+	QMutexLocker locker(&m_lock);
+
+	m_stats.skipped++;
+}
+
+void CaptureStats::buffers(unsigned count)
+{
+	QMutexLocker locker(&m_lock);
+
+	m_stats.buffers = count;
+}
+
+void CaptureStats::get(CapStats &stats) const
+{
+	QMutexLocker locker(&m_lock);
+
+	stats = m_stats;
+	stats.intervalMin = m_interval.min();
+	stats.intervalAvg = m_interval.avg();
+	stats.intervalMax = m_interval.max();
+	stats.intervalP99 = m_interval.percentile(99);
+	stats.holdAvg = m_hold.avg();
+	stats.holdMax = m_hold.max();
+	stats.holdP99 = m_hold.percentile(99);
+}
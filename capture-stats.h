@@ -0,0 +1,97 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef CAPTURE_STATS_H
+#define CAPTURE_STATS_H
+
+#include <QMutex>
+#include <QString>
+#include <linux/videodev2.h>
+
+// Values below 128 units have a bin each, every doubling above that is
+// split into 64 bins: 2 * 64 bins up to 128, 25 * 64 more up to 2^32.
+#define STATS_BINS (27 * 64)
+
+// Counters of one capture session. All times are in microseconds.
+struct CapStats {
+	unsigned frames;	// frames dequeued
+	unsigned dropped;	// frames lost by the driver (sequence gaps)
+	unsigned corrupted;	// buffers flagged with V4L2_BUF_FLAG_ERROR
+	unsigned skipped;	// frames dropped because the consumers were busy
+	unsigned buffers;	// current size of the buffer ring
+
+	// time between frames according to the driver timestamps
+	unsigned intervalMin, intervalAvg, intervalMax, intervalP99;
+	// time a buffer was kept away from the driver
+	unsigned holdAvg, holdMax, holdP99;
+
+	QString toString() const;
+};
+
+// Fixed size histogram, so recording a value never allocates. The bins
+// are a unit wide for small values and grow with them, so that any value
+// is counted to within 1/64 of it.
+class StatsHistogram
+{
+public:
+	StatsHistogram(unsigned unit) : m_unit(unit) { reset(); }
+
+	void reset();
+	void add(unsigned v);
+	unsigned percentile(unsigned pct) const;
+	unsigned min() const { return m_count ? m_min : 0; }
+	unsigned max() const { return m_max; }
+	unsigned avg() const { return m_count ? m_sum / m_count : 0; }
+
+private:
+	static unsigned bin(unsigned units);
+	static unsigned long long upper(unsigned bin);
+
+	unsigned m_unit;
+	unsigned m_bins[STATS_BINS];
+	unsigned m_count;
+	unsigned m_min, m_max;
+	unsigned long long m_sum;
+};
+
+// Updated by the capture thread for every frame, read by anyone with get().
+class CaptureStats
+{
+public:
+	CaptureStats();
+
+	void reset(unsigned buffers);
+	// Returns the number of frames the driver lost before this one.
+	unsigned frame(const v4l2_buffer &buf, bool hasSequence);
+	void hold(unsigned usecs);
+	void skipped();
+	void buffers(unsigned count);
+	void get(CapStats &stats) const;
+
+private:
+	mutable QMutex m_lock;
+	CapStats m_stats;
+	bool m_haveLast;
+	__u32 m_lastSequence;
+	struct timeval m_lastTimestamp;
+	StatsHistogram m_interval;
+	StatsHistogram m_hold;
+};
+
+#endif
@@ -0,0 +1,467 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <linux/dma-buf.h>
+
+#include "capture-thread.h"
+
+#define ADAPTIVE_STEP 2
+
+void FrameRing::init(unsigned size)
+{
+	delete [] m_ring;
+	m_ring = new CapFrame *[size];
+	m_mask = size - 1;
+	m_head.fetchAndStoreOrdered(0);
+	m_tail.fetchAndStoreOrdered(0);
+}
+
+bool FrameRing::push(CapFrame *frame)
+{
+	unsigned head = m_head.fetchAndAddRelaxed(0);
+	unsigned tail = m_tail.fetchAndAddAcquire(0);
+
+	if (head - tail > m_mask)
+		return false;
+	m_ring[head & m_mask] = frame;
+	m_head.fetchAndStoreRelease(head + 1);
+	return true;
+}
+
+CapFrame *FrameRing::pop()
+{
+	unsigned tail = m_tail.fetchAndAddRelaxed(0);
+	unsigned head = m_head.fetchAndAddAcquire(0);
+	CapFrame *frame;
+
+	if (head == tail)
+		return NULL;
+	frame = m_ring[tail & m_mask];
+	m_tail.fetchAndStoreRelease(tail + 1);
+	return frame;
+}
+
+CaptureThread::CaptureThread(v4l2 &fd, QObject *parent) :
+	QThread(parent),
+	v4l2(fd),
+	m_method(methodRead),
+	m_buffers(NULL),
+	m_nbuffers(0),
+	m_frameSize(0),
+	m_adaptive(false),
+	m_zeroCopy(false),
+	m_maxBuffers(VIDEO_MAX_FRAME),
+	m_pool(NULL),
+	m_poolSize(0),
+	m_nspare(0),
+	m_held(0),
+	m_scratch(NULL)
+{
+	m_wakeFd = eventfd(0, EFD_NONBLOCK);
+}
+
+CaptureThread::~CaptureThread()
+{
+	stopCapture();
+	freePool();
+	if (m_wakeFd >= 0)
+		::close(m_wakeFd);
+}
+
+void CaptureThread::freePool()
+{
+	for (unsigned i = 0; i < m_poolSize; i++)
+		free(m_pool[i].store);
+	delete [] m_pool;
+	m_pool = NULL;
+	m_poolSize = 0;
+	m_nspare = 0;
+	free(m_scratch);
+	m_scratch = NULL;
+}
+
+bool CaptureThread::startCapture(CapMethod method, __u32 buftype,
+		struct buffer *buffers, unsigned nbuffers, unsigned frameSize)
+{
+	if (isRunning() || m_wakeFd < 0)
+		return false;
+
+	freePool();
+	m_method = method;
+	m_buftype = buftype;
+	m_buffers = buffers;
+	m_nbuffers = nbuffers;
+	m_frameSize = frameSize;
+	m_held = 0;
+
+	m_pool = new CapFrame[FRAME_POOL_SIZE];
+	m_free.init(FRAME_POOL_SIZE);
+	m_ready.init(FRAME_POOL_SIZE);
+	for (m_poolSize = 0; m_poolSize < FRAME_POOL_SIZE; m_poolSize++) {
+		CapFrame *frame = m_pool + m_poolSize;
+
+		memset(frame, 0, sizeof(*frame));
+		frame->index = -1;
+		frame->dmabuf = -1;
+		m_spare[m_nspare++] = frame;
+		// exported buffers are handed out as they are
+		if (method == methodDmabuf)
+			continue;
+		frame->store = (unsigned char *)malloc(frameSize);
+		if (frame->store == NULL) {
+			freePool();
+			return false;
+		}
+		frame->data = frame->store;
+		frame->length = frameSize;
+	}
+	// read() needs somewhere to put a frame that is dropped
+	if (method == methodRead) {
+		m_scratch = (unsigned char *)malloc(frameSize);
+		if (m_scratch == NULL) {
+			freePool();
+			return false;
+		}
+	}
+
+	timerclear(&m_lastGrow);
+	m_stats.reset(nbuffers);
+	m_stop.fetchAndStoreOrdered(0);
+	m_notify.fetchAndStoreOrdered(0);
+	start(QThread::TimeCriticalPriority);
+	return true;
+}
+
+void CaptureThread::setAdaptiveBuffers(bool adaptive, unsigned max)
+{
+	m_adaptive = adaptive;
+	m_maxBuffers = max;
+}
+
+void CaptureThread::wake()
+{
+	uint64_t one = 1;
+
+	if (write(m_wakeFd, &one, sizeof(one)) != sizeof(one))
+		perror("eventfd");
+}
+
+void CaptureThread::stopCapture()
+{
+	if (!isRunning())
+		return;
+	m_stop.fetchAndStoreOrdered(1);
+	wake();
+	wait();
+}
+
+CapFrame *CaptureThread::getFrame()
+{
+	CapFrame *frame = m_ready.pop();
+
+	if (frame == NULL) {
+		m_notify.fetchAndStoreOrdered(0);
+		// A frame may have been queued just before the flag was cleared.
+		frame = m_ready.pop();
+	}
+	return frame;
+}
+
+void CaptureThread::putFrame(CapFrame *frame)
+{
+	m_free.push(frame);
+	// the driver wants its buffer back as soon as possible
+	if (frame->index >= 0)
+		wake();
+}
+
+static unsigned elapsed(const struct timespec &start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start.tv_sec) * 1000000 +
+		(now.tv_nsec - start.tv_nsec) / 1000;
+}
+
+static void dmabufSync(int fd, __u64 flags)
+{
+	struct dma_buf_sync sync;
+
+	sync.flags = flags;
+	if (::ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync) < 0)
+		perror("DMA_BUF_IOCTL_SYNC");
+}
+
+void CaptureThread::requeue(int index)
+{
+	if (m_method == methodUser)
+		qbuf_user(index, m_buftype, m_buffers[index].start, m_buffers[index].length);
+	else
+		qbuf_mmap(index, m_buftype);
+}
+
+// Take back the frames the consumers are done with. Frames that still
+// reference a driver buffer are requeued here.
+void CaptureThread::reclaim()
+{
+	CapFrame *frame;
+
+	while ((frame = m_free.pop())) {
+		if (frame->index >= 0) {
+			if (frame->dmabuf >= 0)
+				dmabufSync(frame->dmabuf, DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+			requeue(frame->index);
+			m_stats.hold(elapsed(frame->dequeued));
+			m_held--;
+			frame->index = -1;
+			frame->dmabuf = -1;
+			frame->data = frame->store;
+			frame->length = frame->store ? m_frameSize : 0;
+		}
+		m_spare[m_nspare++] = frame;
+	}
+}
+
+bool CaptureThread::capture()
+{
+	CapFrame *frame;
+	v4l2_buffer buf;
+	unsigned char *data;
+	struct timespec dequeued;
+	bool again;
+	int s;
+
+	reclaim();
+	frame = m_nspare ? m_spare[--m_nspare] : NULL;
+
+	switch (m_method) {
+	case methodRead:
+		s = read(frame ? frame->data : m_scratch, m_frameSize);
+		if (s < 0) {
+			if (frame)
+				m_spare[m_nspare++] = frame;
+			if (errno == EAGAIN)
+				return true;
+			emit captureError("read");
+			return false;
+		}
+		memset(&buf, 0, sizeof(buf));
+		buf.bytesused = s;
+		// read() has no timestamps, so take one from the same clock
+		// drivers use
+		clock_gettime(CLOCK_MONOTONIC, &dequeued);
+		buf.timestamp.tv_sec = dequeued.tv_sec;
+		buf.timestamp.tv_usec = dequeued.tv_nsec / 1000;
+		buf.flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+		m_stats.frame(buf, false);
+		break;
+
+	case methodMmap:
+	case methodUser:
+	case methodDmabuf:
+		if (m_method == methodUser ? !dqbuf_user(buf, m_buftype, again) :
+					     !dqbuf_mmap(buf, m_buftype, again)) {
+			if (frame)
+				m_spare[m_nspare++] = frame;
+			emit captureError("dqbuf");
+			return false;
+		}
+		if (again) {
+			if (frame)
+				m_spare[m_nspare++] = frame;
+			return true;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &dequeued);
+		if (m_method == methodUser)
+			data = (unsigned char *)buf.m.userptr;
+		else
+			data = (unsigned char *)m_buffers[buf.index].start;
+		if (frame && (m_method == methodDmabuf || m_zeroCopy) &&
+		    m_held + CAP_MIN_QUEUED < m_nbuffers) {
+			// Hand out the driver buffer itself, it is requeued by
+			// reclaim(). Always leave the driver enough buffers to
+			// capture into.
+			frame->index = buf.index;
+			frame->dmabuf = m_method == methodDmabuf ? m_buffers[buf.index].fd : -1;
+			frame->data = data;
+			frame->length = m_buffers[buf.index].length;
+			frame->dequeued = dequeued;
+			if (frame->dmabuf >= 0)
+				dmabufSync(frame->dmabuf, DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+			m_held++;
+		} else {
+			// exported buffers are never copied, drop the frame instead
+			if (frame && m_method != methodDmabuf) {
+				if (buf.bytesused > frame->length)
+					buf.bytesused = frame->length;
+				memcpy(frame->data, data, buf.bytesused);
+			} else if (frame) {
+				m_spare[m_nspare++] = frame;
+				frame = NULL;
+			}
+			qbuf(buf);
+			m_stats.hold(elapsed(dequeued));
+		}
+		if (m_stats.frame(buf, true) && m_adaptive)
+			growBuffers();
+		break;
+	}
+
+	if (frame == NULL) {
+		m_stats.skipped();
+		return true;
+	}
+	frame->size = buf.bytesused;
+	frame->sequence = buf.sequence;
+	frame->flags = buf.flags;
+	frame->timestamp = buf.timestamp;
+	m_ready.push(frame);
+	if (m_notify.testAndSetOrdered(0, 1))
+		emit frameReady();
+	return true;
+}
+
+// Add a few buffers to the ring after the driver dropped frames. This is
+// done at most once a second since a single drop may just be a one-off.
+void CaptureThread::growBuffers()
+{
+	unsigned count = m_maxBuffers > m_nbuffers ? m_maxBuffers - m_nbuffers : 0;
+	struct buffer *buffers;
+	v4l2_create_buffers cbufs;
+	v4l2_format fmt;
+	struct timeval tv, res;
+	unsigned i;
+
+	if (count == 0)
+		return;
+	if (count > ADAPTIVE_STEP)
+		count = ADAPTIVE_STEP;
+	gettimeofday(&tv, NULL);
+	timersub(&tv, &m_lastGrow, &res);
+	if (res.tv_sec < 1)
+		return;
+	m_lastGrow = tv;
+
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = m_buftype;
+	if (ioctl(VIDIOC_G_FMT, &fmt) < 0)
+		return;
+	if (m_method == methodUser ? !create_bufs_user(cbufs, fmt, count) :
+				     !create_bufs_mmap(cbufs, fmt, count)) {
+		// Not supported by this driver, so don't bother again.
+		perror("VIDIOC_CREATE_BUFS");
+		m_adaptive = false;
+		return;
+	}
+	buffers = (struct buffer *)realloc(m_buffers,
+			(cbufs.index + cbufs.count) * sizeof(*m_buffers));
+	if (buffers == NULL)
+		return;
+	m_buffers = buffers;
+
+	for (i = cbufs.index; i < cbufs.index + cbufs.count; i++) {
+		if (m_method == methodUser) {
+			m_buffers[i].length = m_frameSize;
+			m_buffers[i].start = malloc(m_frameSize);
+			if (m_buffers[i].start == NULL)
+				break;
+			m_nbuffers = i + 1;
+			if (!qbuf_user(i, m_buftype, m_buffers[i].start, m_frameSize))
+				break;
+			continue;
+		}
+
+		v4l2_buffer buf;
+
+		memset(&buf, 0, sizeof(buf));
+		buf.type = m_buftype;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i;
+		if (ioctl(VIDIOC_QUERYBUF, &buf) < 0)
+			break;
+		m_buffers[i].length = buf.length;
+		if (m_method == methodDmabuf) {
+			if (!expbuf(m_buftype, i, m_buffers[i].fd))
+				break;
+			m_buffers[i].start = ::mmap(NULL, buf.length, PROT_READ,
+					MAP_SHARED, m_buffers[i].fd, 0);
+			if (m_buffers[i].start == MAP_FAILED) {
+				::close(m_buffers[i].fd);
+				break;
+			}
+		} else {
+			m_buffers[i].start = mmap(buf.length, buf.m.offset);
+			if (m_buffers[i].start == MAP_FAILED)
+				break;
+		}
+		m_nbuffers = i + 1;
+		if (!qbuf_mmap(i, m_buftype))
+			break;
+	}
+	m_stats.buffers(m_nbuffers);
+}
+
+void CaptureThread::run()
+{
+	struct pollfd pfd[2];
+
+	pfd[0].fd = fd();
+	pfd[0].events = POLLIN;
+	pfd[1].fd = m_wakeFd;
+	pfd[1].events = POLLIN;
+
+	while (!m_stop.fetchAndAddAcquire(0)) {
+		int ret = poll(pfd, 2, 1000);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			emit captureError("poll");
+			break;
+		}
+		if (pfd[1].revents) {
+			uint64_t cnt;
+
+			if (::read(m_wakeFd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+				perror("eventfd");
+			reclaim();
+			continue;
+		}
+		if (ret == 0)
+			continue;
+		if (pfd[0].revents & POLLERR) {
+			emit captureError("capture stopped");
+			break;
+		}
+		if ((pfd[0].revents & POLLIN) && !capture())
+			break;
+	}
+}
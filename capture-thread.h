@@ -0,0 +1,173 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef CAPTURE_THREAD_H
+#define CAPTURE_THREAD_H
+
+#include <QThread>
+#include <QAtomicInt>
+#include <sys/time.h>
+#include <time.h>
+#include <linux/videodev2.h>
+
+#include "qv4l2.h"
+#include "v4l2-api.h"
+#include "capture-stats.h"
+
+#define FRAME_POOL_SIZE 8
+// buffers the driver always keeps to capture into
+#define CAP_MIN_QUEUED 2
+// With methodDmabuf the GUI holds the frame it shows and the next one
+// in flight, on top of the buffers the driver keeps.
+#define CAP_DMABUF_BUFFERS (CAP_MIN_QUEUED + 2)
+
+// A frame as handed from the capture thread to its consumers.
+struct CapFrame {
+	unsigned char	*data;
+	unsigned	size;		// bytes used
+	unsigned	length;		// bytes allocated
+	__u32		sequence;
+	__u32		flags;
+	struct timeval	timestamp;
+	unsigned char	*store;		// pool memory of this frame or NULL
+	int		index;		// driver buffer held by this frame or -1
+	int		dmabuf;		// exported DMA buffer of that index or -1
+	struct timespec	dequeued;	// when that buffer was dequeued
+};
+
+// Lock-free ring of frame pointers. Only safe with a single producer
+// and a single consumer.
+class FrameRing
+{
+public:
+	FrameRing() : m_mask(0), m_ring(NULL) {}
+	~FrameRing() { delete [] m_ring; }
+
+	// size must be a power of two
+	void init(unsigned size);
+	bool push(CapFrame *frame);
+	CapFrame *pop();
+
+private:
+	unsigned m_mask;
+	CapFrame **m_ring;
+	QAtomicInt m_head;	// only written by the producer
+	QAtomicInt m_tail;	// only written by the consumer
+};
+
+// Where the frames of the TV tab come from, whichever engine captures
+// them. The engine announces new frames with a frameReady() signal of its
+// own. The GUI then takes them with getFrame(), from one thread only,
+// and gives each one back with putFrame().
+class FrameSource
+{
+public:
+	virtual ~FrameSource() {}
+
+	// Returns NULL if no frame is pending.
+	virtual CapFrame *getFrame() = 0;
+	virtual void putFrame(CapFrame *frame) = 0;
+	// Counters of the current capture session, safe to call any time.
+	virtual void stats(CapStats &stats) const = 0;
+	// Engines that only learn the format from the stream return it here
+	// once after each change. Frames still queued may be older.
+	virtual bool newFormat(v4l2_format &) { return false; }
+};
+
+// Owns the streaming side of the device: it waits for buffers with
+// poll(), dequeues them, copies them into a small frame pool and
+// requeues them right away so the driver never runs out of buffers
+// because the GUI is busy. If all pool frames are still held by the
+// consumers the frame is dropped instead of stalling the driver.
+//
+// With methodDmabuf nothing is copied: the frame references the
+// exported buffer and it is requeued when the frame is given back.
+// With zero copy enabled mmap and user pointer buffers are handed out
+// the same way, as long as the driver keeps enough buffers to capture
+// into. Otherwise the frame is copied as usual.
+class CaptureThread : public QThread, public v4l2, public FrameSource
+{
+	Q_OBJECT
+
+public:
+	CaptureThread(v4l2 &fd, QObject *parent = 0);
+	virtual ~CaptureThread();
+
+	// Streaming must already be enabled for mmap and user pointer I/O.
+	bool startCapture(CapMethod method, __u32 buftype,
+			struct buffer *buffers, unsigned nbuffers, unsigned frameSize);
+	void stopCapture();
+
+	// Grow the buffer ring with VIDIOC_CREATE_BUFS, up to max buffers,
+	// when the sequence numbers show that the driver dropped frames.
+	void setAdaptiveBuffers(bool adaptive, unsigned max = VIDEO_MAX_FRAME);
+
+	// Hand out the mmap and user pointer buffers themselves. Consumers
+	// that keep a frame around then keep a driver buffer.
+	void setZeroCopy(bool zeroCopy) { m_zeroCopy = zeroCopy; }
+
+	// The buffer ring may have been grown, so the owner must pick it up
+	// again after stopCapture() and before releasing the buffers.
+	struct buffer *buffers() const { return m_buffers; }
+	unsigned numBuffers() const { return m_nbuffers; }
+
+	// FrameSource
+	virtual CapFrame *getFrame();
+	virtual void putFrame(CapFrame *frame);
+	virtual void stats(CapStats &stats) const { m_stats.get(stats); }
+
+signals:
+	void frameReady();
+	void captureError(const QString &text);
+
+protected:
+	virtual void run();
+
+private:
+	bool capture();
+	void reclaim();
+	void wake();
+	void requeue(int index);
+	void growBuffers();
+	void freePool();
+
+	CapMethod m_method;
+	__u32 m_buftype;
+	struct buffer *m_buffers;
+	unsigned m_nbuffers;
+	unsigned m_frameSize;
+	bool m_adaptive;
+	bool m_zeroCopy;
+	unsigned m_maxBuffers;
+	struct timeval m_lastGrow;
+	int m_wakeFd;
+	QAtomicInt m_stop;
+	QAtomicInt m_notify;
+	CaptureStats m_stats;
+	CapFrame *m_pool;
+	unsigned m_poolSize;
+	CapFrame *m_spare[FRAME_POOL_SIZE];	// only used by the thread
+	unsigned m_nspare;
+	unsigned m_held;
+	unsigned char *m_scratch;
+	FrameRing m_free;
+	FrameRing m_ready;
+};
+
+#endif
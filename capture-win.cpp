@@ -21,28 +21,61 @@
 #include <QImage>
 #include <QVBoxLayout>
 #include <QCloseEvent>
+#include <QPainter>
 
 #include "qv4l2.h"
 #include "capture-win.h"
 
+void CaptureView::setImage(const QImage &image)
+{
+	if (image.size() != m_image.size())
+		setFixedSize(image.size());
+	m_image = image;
+	update();
+}
+
+void CaptureView::paintEvent(QPaintEvent *)
+{
+	QPainter painter(this);
+
+	painter.drawImage(0, 0, m_image);
+}
+
 CaptureWin::CaptureWin()
 {
 	QVBoxLayout *vbox = new QVBoxLayout(this);
 
 	setWindowTitle("V4L2 Capture");
-	m_label = new QLabel();
+	m_view = new CaptureView();
 	m_msg = new QLabel("No frame");
+	m_stats = new QLabel();
 
-	vbox->addWidget(m_label);
+	vbox->addWidget(m_view);
 	vbox->addWidget(m_msg);
+	vbox->addWidget(m_stats);
 }
 
 void CaptureWin::setImage(const QImage &image, const QString &status)
 {
-	m_label->setPixmap(QPixmap::fromImage(image));
+	m_view->setImage(image);
 	m_msg->setText(status);
 }
 
+void CaptureWin::setImage(const QImage &image)
+{
+	m_view->setImage(image);
+}
+
+void CaptureWin::setStatus(const QString &status)
+{
+	m_msg->setText(status);
+}
+
+void CaptureWin::setStats(const QString &stats)
+{
+	m_stats->setText(stats);
+}
+
 void CaptureWin::closeEvent(QCloseEvent *event)
 {
 	QWidget::closeEvent(event);
@@ -21,11 +21,28 @@
 #define CAPTURE_WIN_H
 
 #include <QWidget>
+#include <QImage>
 #include <sys/time.h>
 
-class QImage;
 class QLabel;
 
+// Paints the image as it is instead of turning it into a QPixmap first.
+// The image may point into memory it does not own, such as a driver
+// buffer, which must then stay valid until the next setImage() call.
+class CaptureView : public QWidget
+{
+public:
+	CaptureView(QWidget *parent = 0) : QWidget(parent) {}
+
+	void setImage(const QImage &image);
+
+protected:
+	virtual void paintEvent(QPaintEvent *event);
+
+private:
+	QImage m_image;
+};
+
 class CaptureWin : public QWidget
 {
 	Q_OBJECT
@@ -35,6 +52,9 @@ public:
 	virtual ~CaptureWin() {}
 
 	void setImage(const QImage &image, const QString &status);
+	void setImage(const QImage &image);
+	void setStatus(const QString &status);
+	void setStats(const QString &stats);
 
 protected:
 	virtual void closeEvent(QCloseEvent *event);
@@ -43,8 +63,9 @@ signals:
 	void close();
 
 private:
-	QLabel *m_label;
+	CaptureView *m_view;
 	QLabel *m_msg;
+	QLabel *m_stats;
 };
 
 #endif
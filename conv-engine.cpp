@@ -0,0 +1,398 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <QThread>
+#include <libv4lconvert.h>
+
+#include "conv-engine.h"
+
+// fewer rows than this are not worth handing to another thread
+#define CONV_MIN_ROWS 32
+
+static inline unsigned char clip(int v)
+{
+	return v > 0xff ? 0xff : (v < 0 ? 0 : v);
+}
+
+// The same integer approximation libv4lconvert uses, so both give
+// identical results.
+static inline void chroma(int u, int v, int &u1, int &rg, int &v1)
+{
+	u -= 128;
+	v -= 128;
+	u1 = (u * 129) >> 6;
+	rg = (u * 3 + v * 6) >> 3;
+	v1 = (v * 3) >> 1;
+}
+
+// bpp 3 is RGB24, bpp 4 is BGR32, the layout of QImage::Format_RGB32
+template <int bpp>
+static inline void putRgb(unsigned char *d, int y, int u1, int rg, int v1)
+{
+	if (bpp == 3) {
+		d[0] = clip(y + v1);
+		d[1] = clip(y - rg);
+		d[2] = clip(y + u1);
+	} else {
+		d[0] = clip(y + u1);
+		d[1] = clip(y - rg);
+		d[2] = clip(y + v1);
+		d[3] = 0xff;
+	}
+}
+
+// YUYV and UYVY, Y0 is the offset of the first luma sample of a pair
+template <int Y0, int U, int V, int bpp>
+static void convPacked(const ConvJob &job, unsigned y0, unsigned y1)
+{
+	for (unsigned y = y0; y < y1; y++) {
+		const unsigned char *s = job.src + y * job.srcStride;
+		unsigned char *d = job.dst + y * job.dstStride;
+		unsigned x = job.packed ? job.packed(s, d, job.width) : 0;
+
+		s += 2 * x;
+		d += bpp * x;
+		for (; x + 1 < job.width; x += 2) {
+			int u1, rg, v1;
+
+			chroma(s[U], s[V], u1, rg, v1);
+			putRgb<bpp>(d, s[Y0], u1, rg, v1);
+			putRgb<bpp>(d + bpp, s[Y0 + 2], u1, rg, v1);
+			s += 4;
+			d += 2 * bpp;
+		}
+	}
+}
+
+// YUV420 with separate U and V planes, or NV12 with interleaved chroma
+template <bool nv12, int bpp>
+static void convPlanar(const ConvJob &job, unsigned y0, unsigned y1)
+{
+	const unsigned char *uplane = job.src + job.srcStride * job.height;
+	unsigned cstride = nv12 ? job.srcStride : job.srcStride / 2;
+	const unsigned char *vplane = uplane + cstride * (job.height / 2);
+
+	for (unsigned y = y0; y < y1; y++) {
+		const unsigned char *s = job.src + y * job.srcStride;
+		const unsigned char *us = uplane + (y / 2) * cstride;
+		const unsigned char *vs = nv12 ? us + 1 : vplane + (y / 2) * cstride;
+		unsigned char *d = job.dst + y * job.dstStride;
+		unsigned x = job.planar ? job.planar(s, us, vs, d, job.width) : 0;
+
+		s += x;
+		us += nv12 ? x : x / 2;
+		vs += nv12 ? x : x / 2;
+		d += bpp * x;
+		for (; x + 1 < job.width; x += 2) {
+			int u1, rg, v1;
+
+			chroma(*us, *vs, u1, rg, v1);
+			putRgb<bpp>(d, s[0], u1, rg, v1);
+			putRgb<bpp>(d + bpp, s[1], u1, rg, v1);
+			s += 2;
+			us += nv12 ? 2 : 1;
+			vs += nv12 ? 2 : 1;
+			d += 2 * bpp;
+		}
+	}
+}
+
+template <int bpp>
+static ConvFunc findFunc(__u32 srcFormat)
+{
+	switch (srcFormat) {
+	case V4L2_PIX_FMT_YUYV:
+		return convPacked<0, 1, 3, bpp>;
+	case V4L2_PIX_FMT_UYVY:
+		return convPacked<1, 0, 2, bpp>;
+	case V4L2_PIX_FMT_YUV420:
+		return convPlanar<false, bpp>;
+	case V4L2_PIX_FMT_NV12:
+		return convPlanar<true, bpp>;
+	}
+	return NULL;
+}
+
+static ConvFunc findFunc(__u32 srcFormat, __u32 dstFormat)
+{
+	switch (dstFormat) {
+	case V4L2_PIX_FMT_RGB24:
+		return findFunc<3>(srcFormat);
+	case V4L2_PIX_FMT_BGR32:
+		return findFunc<4>(srcFormat);
+	}
+	return NULL;
+}
+
+void ConvStripe::convert()
+{
+	m_engine->convertRows(m_y0, m_y1);
+}
+
+void ConvStripe::run()
+{
+	convert();
+	m_engine->m_done.release();
+}
+
+ConvEngine::ConvEngine() :
+	m_func(NULL),
+	m_simd(true),
+	m_srcSize(0),
+	m_dstSize(0),
+	m_stripes(0)
+{
+	memset(&m_job, 0, sizeof(m_job));
+	// keep the workers around between frames
+	m_pool.setExpiryTimeout(-1);
+}
+
+ConvEngine::~ConvEngine()
+{
+	m_pool.waitForDone();
+}
+
+bool ConvEngine::supported(__u32 srcFormat, __u32 dstFormat)
+{
+	return findFunc(srcFormat, dstFormat) != NULL;
+}
+
+bool ConvEngine::setFormat(const v4l2_format &src, const v4l2_format &dst)
+{
+	const v4l2_pix_format &srcPix = src.fmt.pix;
+	const v4l2_pix_format &dstPix = dst.fmt.pix;
+	bool packed = srcPix.pixelformat == V4L2_PIX_FMT_YUYV ||
+		      srcPix.pixelformat == V4L2_PIX_FMT_UYVY;
+	unsigned bpp = dstPix.pixelformat == V4L2_PIX_FMT_BGR32 ? 4 : 3;
+	unsigned rows, threads;
+
+	m_pool.waitForDone();
+	m_func = findFunc(srcPix.pixelformat, dstPix.pixelformat);
+	if (m_func == NULL || srcPix.width != dstPix.width ||
+	    srcPix.height != dstPix.height || srcPix.width < 2) {
+		m_func = NULL;
+		return false;
+	}
+	m_job.width = srcPix.width;
+	m_job.height = srcPix.height;
+	m_job.srcStride = srcPix.bytesperline;
+	if (m_job.srcStride < srcPix.width * (packed ? 2 : 1))
+		m_job.srcStride = srcPix.width * (packed ? 2 : 1);
+	m_job.dstStride = dstPix.bytesperline;
+	if (m_job.dstStride < dstPix.width * bpp)
+		m_job.dstStride = dstPix.width * bpp;
+	m_srcSize = m_job.srcStride * m_job.height;
+	if (!packed)
+		m_srcSize += m_srcSize / 2;
+	m_dstSize = m_job.dstStride * m_job.height;
+	m_job.packed = NULL;
+	m_job.planar = NULL;
+	if (m_simd)
+		simdKernels(srcPix.pixelformat, bpp, m_job.packed, m_job.planar);
+
+	// idealThreadCount() is -1 if the number of cores is not known
+	threads = QThread::idealThreadCount() > 1 ? QThread::idealThreadCount() : 1;
+	m_stripes = m_job.height / CONV_MIN_ROWS;
+	if (m_stripes > threads)
+		m_stripes = threads;
+	if (m_stripes > CONV_MAX_STRIPES)
+		m_stripes = CONV_MAX_STRIPES;
+	if (m_stripes < 1)
+		m_stripes = 1;
+	// stripes start on an even row so 4:2:0 chroma rows are never shared
+	rows = ((m_job.height + m_stripes - 1) / m_stripes + 1) & ~1;
+	for (unsigned i = 0; i < m_stripes; i++) {
+		unsigned y0 = i * rows;
+		unsigned y1 = y0 + rows;
+
+		if (y0 > m_job.height)
+			y0 = m_job.height;
+		if (y1 > m_job.height)
+			y1 = m_job.height;
+		m_stripe[i].set(this, y0, y1);
+	}
+	m_pool.setMaxThreadCount(m_stripes > 1 ? m_stripes - 1 : 1);
+	return true;
+}
+
+int ConvEngine::convert(const unsigned char *src, unsigned size,
+		unsigned char *dst, unsigned dstSize)
+{
+	if (m_func == NULL || size < m_srcSize || dstSize < m_dstSize)
+		return -1;
+	m_job.src = src;
+	m_job.dst = dst;
+	// the calling thread takes the first stripe itself
+	for (unsigned i = 1; i < m_stripes; i++)
+		m_pool.start(&m_stripe[i]);
+	m_stripe[0].convert();
+	m_done.acquire(m_stripes - 1);
+	return m_dstSize;
+}
+
+static double now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Milliseconds per frame, the result of the last run is left in dst.
+static double timeEngine(ConvEngine &engine, bool simd, const v4l2_format &srcFmt,
+		const v4l2_format &dstFmt, unsigned char *src, unsigned char *dst, unsigned frames)
+{
+	double start;
+
+	engine.setSimd(simd);
+	engine.setFormat(srcFmt, dstFmt);
+	start = now();
+	for (unsigned i = 0; i < frames; i++)
+		engine.convert(src, srcFmt.fmt.pix.sizeimage, dst, dstFmt.fmt.pix.sizeimage);
+	return (now() - start) / frames;
+}
+
+int ConvEngine::benchmark(const char *device, unsigned frames)
+{
+	static const struct {
+		__u32 pixfmt;
+		bool packed;
+		const char *name;
+	} formats[] = {
+		{ V4L2_PIX_FMT_YUYV, true, "YUYV" },
+		{ V4L2_PIX_FMT_UYVY, true, "UYVY" },
+		{ V4L2_PIX_FMT_YUV420, false, "YU12" },
+		{ V4L2_PIX_FMT_NV12, false, "NV12" },
+	};
+	static const struct {
+		unsigned width, height;
+	} sizes[] = {
+		{ 720, 576 },
+		{ 1280, 720 },
+		{ 1920, 1080 },
+	};
+	struct v4lconvert_data *lib;
+	ConvEngine engine;
+	int fd;
+
+	// libv4lconvert wants a device, but the conversions used here never
+	// touch it
+	fd = ::open(device, O_RDWR);
+	lib = v4lconvert_create(fd);
+	if (lib == NULL)
+		printf("libv4lconvert not available, timing the engine only\n");
+	printf("%u frames per test, %d threads, %s kernels\n", frames,
+			QThread::idealThreadCount(), simdName());
+
+	for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		for (unsigned f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+			// widths that are not a multiple of 16 pixels exercise the
+			// scalar tail of the vector kernels
+			unsigned width = sizes[s].width + (f & 1) * 2;
+			unsigned height = sizes[s].height;
+			unsigned srcSize = formats[f].packed ? width * height * 2 : width * height * 3 / 2;
+			unsigned dstSize = width * height * 4;
+			unsigned char *src = (unsigned char *)malloc(srcSize);
+			unsigned char *scalar = (unsigned char *)malloc(dstSize);
+			unsigned char *vector = (unsigned char *)malloc(dstSize);
+			unsigned char *ref = (unsigned char *)malloc(dstSize);
+			v4l2_format srcFmt, dstFmt;
+			double scalarMs, vectorMs, libMs;
+			bool same = true;
+			unsigned seed = 1;
+			unsigned i;
+
+			if (!src || !scalar || !vector || !ref) {
+				free(src);
+				free(scalar);
+				free(vector);
+				free(ref);
+				fprintf(stderr, "out of memory\n");
+				return 1;
+			}
+			for (i = 0; i < srcSize; i++) {
+				seed = seed * 1103515245 + 12345;
+				src[i] = seed >> 16;
+			}
+			memset(&srcFmt, 0, sizeof(srcFmt));
+			srcFmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+			srcFmt.fmt.pix.width = width;
+			srcFmt.fmt.pix.height = height;
+			srcFmt.fmt.pix.pixelformat = formats[f].pixfmt;
+			srcFmt.fmt.pix.field = V4L2_FIELD_NONE;
+			srcFmt.fmt.pix.bytesperline = formats[f].packed ? width * 2 : width;
+			srcFmt.fmt.pix.sizeimage = srcSize;
+
+			// the vector kernels must match the scalar code exactly
+			dstFmt = srcFmt;
+			dstFmt.fmt.pix.pixelformat = V4L2_PIX_FMT_BGR32;
+			dstFmt.fmt.pix.bytesperline = width * 4;
+			dstFmt.fmt.pix.sizeimage = width * height * 4;
+			timeEngine(engine, false, srcFmt, dstFmt, src, scalar, 1);
+			timeEngine(engine, true, srcFmt, dstFmt, src, vector, 1);
+			if (memcmp(scalar, vector, dstFmt.fmt.pix.sizeimage))
+				same = false;
+
+			dstFmt.fmt.pix.pixelformat = V4L2_PIX_FMT_RGB24;
+			dstFmt.fmt.pix.bytesperline = width * 3;
+			dstFmt.fmt.pix.sizeimage = width * height * 3;
+			scalarMs = timeEngine(engine, false, srcFmt, dstFmt, src, scalar, frames);
+			vectorMs = timeEngine(engine, true, srcFmt, dstFmt, src, vector, frames);
+			if (memcmp(scalar, vector, dstFmt.fmt.pix.sizeimage))
+				same = false;
+			printf("%s %4ux%-4u: scalar %6.2f ms  %s %6.2f ms  %s",
+					formats[f].name, width, height, scalarMs,
+					simdName(), vectorMs, same ? "identical" : "DIFFERENT");
+
+			if (lib) {
+				libMs = now();
+				for (i = 0; i < frames; i++)
+					if (v4lconvert_convert(lib, &srcFmt, &dstFmt, src, srcSize,
+							ref, dstFmt.fmt.pix.sizeimage) < 0)
+						break;
+				if (i < frames) {
+					printf("  libv4lconvert failed: %s\n",
+						v4lconvert_get_error_message(lib));
+				} else {
+					libMs = (now() - libMs) / frames;
+					printf("  libv4lconvert %6.2f ms  %s\n", libMs,
+						memcmp(scalar, ref, dstFmt.fmt.pix.sizeimage) ?
+						"DIFFERENT" : "identical");
+				}
+			} else {
+				printf("\n");
+			}
+			free(src);
+			free(scalar);
+			free(vector);
+			free(ref);
+		}
+	}
+	if (lib)
+		v4lconvert_destroy(lib);
+	if (fd >= 0)
+		::close(fd);
+	return 0;
+}
@@ -0,0 +1,112 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef CONV_ENGINE_H
+#define CONV_ENGINE_H
+
+#include <cstddef>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSemaphore>
+#include <linux/videodev2.h>
+
+#include "conv-simd.h"
+
+#define CONV_MAX_STRIPES 8
+
+class ConvEngine;
+
+// The rows of one frame a single conversion call works on.
+struct ConvJob {
+	const unsigned char *src;
+	unsigned char *dst;
+	unsigned width;
+	unsigned height;
+	unsigned srcStride;	// bytes per line of the luma plane
+	unsigned dstStride;
+	SimdPacked packed;	// vectorized start of each row, or NULL
+	SimdPlanar planar;
+};
+
+typedef void (*ConvFunc)(const ConvJob &job, unsigned y0, unsigned y1);
+
+class ConvStripe : public QRunnable
+{
+public:
+	ConvStripe() : m_engine(NULL), m_y0(0), m_y1(0) { setAutoDelete(false); }
+
+	void set(ConvEngine *engine, unsigned y0, unsigned y1)
+	{
+		m_engine = engine;
+		m_y0 = y0;
+		m_y1 = y1;
+	}
+	// Converts the rows of the stripe.
+	void convert();
+	// Converts them from the pool, and tells the engine it is done.
+	virtual void run();
+
+private:
+	ConvEngine *m_engine;
+	unsigned m_y0, m_y1;
+};
+
+// Converts YUYV, UYVY, YUV420 and NV12 to RGB24 or the BGR32 layout
+// of QImage::Format_RGB32. The frame is split into horizontal stripes
+// that are converted in parallel. The results are identical to those
+// of libv4lconvert, which is still used for every other format.
+class ConvEngine
+{
+public:
+	ConvEngine();
+	~ConvEngine();
+
+	// Returns false if the formats are not handled here.
+	bool setFormat(const v4l2_format &src, const v4l2_format &dst);
+	bool isActive() const { return m_func != NULL; }
+	// Use the vectorized kernels if the CPU has them, takes effect with
+	// the next setFormat(). On by default.
+	void setSimd(bool simd) { m_simd = simd; }
+	// Returns the number of bytes written or -1 if the frame is too short.
+	int convert(const unsigned char *src, unsigned size,
+			unsigned char *dst, unsigned dstSize);
+
+	static bool supported(__u32 srcFormat, __u32 dstFormat);
+	// Compare against libv4lconvert on synthetic frames and print the
+	// results. Returns the exit code for main().
+	static int benchmark(const char *device, unsigned frames);
+
+private:
+	friend class ConvStripe;
+	void convertRows(unsigned y0, unsigned y1) { m_func(m_job, y0, y1); }
+
+	ConvFunc m_func;
+	bool m_simd;
+	ConvJob m_job;
+	unsigned m_srcSize;
+	unsigned m_dstSize;
+	unsigned m_stripes;
+	ConvStripe m_stripe[CONV_MAX_STRIPES];
+	QThreadPool m_pool;
+	// released once by each stripe the pool ran; waitForDone() would
+	// end the pool threads as well in Qt 4
+	QSemaphore m_done;
+};
+
+#endif
@@ -0,0 +1,707 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stddef.h>
+
+#include "conv-simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+// All kernels compute in 16 bit lanes with the same integer arithmetic as
+// chroma() in conv-engine.cpp. Clipping is done by saturating narrowing.
+
+#ifdef SIMD_X86
+
+// The kernels are built for their instruction set regardless of the
+// compiler flags and only called if the CPU has it.
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+static inline SSE2 void chroma_sse2(__m128i u, __m128i v,
+		__m128i &u1, __m128i &rg, __m128i &v1)
+{
+	const __m128i c128 = _mm_set1_epi16(128);
+
+	u = _mm_sub_epi16(u, c128);
+	v = _mm_sub_epi16(v, c128);
+	u1 = _mm_srai_epi16(_mm_mullo_epi16(u, _mm_set1_epi16(129)), 6);
+	rg = _mm_srai_epi16(_mm_add_epi16(_mm_mullo_epi16(u, _mm_set1_epi16(3)),
+				_mm_mullo_epi16(v, _mm_set1_epi16(6))), 3);
+	v1 = _mm_srai_epi16(_mm_mullo_epi16(v, _mm_set1_epi16(3)), 1);
+}
+
+// 16 pixels from their luma in ya and yb and 8 chroma pairs
+static inline SSE2 void rgb_sse2(__m128i ya, __m128i yb, __m128i u, __m128i v,
+		__m128i &r, __m128i &g, __m128i &b)
+{
+	__m128i u1, rg, v1;
+
+	chroma_sse2(u, v, u1, rg, v1);
+	r = _mm_packus_epi16(_mm_add_epi16(ya, _mm_unpacklo_epi16(v1, v1)),
+			     _mm_add_epi16(yb, _mm_unpackhi_epi16(v1, v1)));
+	g = _mm_packus_epi16(_mm_sub_epi16(ya, _mm_unpacklo_epi16(rg, rg)),
+			     _mm_sub_epi16(yb, _mm_unpackhi_epi16(rg, rg)));
+	b = _mm_packus_epi16(_mm_add_epi16(ya, _mm_unpacklo_epi16(u1, u1)),
+			     _mm_add_epi16(yb, _mm_unpackhi_epi16(u1, u1)));
+}
+
+static inline SSE2 void store_bgr32_sse2(unsigned char *d, __m128i r, __m128i g, __m128i b)
+{
+	const __m128i ff = _mm_set1_epi8((char)0xff);
+	__m128i bg = _mm_unpacklo_epi8(b, g);
+	__m128i ra = _mm_unpacklo_epi8(r, ff);
+
+	_mm_storeu_si128((__m128i *)d, _mm_unpacklo_epi16(bg, ra));
+	_mm_storeu_si128((__m128i *)(d + 16), _mm_unpackhi_epi16(bg, ra));
+	bg = _mm_unpackhi_epi8(b, g);
+	ra = _mm_unpackhi_epi8(r, ff);
+	_mm_storeu_si128((__m128i *)(d + 32), _mm_unpacklo_epi16(bg, ra));
+	_mm_storeu_si128((__m128i *)(d + 48), _mm_unpackhi_epi16(bg, ra));
+}
+
+// SSE2 has no byte shuffle, so RGB24 is interleaved by hand
+static inline SSE2 void store_rgb24_sse2(unsigned char *d, __m128i r, __m128i g, __m128i b)
+{
+	unsigned char rr[16], gg[16], bb[16];
+
+	_mm_storeu_si128((__m128i *)rr, r);
+	_mm_storeu_si128((__m128i *)gg, g);
+	_mm_storeu_si128((__m128i *)bb, b);
+	for (unsigned i = 0; i < 16; i++) {
+		d[0] = rr[i];
+		d[1] = gg[i];
+		d[2] = bb[i];
+		d += 3;
+	}
+}
+
+template <unsigned bpp>
+static inline SSE2 void store_sse2(unsigned char *d, __m128i r, __m128i g, __m128i b)
+{
+	if (bpp == 3)
+		store_rgb24_sse2(d, r, g, b);
+	else
+		store_bgr32_sse2(d, r, g, b);
+}
+
+template <bool uyvy, unsigned bpp>
+static SSE2 unsigned packed_sse2(const unsigned char *src, unsigned char *dst, unsigned width)
+{
+	const __m128i lowByte = _mm_set1_epi16(0xff);
+	unsigned x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)src);
+		__m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+		__m128i ya, yb, uv, r, g, bl;
+
+		if (uyvy) {
+			ya = _mm_srli_epi16(a, 8);
+			yb = _mm_srli_epi16(b, 8);
+			uv = _mm_packus_epi16(_mm_and_si128(a, lowByte), _mm_and_si128(b, lowByte));
+		} else {
+			ya = _mm_and_si128(a, lowByte);
+			yb = _mm_and_si128(b, lowByte);
+			uv = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+		}
+		rgb_sse2(ya, yb, _mm_and_si128(uv, lowByte), _mm_srli_epi16(uv, 8), r, g, bl);
+		store_sse2<bpp>(dst, r, g, bl);
+		src += 32;
+		dst += 16 * bpp;
+	}
+	return x;
+}
+
+template <bool nv12, unsigned bpp>
+static SSE2 unsigned planar_sse2(const unsigned char *y, const unsigned char *u,
+		const unsigned char *v, unsigned char *dst, unsigned width)
+{
+	const __m128i lowByte = _mm_set1_epi16(0xff);
+	const __m128i zero = _mm_setzero_si128();
+	unsigned x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		__m128i yy = _mm_loadu_si128((const __m128i *)y);
+		__m128i uu, vv, r, g, b;
+
+		if (nv12) {
+			__m128i uv = _mm_loadu_si128((const __m128i *)u);
+
+			uu = _mm_and_si128(uv, lowByte);
+			vv = _mm_srli_epi16(uv, 8);
+			u += 16;
+		} else {
+			uu = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)u), zero);
+			vv = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)v), zero);
+			u += 8;
+			v += 8;
+		}
+		rgb_sse2(_mm_unpacklo_epi8(yy, zero), _mm_unpackhi_epi8(yy, zero), uu, vv, r, g, b);
+		store_sse2<bpp>(dst, r, g, b);
+		y += 16;
+		dst += 16 * bpp;
+	}
+	return x;
+}
+
+static inline AVX2 void chroma_avx2(__m256i u, __m256i v,
+		__m256i &u1, __m256i &rg, __m256i &v1)
+{
+	const __m256i c128 = _mm256_set1_epi16(128);
+
+	u = _mm256_sub_epi16(u, c128);
+	v = _mm256_sub_epi16(v, c128);
+	u1 = _mm256_srai_epi16(_mm256_mullo_epi16(u, _mm256_set1_epi16(129)), 6);
+	rg = _mm256_srai_epi16(_mm256_add_epi16(_mm256_mullo_epi16(u, _mm256_set1_epi16(3)),
+				_mm256_mullo_epi16(v, _mm256_set1_epi16(6))), 3);
+	v1 = _mm256_srai_epi16(_mm256_mullo_epi16(v, _mm256_set1_epi16(3)), 1);
+}
+
+// Pack two registers of 16 pixels each into 32 bytes in pixel order.
+static inline AVX2 __m256i pack_avx2(__m256i a, __m256i b)
+{
+	return _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8);
+}
+
+static inline AVX2 void store_rgb24_avx2(unsigned char *d, __m128i r, __m128i g, __m128i b)
+{
+	static const signed char mask[3][3][16] = {
+		{
+			{ 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5 },
+			{ -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1 },
+			{ -1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1 },
+		}, {
+			{ -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1 },
+			{ 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10 },
+			{ -1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1 },
+		}, {
+			{ -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1 },
+			{ -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1 },
+			{ 10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15 },
+		},
+	};
+
+	for (unsigned i = 0; i < 3; i++) {
+		__m128i out = _mm_or_si128(
+			_mm_or_si128(_mm_shuffle_epi8(r, _mm_loadu_si128((const __m128i *)mask[i][0])),
+				     _mm_shuffle_epi8(g, _mm_loadu_si128((const __m128i *)mask[i][1]))),
+			_mm_shuffle_epi8(b, _mm_loadu_si128((const __m128i *)mask[i][2])));
+
+		_mm_storeu_si128((__m128i *)(d + 16 * i), out);
+	}
+}
+
+template <unsigned bpp>
+static inline AVX2 void store_avx2(unsigned char *d, __m256i r, __m256i g, __m256i b)
+{
+	if (bpp == 3) {
+		store_rgb24_avx2(d, _mm256_castsi256_si128(r), _mm256_castsi256_si128(g),
+				 _mm256_castsi256_si128(b));
+		store_rgb24_avx2(d + 48, _mm256_extracti128_si256(r, 1),
+				 _mm256_extracti128_si256(g, 1), _mm256_extracti128_si256(b, 1));
+	} else {
+		store_bgr32_sse2(d, _mm256_castsi256_si128(r), _mm256_castsi256_si128(g),
+				 _mm256_castsi256_si128(b));
+		store_bgr32_sse2(d + 64, _mm256_extracti128_si256(r, 1),
+				 _mm256_extracti128_si256(g, 1), _mm256_extracti128_si256(b, 1));
+	}
+}
+
+// 32 pixels from 16 chroma pairs, ya and yb hold pixels 0-15 and 16-31.
+// With lanes set the chroma pairs are in the order a lane-wise pack leaves
+// them in, otherwise they are in pixel order.
+template <unsigned bpp>
+static inline AVX2 void rgb_avx2(unsigned char *d, __m256i ya, __m256i yb,
+		__m256i u, __m256i v, bool lanes)
+{
+	__m256i u1, rg, v1, r, g, b, lo, hi;
+
+	chroma_avx2(u, v, u1, rg, v1);
+#define DUP(c)									\
+	lo = _mm256_unpacklo_epi16(c, c);					\
+	hi = _mm256_unpackhi_epi16(c, c);					\
+	if (!lanes) {								\
+		__m256i t = _mm256_permute2x128_si256(lo, hi, 0x20);		\
+		hi = _mm256_permute2x128_si256(lo, hi, 0x31);			\
+		lo = t;								\
+	}
+	DUP(v1);
+	r = pack_avx2(_mm256_add_epi16(ya, lo), _mm256_add_epi16(yb, hi));
+	DUP(rg);
+	g = pack_avx2(_mm256_sub_epi16(ya, lo), _mm256_sub_epi16(yb, hi));
+	DUP(u1);
+	b = pack_avx2(_mm256_add_epi16(ya, lo), _mm256_add_epi16(yb, hi));
+#undef DUP
+	store_avx2<bpp>(d, r, g, b);
+}
+
+template <bool uyvy, unsigned bpp>
+static AVX2 unsigned packed_avx2(const unsigned char *src, unsigned char *dst, unsigned width)
+{
+	const __m256i lowByte = _mm256_set1_epi16(0xff);
+	unsigned x;
+
+	for (x = 0; x + 32 <= width; x += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)src);
+		__m256i b = _mm256_loadu_si256((const __m256i *)(src + 32));
+		__m256i ya, yb, uv;
+
+		if (uyvy) {
+			ya = _mm256_srli_epi16(a, 8);
+			yb = _mm256_srli_epi16(b, 8);
+			uv = _mm256_packus_epi16(_mm256_and_si256(a, lowByte),
+						 _mm256_and_si256(b, lowByte));
+		} else {
+			ya = _mm256_and_si256(a, lowByte);
+			yb = _mm256_and_si256(b, lowByte);
+			uv = _mm256_packus_epi16(_mm256_srli_epi16(a, 8),
+						 _mm256_srli_epi16(b, 8));
+		}
+		// The lane-wise pack leaves chroma pairs 0-3 and 8-11 in the
+		// low lane, so unpacking them lines up with ya and yb as is.
+		rgb_avx2<bpp>(dst, ya, yb, _mm256_and_si256(uv, lowByte),
+			      _mm256_srli_epi16(uv, 8), true);
+		src += 64;
+		dst += 32 * bpp;
+	}
+	return x;
+}
+
+template <bool nv12, unsigned bpp>
+static AVX2 unsigned planar_avx2(const unsigned char *y, const unsigned char *u,
+		const unsigned char *v, unsigned char *dst, unsigned width)
+{
+	const __m256i lowByte = _mm256_set1_epi16(0xff);
+	unsigned x;
+
+	for (x = 0; x + 32 <= width; x += 32) {
+		__m256i yy = _mm256_loadu_si256((const __m256i *)y);
+		__m256i uu, vv;
+
+		if (nv12) {
+			__m256i uv = _mm256_loadu_si256((const __m256i *)u);
+
+			uu = _mm256_and_si256(uv, lowByte);
+			vv = _mm256_srli_epi16(uv, 8);
+			u += 32;
+		} else {
+			uu = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)u));
+			vv = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)v));
+			u += 16;
+			v += 16;
+		}
+		rgb_avx2<bpp>(dst, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(yy)),
+			      _mm256_cvtepu8_epi16(_mm256_extracti128_si256(yy, 1)),
+			      uu, vv, false);
+		y += 32;
+		dst += 32 * bpp;
+	}
+	return x;
+}
+
+template <bool uyvy>
+static SSE2 unsigned luma_sse2(const unsigned char *src, unsigned char *dst, unsigned width)
+{
+	const __m128i lowByte = _mm_set1_epi16(0xff);
+	unsigned x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)src);
+		__m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+
+		if (uyvy)
+			a = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+		else
+			a = _mm_packus_epi16(_mm_and_si128(a, lowByte), _mm_and_si128(b, lowByte));
+		_mm_storeu_si128((__m128i *)dst, a);
+		src += 32;
+		dst += 16;
+	}
+	return x;
+}
+
+static SSE2 unsigned sum_sse2(const unsigned char *src, unsigned n, unsigned &sum)
+{
+	__m128i acc = _mm_setzero_si128();
+	unsigned x;
+
+	for (x = 0; x + 16 <= n; x += 16)
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(src + x)),
+					_mm_setzero_si128()));
+	sum = _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+	return x;
+}
+
+// The K-weighting filters run along the samples, so the lanes hold
+// channels. Each lane does the same double operations in the same order
+// as Loudness::filter().
+static inline SSE2 void kweight2_sse2(const double *coef, double *z, unsigned zstride,
+		const float *x, unsigned channels, unsigned n, double *sum)
+{
+	const __m128d b00 = _mm_set1_pd(coef[0]), b01 = _mm_set1_pd(coef[1]);
+	const __m128d b02 = _mm_set1_pd(coef[2]), a01 = _mm_set1_pd(coef[3]);
+	const __m128d a02 = _mm_set1_pd(coef[4]), a11 = _mm_set1_pd(coef[5]);
+	const __m128d a12 = _mm_set1_pd(coef[6]), m2 = _mm_set1_pd(-2.0);
+	__m128d z00 = _mm_loadu_pd(z), z01 = _mm_loadu_pd(z + zstride);
+	__m128d z10 = _mm_loadu_pd(z + 2 * zstride), z11 = _mm_loadu_pd(z + 3 * zstride);
+	__m128d acc = _mm_setzero_pd();
+
+	for (unsigned i = 0; i < n; i++) {
+		__m128d v = _mm_cvtps_pd(_mm_castsi128_ps(
+				_mm_loadl_epi64((const __m128i *)(x + i * channels))));
+		__m128d y = _mm_add_pd(_mm_mul_pd(b00, v), z00);
+
+		z00 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(b01, v), _mm_mul_pd(a01, y)), z01);
+		z01 = _mm_sub_pd(_mm_mul_pd(b02, v), _mm_mul_pd(a02, y));
+		v = y;
+		y = _mm_add_pd(v, z10);
+		z10 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(m2, v), _mm_mul_pd(a11, y)), z11);
+		z11 = _mm_sub_pd(v, _mm_mul_pd(a12, y));
+		acc = _mm_add_pd(acc, _mm_mul_pd(y, y));
+	}
+	_mm_storeu_pd(z, z00);
+	_mm_storeu_pd(z + zstride, z01);
+	_mm_storeu_pd(z + 2 * zstride, z10);
+	_mm_storeu_pd(z + 3 * zstride, z11);
+	_mm_storeu_pd(sum, _mm_add_pd(_mm_loadu_pd(sum), acc));
+}
+
+static SSE2 unsigned kweight_sse2(const double *coef, double *z, unsigned zstride,
+		const float *x, unsigned channels, unsigned n, double *sum)
+{
+	unsigned c;
+
+	for (c = 0; c + 2 <= channels; c += 2)
+		kweight2_sse2(coef, z + c, zstride, x + c, channels, n, sum + c);
+	return c;
+}
+
+static inline AVX2 void kweight4_avx2(const double *coef, double *z, unsigned zstride,
+		const float *x, unsigned channels, unsigned n, double *sum)
+{
+	const __m256d b00 = _mm256_set1_pd(coef[0]), b01 = _mm256_set1_pd(coef[1]);
+	const __m256d b02 = _mm256_set1_pd(coef[2]), a01 = _mm256_set1_pd(coef[3]);
+	const __m256d a02 = _mm256_set1_pd(coef[4]), a11 = _mm256_set1_pd(coef[5]);
+	const __m256d a12 = _mm256_set1_pd(coef[6]), m2 = _mm256_set1_pd(-2.0);
+	__m256d z00 = _mm256_loadu_pd(z), z01 = _mm256_loadu_pd(z + zstride);
+	__m256d z10 = _mm256_loadu_pd(z + 2 * zstride), z11 = _mm256_loadu_pd(z + 3 * zstride);
+	__m256d acc = _mm256_setzero_pd();
+
+	for (unsigned i = 0; i < n; i++) {
+		__m256d v = _mm256_cvtps_pd(_mm_loadu_ps(x + i * channels));
+		__m256d y = _mm256_add_pd(_mm256_mul_pd(b00, v), z00);
+
+		z00 = _mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(b01, v), _mm256_mul_pd(a01, y)), z01);
+		z01 = _mm256_sub_pd(_mm256_mul_pd(b02, v), _mm256_mul_pd(a02, y));
+		v = y;
+		y = _mm256_add_pd(v, z10);
+		z10 = _mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(m2, v), _mm256_mul_pd(a11, y)), z11);
+		z11 = _mm256_sub_pd(v, _mm256_mul_pd(a12, y));
+		acc = _mm256_add_pd(acc, _mm256_mul_pd(y, y));
+	}
+	_mm256_storeu_pd(z, z00);
+	_mm256_storeu_pd(z + zstride, z01);
+	_mm256_storeu_pd(z + 2 * zstride, z10);
+	_mm256_storeu_pd(z + 3 * zstride, z11);
+	_mm256_storeu_pd(sum, _mm256_add_pd(_mm256_loadu_pd(sum), acc));
+}
+
+static AVX2 unsigned kweight_avx2(const double *coef, double *z, unsigned zstride,
+		const float *x, unsigned channels, unsigned n, double *sum)
+{
+	unsigned c;
+
+	for (c = 0; c + 4 <= channels; c += 4)
+		kweight4_avx2(coef, z + c, zstride, x + c, channels, n, sum + c);
+	// stereo, or the front pair of 5.1
+	if (c + 2 <= channels) {
+		kweight2_sse2(coef, z + c, zstride, x + c, channels, n, sum + c);
+		c += 2;
+	}
+	return c;
+}
+
+#endif
+
+#ifdef SIMD_NEON
+
+// 16 pixels from 8 chroma pairs and the luma of the even and odd pixels
+static inline void rgb_neon(uint8x8_t ye, uint8x8_t yo, uint8x8_t u, uint8x8_t v,
+		uint8x16_t &r, uint8x16_t &g, uint8x16_t &b)
+{
+	int16x8_t uu = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(u)), vdupq_n_s16(128));
+	int16x8_t vv = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v)), vdupq_n_s16(128));
+	int16x8_t u1 = vshrq_n_s16(vmulq_n_s16(uu, 129), 6);
+	int16x8_t rg = vshrq_n_s16(vaddq_s16(vmulq_n_s16(uu, 3), vmulq_n_s16(vv, 6)), 3);
+	int16x8_t v1 = vshrq_n_s16(vmulq_n_s16(vv, 3), 1);
+	int16x8_t e = vreinterpretq_s16_u16(vmovl_u8(ye));
+	int16x8_t o = vreinterpretq_s16_u16(vmovl_u8(yo));
+	uint8x8x2_t z;
+
+	z = vzip_u8(vqmovun_s16(vaddq_s16(e, v1)), vqmovun_s16(vaddq_s16(o, v1)));
+	r = vcombine_u8(z.val[0], z.val[1]);
+	z = vzip_u8(vqmovun_s16(vsubq_s16(e, rg)), vqmovun_s16(vsubq_s16(o, rg)));
+	g = vcombine_u8(z.val[0], z.val[1]);
+	z = vzip_u8(vqmovun_s16(vaddq_s16(e, u1)), vqmovun_s16(vaddq_s16(o, u1)));
+	b = vcombine_u8(z.val[0], z.val[1]);
+}
+
+template <unsigned bpp>
+static inline void store_neon(unsigned char *d, uint8x16_t r, uint8x16_t g, uint8x16_t b)
+{
+	if (bpp == 3) {
+		uint8x16x3_t t;
+
+		t.val[0] = r;
+		t.val[1] = g;
+		t.val[2] = b;
+		vst3q_u8(d, t);
+	} else {
+		uint8x16x4_t t;
+
+		t.val[0] = b;
+		t.val[1] = g;
+		t.val[2] = r;
+		t.val[3] = vdupq_n_u8(0xff);
+		vst4q_u8(d, t);
+	}
+}
+
+template <bool uyvy, unsigned bpp>
+static unsigned packed_neon(const unsigned char *src, unsigned char *dst, unsigned width)
+{
+	unsigned x;
+
+	for (x = 0; x + 32 <= width; x += 32) {
+		uint8x16x4_t p = vld4q_u8(src);
+		uint8x16_t ye = p.val[uyvy ? 1 : 0];
+		uint8x16_t u = p.val[uyvy ? 0 : 1];
+		uint8x16_t yo = p.val[uyvy ? 3 : 2];
+		uint8x16_t v = p.val[uyvy ? 2 : 3];
+		uint8x16_t r, g, b;
+
+		rgb_neon(vget_low_u8(ye), vget_low_u8(yo), vget_low_u8(u), vget_low_u8(v), r, g, b);
+		store_neon<bpp>(dst, r, g, b);
+		rgb_neon(vget_high_u8(ye), vget_high_u8(yo), vget_high_u8(u), vget_high_u8(v), r, g, b);
+		store_neon<bpp>(dst + 16 * bpp, r, g, b);
+		src += 64;
+		dst += 32 * bpp;
+	}
+	return x;
+}
+
+template <bool nv12, unsigned bpp>
+static unsigned planar_neon(const unsigned char *y, const unsigned char *u,
+		const unsigned char *v, unsigned char *dst, unsigned width)
+{
+	unsigned x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		uint8x8x2_t yy = vld2_u8(y);
+		uint8x8_t uu, vv;
+		uint8x16_t r, g, b;
+
+		if (nv12) {
+			uint8x8x2_t uv = vld2_u8(u);
+
+			uu = uv.val[0];
+			vv = uv.val[1];
+			u += 16;
+		} else {
+			uu = vld1_u8(u);
+			vv = vld1_u8(v);
+			u += 8;
+			v += 8;
+		}
+		rgb_neon(yy.val[0], yy.val[1], uu, vv, r, g, b);
+		store_neon<bpp>(dst, r, g, b);
+		y += 16;
+		dst += 16 * bpp;
+	}
+	return x;
+}
+
+template <bool uyvy>
+static unsigned luma_neon(const unsigned char *src, unsigned char *dst, unsigned width)
+{
+	unsigned x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		uint8x16x2_t p = vld2q_u8(src);
+
+		vst1q_u8(dst, p.val[uyvy ? 1 : 0]);
+		src += 32;
+		dst += 16;
+	}
+	return x;
+}
+
+static unsigned sum_neon(const unsigned char *src, unsigned n, unsigned &sum)
+{
+	uint32x4_t acc = vdupq_n_u32(0);
+	unsigned x;
+
+	for (x = 0; x + 16 <= n; x += 16)
+		acc = vpadalq_u16(acc, vpaddlq_u8(vld1q_u8(src + x)));
+	sum = vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) +
+		vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+	return x;
+}
+
+#endif
+
+enum SimdLevel {
+	simdNone,
+	simdSSE2,
+	simdAVX2,
+	simdNEON,
+};
+
+static SimdLevel simdLevel()
+{
+	static int level = -1;
+
+	if (level >= 0)
+		return (SimdLevel)level;
+#if defined(SIMD_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		level = simdAVX2;
+	else if (__builtin_cpu_supports("sse2"))
+		level = simdSSE2;
+	else
+		level = simdNone;
+#elif defined(SIMD_NEON)
+	level = simdNEON;
+#else
+	level = simdNone;
+#endif
+	return (SimdLevel)level;
+}
+
+const char *simdName()
+{
+	switch (simdLevel()) {
+	case simdSSE2:
+		return "SSE2";
+	case simdAVX2:
+		return "AVX2";
+	case simdNEON:
+		return "NEON";
+	default:
+		return "none";
+	}
+}
+
+#define PICK(isa)								\
+	switch (srcFormat) {							\
+	case V4L2_PIX_FMT_YUYV:							\
+		packed = packed_##isa<false, bpp>;				\
+		break;								\
+	case V4L2_PIX_FMT_UYVY:							\
+		packed = packed_##isa<true, bpp>;				\
+		break;								\
+	case V4L2_PIX_FMT_YUV420:						\
+		planar = planar_##isa<false, bpp>;				\
+		break;								\
+	case V4L2_PIX_FMT_NV12:							\
+		planar = planar_##isa<true, bpp>;				\
+		break;								\
+	}
+
+template <unsigned bpp>
+static void pick(__u32 srcFormat, SimdPacked &packed, SimdPlanar &planar)
+{
+	switch (simdLevel()) {
+#ifdef SIMD_X86
+	case simdSSE2:
+		PICK(sse2);
+		break;
+	case simdAVX2:
+		PICK(avx2);
+		break;
+#endif
+#ifdef SIMD_NEON
+	case simdNEON:
+		PICK(neon);
+		break;
+#endif
+	default:
+		break;
+	}
+}
+
+void simdKernels(__u32 srcFormat, unsigned bpp, SimdPacked &packed, SimdPlanar &planar)
+{
+	packed = NULL;
+	planar = NULL;
+	if (bpp == 3)
+		pick<3>(srcFormat, packed, planar);
+	else if (bpp == 4)
+		pick<4>(srcFormat, packed, planar);
+}
+
+void simdLumaKernels(__u32 srcFormat, SimdLuma &luma, SimdSum &sum)
+{
+	bool uyvy = srcFormat == V4L2_PIX_FMT_UYVY || srcFormat == V4L2_PIX_FMT_VYUY;
+	bool packed = uyvy || srcFormat == V4L2_PIX_FMT_YUYV || srcFormat == V4L2_PIX_FMT_YVYU;
+
+	luma = NULL;
+	sum = NULL;
+	switch (simdLevel()) {
+#ifdef SIMD_X86
+	case simdSSE2:
+	case simdAVX2:
+		if (packed)
+			luma = uyvy ? luma_sse2<true> : luma_sse2<false>;
+		sum = sum_sse2;
+		break;
+#endif
+#ifdef SIMD_NEON
+	case simdNEON:
+		if (packed)
+			luma = uyvy ? luma_neon<true> : luma_neon<false>;
+		sum = sum_neon;
+		break;
+#endif
+	default:
+		break;
+	}
+}
+
+SimdKWeight simdKWeightKernel()
+{
+	switch (simdLevel()) {
+#ifdef SIMD_X86
+	case simdSSE2:
+		return kweight_sse2;
+	case simdAVX2:
+		return kweight_avx2;
+#endif
+	default:
+		// NEON has no double lanes before ARMv8, the caller filters
+		return NULL;
+	}
+}
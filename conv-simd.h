@@ -0,0 +1,60 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef CONV_SIMD_H
+#define CONV_SIMD_H
+
+#include <linux/videodev2.h>
+
+// Vectorized row converters. They convert as many pixels from the start
+// of a row as suits them and return that number, the caller converts
+// the rest. Results are identical to the scalar code in conv-engine.cpp.
+
+// YUYV or UYVY
+typedef unsigned (*SimdPacked)(const unsigned char *src, unsigned char *dst,
+		unsigned width);
+// Separate U and V rows, or for NV12 the interleaved row in u and v unused.
+typedef unsigned (*SimdPlanar)(const unsigned char *y, const unsigned char *u,
+		const unsigned char *v, unsigned char *dst, unsigned width);
+
+// Pick the kernels for the best instruction set this CPU has, bpp is
+// 3 for RGB24 and 4 for BGR32. Both are set to NULL if there are none.
+void simdKernels(__u32 srcFormat, unsigned bpp, SimdPacked &packed, SimdPlanar &planar);
+// Luma of a packed YUV row, only for YUYV, YVYU, UYVY and VYUY.
+typedef unsigned (*SimdLuma)(const unsigned char *src, unsigned char *dst, unsigned width);
+// Sum of the first bytes of a row, the number of bytes summed is returned.
+typedef unsigned (*SimdSum)(const unsigned char *src, unsigned n, unsigned &sum);
+
+// The kernels of the picture detectors. The sum kernel suits any format,
+// the luma kernel is NULL if the format is not packed YUV.
+void simdLumaKernels(__u32 srcFormat, SimdLuma &luma, SimdSum &sum);
+// Both K-weighting biquads of BS.1770 over n frames of interleaved
+// samples, several channels at a time. coef holds b0, b1, b2, a1, a2 of
+// the shelf, then a1, a2 of the high-pass. State k of channel c is at
+// z[k * zstride + c], the squares of the output are added to sum[c]. The
+// first channels are filtered, their number is returned.
+typedef unsigned (*SimdKWeight)(const double *coef, double *z, unsigned zstride,
+		const float *x, unsigned channels, unsigned n, double *sum);
+
+// NULL if there is no kernel for this CPU.
+SimdKWeight simdKWeightKernel();
+// Name of the instruction set simdKernels() uses.
+const char *simdName();
+
+#endif
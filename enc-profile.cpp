@@ -0,0 +1,189 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <QThread>
+
+#include "enc-profile.h"
+
+static const EncProfile profiles[] = {
+	{ "x264", "x264enc", "speed-preset=ultrafast tune=zerolatency",
+		"threads", 0, "matroskamux", "mkv" },
+	{ "vp8", "vp8enc", "deadline=1 cpu-used=8",
+		"threads", 0, "webmmux", "webm" },
+	{ "mjpeg", "jpegenc", "quality=85",
+		NULL, 0, "matroskamux", "mkv" },
+	{ "theora", "theoraenc", "quality=63",
+		NULL, 0, "oggmux", "ogg" },
+};
+
+#define NUM_PROFILES (sizeof(profiles) / sizeof(profiles[0]))
+
+const EncProfile *encProfile(const char *name)
+{
+	for (unsigned i = 0; i < NUM_PROFILES; i++)
+		if (!strcmp(profiles[i].name, name))
+			return &profiles[i];
+	return NULL;
+}
+
+const EncProfile *encDefaultProfile()
+{
+	return encProfile("theora");
+}
+
+const char *encProfileNames()
+{
+	static char names[64];
+
+	if (names[0] == 0) {
+		for (unsigned i = 0; i < NUM_PROFILES; i++) {
+			if (i)
+				strcat(names, " ");
+			strcat(names, profiles[i].name);
+		}
+	}
+	return names;
+}
+
+GstElement *encCreate(const EncProfile *profile, unsigned threads)
+{
+	GstElement *enc = gst_element_factory_make(profile->encoder, NULL);
+	gchar **settings;
+
+	if (enc == NULL)
+		return NULL;
+	settings = g_strsplit(profile->settings, " ", 0);
+	for (unsigned i = 0; settings[i]; i++) {
+		char *value = strchr(settings[i], '=');
+
+		if (value == NULL)
+			continue;
+		*value++ = 0;
+		gst_util_set_object_arg(G_OBJECT(enc), settings[i], value);
+	}
+	g_strfreev(settings);
+
+	if (threads == 0)
+		threads = profile->threads;
+	if (threads == 0)
+		threads = QThread::idealThreadCount();
+	if (profile->threadsProperty)
+		g_object_set(G_OBJECT(enc), profile->threadsProperty, threads, NULL);
+	return enc;
+}
+
+static double cpuSeconds()
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+		ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static double wallSeconds()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int encBenchmark(unsigned frames)
+{
+	const unsigned fps = 25;
+
+	gst_init(NULL, NULL);
+	printf("%u frames of 720x576 at %u fps per profile, %d threads\n",
+			frames, fps, QThread::idealThreadCount());
+	printf("%-8s %10s %12s\n", "profile", "realtime", "ms cpu/frame");
+	for (unsigned i = 0; i < NUM_PROFILES; i++) {
+		const EncProfile *profile = &profiles[i];
+		GstElement *pipeline, *src, *filter, *convert, *enc, *sink;
+		GstCaps *caps;
+		GstBus *bus;
+		GstMessage *msg;
+		double wall, cpu;
+
+		pipeline = gst_pipeline_new("benchmark");
+		src = gst_element_factory_make("videotestsrc", NULL);
+		filter = gst_element_factory_make("capsfilter", NULL);
+		convert = gst_element_factory_make("videoconvert", NULL);
+		enc = encCreate(profile, 0);
+		sink = gst_element_factory_make("fakesink", NULL);
+		if (!src || !filter || !convert || !enc || !sink) {
+			printf("%-8s %s not available\n", profile->name,
+					enc ? "test elements" : profile->encoder);
+			if (src)
+				gst_object_unref(src);
+			if (filter)
+				gst_object_unref(filter);
+			if (convert)
+				gst_object_unref(convert);
+			if (enc)
+				gst_object_unref(enc);
+			if (sink)
+				gst_object_unref(sink);
+			gst_object_unref(pipeline);
+			continue;
+		}
+		// a busy pattern, a flat one flatters the encoders
+		g_object_set(G_OBJECT(src), "num-buffers", frames, NULL);
+		gst_util_set_object_arg(G_OBJECT(src), "pattern", "snow");
+		caps = gst_caps_new_simple("video/x-raw",
+				"format", G_TYPE_STRING, "I420",
+				"width", G_TYPE_INT, 720,
+				"height", G_TYPE_INT, 576,
+				"framerate", GST_TYPE_FRACTION, fps, 1,
+				NULL);
+		g_object_set(G_OBJECT(filter), "caps", caps, NULL);
+		gst_caps_unref(caps);
+		gst_bin_add_many(GST_BIN(pipeline), src, filter, convert, enc, sink, NULL);
+		if (!gst_element_link_many(src, filter, convert, enc, sink, NULL)) {
+			printf("%-8s cannot link\n", profile->name);
+			gst_object_unref(pipeline);
+			continue;
+		}
+
+		wall = wallSeconds();
+		cpu = cpuSeconds();
+		gst_element_set_state(pipeline, GST_STATE_PLAYING);
+		bus = gst_element_get_bus(pipeline);
+		msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+				(GstMessageType)(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+		wall = wallSeconds() - wall;
+		cpu = cpuSeconds() - cpu;
+		if (msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR)
+			printf("%-8s failed\n", profile->name);
+		else
+			printf("%-8s %9.2fx %12.2f\n", profile->name,
+					frames / (double)fps / wall, cpu * 1000 / frames);
+		if (msg)
+			gst_message_unref(msg);
+		gst_object_unref(bus);
+		gst_element_set_state(pipeline, GST_STATE_NULL);
+		gst_object_unref(pipeline);
+	}
+	return 0;
+}
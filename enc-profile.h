@@ -0,0 +1,51 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef ENC_PROFILE_H
+#define ENC_PROFILE_H
+
+#include <gst/gst.h>
+
+// How the GStreamer engine records: which video encoder, how it is set
+// up and what container it goes into. Audio is always Vorbis.
+struct EncProfile {
+	const char *name;
+	const char *encoder;		// element factory
+	const char *settings;		// property=value pairs, blank separated
+	const char *threadsProperty;	// NULL if the encoder is single threaded
+	unsigned threads;		// 0 for one per core
+	const char *muxer;
+	const char *extension;
+};
+
+// NULL if there is no profile of that name.
+const EncProfile *encProfile(const char *name);
+const EncProfile *encDefaultProfile();
+// For the help text, blank separated.
+const char *encProfileNames();
+
+// Creates the encoder of the profile, with threads overriding the
+// profile's thread count unless it is 0. NULL if it is not installed.
+GstElement *encCreate(const EncProfile *profile, unsigned threads);
+
+// Encodes frames of a test pattern with every profile and prints how
+// much faster than real time each one is and the CPU time per frame.
+int encBenchmark(unsigned frames);
+
+#endif
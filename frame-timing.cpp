@@ -0,0 +1,102 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "frame-timing.h"
+
+// frame rate is measured over periods of this many usecs
+#define FPS_PERIOD	500000
+// and the status text is refreshed at most this often
+#define STATUS_PERIOD	250000
+
+long long FrameTiming::now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+void FrameTiming::reset()
+{
+	m_count = 0;
+	m_periodFrames = 0;
+	m_periodStart = -1;
+	m_lastTimestamp = 0;
+	m_lastUpdate = 0;
+	m_monotonic = false;
+	m_fps = 0;
+	m_latency = -1;
+	m_avgLatency = -1;
+}
+
+void FrameTiming::frames(unsigned count, const struct timeval &timestamp, __u32 flags)
+{
+	long long ts;
+
+	m_monotonic = (flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+	ts = m_monotonic ? timestamp.tv_sec * 1000000LL + timestamp.tv_usec : now();
+	m_count += count;
+	m_lastTimestamp = ts;
+
+	// the first frame only starts the clock
+	if (m_periodStart < 0 || ts < m_periodStart) {
+		m_periodStart = ts;
+		m_periodFrames = 0;
+		return;
+	}
+	m_periodFrames += count;
+	if (ts - m_periodStart >= FPS_PERIOD) {
+		double fps = m_periodFrames * 1000000.0 / (ts - m_periodStart);
+
+		m_fps = m_fps ? (m_fps + fps) / 2 : fps;
+		m_periodStart = ts;
+		m_periodFrames = 0;
+	}
+}
+
+void FrameTiming::displayed()
+{
+	if (!m_monotonic)
+		return;
+	m_latency = now() - m_lastTimestamp;
+	if (m_avgLatency < 0)
+		m_avgLatency = m_latency;
+	else
+		m_avgLatency += (m_latency - m_avgLatency) / 8;
+}
+
+bool FrameTiming::update()
+{
+	long long t = now();
+	char buf[80];
+
+	if (t - m_lastUpdate < STATUS_PERIOD)
+		return false;
+	m_lastUpdate = t;
+	if (m_avgLatency >= 0)
+		snprintf(buf, sizeof(buf), "Frame: %u Fps: %.1f Latency: %.1f ms",
+				m_count, m_fps, m_avgLatency / 1000.0);
+	else
+		snprintf(buf, sizeof(buf), "Frame: %u Fps: %.1f", m_count, m_fps);
+	m_status = buf;
+	return true;
+}
@@ -0,0 +1,69 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef FRAME_TIMING_H
+#define FRAME_TIMING_H
+
+#include <QString>
+#include <sys/time.h>
+#include <linux/videodev2.h>
+
+// Frame rate and capture to display latency of a capture session.
+// Driver timestamps are used when they are taken from CLOCK_MONOTONIC,
+// otherwise frames are timed when they arrive. Either way the result is
+// immune to wall clock adjustments.
+class FrameTiming
+{
+public:
+	FrameTiming() { reset(); }
+
+	void reset();
+	// Account for count frames. The timestamp and flags are those of the
+	// newest one.
+	void frames(unsigned count, const struct timeval &timestamp, __u32 flags);
+	// Call right after the newest frame was shown.
+	void displayed();
+
+	unsigned count() const { return m_count; }
+	double fps() const { return m_fps; }
+	// capture to display latency of the last shown frame in usecs, or
+	// -1 if the driver timestamps cannot be compared to our clock
+	int latency() const { return m_latency; }
+
+	// Returns true a few times per second, status() is then up to date.
+	// Keeps the status text from being rebuilt for every frame.
+	bool update();
+	const QString &status() const { return m_status; }
+
+	static long long now();
+
+private:
+	unsigned m_count;
+	unsigned m_periodFrames;
+	long long m_periodStart;
+	long long m_lastTimestamp;
+	long long m_lastUpdate;
+	bool m_monotonic;
+	double m_fps;
+	int m_latency;
+	int m_avgLatency;
+	QString m_status;
+};
+
+#endif
@@ -31,8 +31,9 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <unistd.h>
 
-GeneralTab::GeneralTab(const QString &device, v4l2 &fd, int n, QWidget *parent, QProgressBar *pl1, QProgressBar *pr1) :
+GeneralTab::GeneralTab(const QString &device, v4l2 &fd, int n, QWidget *parent, QProgressBar *pl1, QProgressBar *pr1, QLabel *loud1) :
 	QGridLayout(parent),
 	v4l2(fd),
 	m_row(0),
@@ -51,7 +52,9 @@ GeneralTab::GeneralTab(const QString &device, v4l2 &fd, int n, QWidget *parent,
 	m_vidCapFormats(NULL),
 	m_frameSize(NULL),
 	m_vidOutFormats(NULL),
-	m_vbiMethods(NULL)
+	m_vbiMethods(NULL),
+	m_numBuffers(NULL),
+	m_adaptiveBuffers(NULL)
 {
 	setSpacing(3);
 
@@ -248,6 +251,7 @@ GeneralTab::GeneralTab(const QString &device, v4l2 &fd, int n, QWidget *parent,
     // new code 2017 - create ListBox with the list of preset channels with frequencies
     pg1left = pl1;
     pg1right = pr1;
+    loudlabel1 = loud1;
 
     QHBoxLayout *chanlayout = new QHBoxLayout();
     chantable = new QTableWidget(parent);
@@ -416,7 +420,13 @@ capture_method:
 			reqbufs_user(reqbuf, 0);
 		}
 		if (reqbufs_mmap(reqbuf, 1)) {
+			int fd;
+
 			m_capMethods->addItem("Memory mapped I/O", QVariant(methodMmap));
+			if (expbuf(m_buftype, 0, fd)) {
+				m_capMethods->addItem("DMA buffer export", QVariant(methodDmabuf));
+				::close(fd);
+			}
 			reqbufs_mmap(reqbuf, 0);
 		}
 	}
@@ -425,6 +435,20 @@ capture_method:
 	}
 	addWidget(m_capMethods);
 
+	if (caps() & V4L2_CAP_STREAMING) {
+		addLabel("Buffers");
+		m_numBuffers = new QSpinBox(parent);
+		m_numBuffers->setRange(2, VIDEO_MAX_FRAME);
+		m_numBuffers->setValue(3);
+		m_numBuffers->setWhatsThis("Number of buffers requested for streaming I/O.");
+		addWidget(m_numBuffers);
+
+		addLabel("Adaptive Buffers");
+		m_adaptiveBuffers = new QCheckBox(parent);
+		m_adaptiveBuffers->setWhatsThis("Add buffers while capturing when the driver drops frames.");
+		addWidget(m_adaptiveBuffers);
+	}
+
 done:
 	QGridLayout::addWidget(new QWidget(parent), rowCount(), 0, 1, n);
 	setRowStretch(rowCount() - 1, 1);
@@ -436,6 +460,8 @@ done:
 
     channelsproglayout->addWidget(pg1left);
     channelsproglayout->addWidget(pg1right);
+    if (loudlabel1)
+        channelsproglayout->addWidget(loudlabel1);
 
     proglayout->addWidget(proglabel);
     proglayout->addLayout(channelsproglayout);
@@ -476,6 +502,24 @@ CapMethod GeneralTab::capMethod()
 	return (CapMethod)m_capMethods->itemData(m_capMethods->currentIndex()).toInt();
 }
 
+unsigned GeneralTab::numBuffers() const
+{
+	return m_numBuffers ? m_numBuffers->value() : 3;
+}
+
+bool GeneralTab::adaptiveBuffers() const
+{
+	return m_adaptiveBuffers && m_adaptiveBuffers->isChecked();
+}
+
+void GeneralTab::setBuffers(unsigned count, bool adaptive)
+{
+	if (m_numBuffers && count)
+		m_numBuffers->setValue(count);
+	if (m_adaptiveBuffers)
+		m_adaptiveBuffers->setChecked(adaptive);
+}
+
 void GeneralTab::inputChanged(int input)
 {
 	s_input(input);
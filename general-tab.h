@@ -39,13 +39,17 @@ class GeneralTab: public QGridLayout, public v4l2
 	Q_OBJECT
 
 public:
-    GeneralTab(const QString &device, v4l2 &fd, int n, QWidget *parent = 0, QProgressBar *pl1 = 0, QProgressBar *pr1 = 0);
+    GeneralTab(const QString &device, v4l2 &fd, int n, QWidget *parent = 0, QProgressBar *pl1 = 0, QProgressBar *pr1 = 0, QLabel *loud1 = 0);
 	virtual ~GeneralTab() {}
 
 	CapMethod capMethod();
+	unsigned numBuffers() const;
+	bool adaptiveBuffers() const;
+	void setBuffers(unsigned count, bool adaptive);
     QTableWidget *chantable;
     QProgressBar *pg1left;
     QProgressBar *pg1right;
+    QLabel *loudlabel1;
     QLabel *proglabel;
 
 	bool get_interval(struct v4l2_fract &interval);
@@ -177,6 +181,8 @@ private:
 	QComboBox *m_frameInterval;
 	QComboBox *m_vidOutFormats;
 	QComboBox *m_capMethods;
+	QSpinBox *m_numBuffers;
+	QCheckBox *m_adaptiveBuffers;
 	QComboBox *m_vbiMethods;
 };
 
@@ -0,0 +1,257 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gst-tap.h"
+
+// GStreamer raw video formats that have a V4L2 equivalent, with the bytes
+// per pixel of the first plane
+static const struct {
+	const char *name;
+	__u32 pixelformat;
+	unsigned bytes;
+	unsigned planes;	// size of the image in halves of the first plane
+} tapFormats[] = {
+	{ "YUY2",  V4L2_PIX_FMT_YUYV,   2, 2 },
+	{ "YVYU",  V4L2_PIX_FMT_YVYU,   2, 2 },
+	{ "UYVY",  V4L2_PIX_FMT_UYVY,   2, 2 },
+	{ "GRAY8", V4L2_PIX_FMT_GREY,   1, 2 },
+	{ "RGB",   V4L2_PIX_FMT_RGB24,  3, 2 },
+	{ "BGR",   V4L2_PIX_FMT_BGR24,  3, 2 },
+	{ "xRGB",  V4L2_PIX_FMT_RGB32,  4, 2 },
+	{ "BGRx",  V4L2_PIX_FMT_BGR32,  4, 2 },
+	{ "I420",  V4L2_PIX_FMT_YUV420, 1, 3 },
+	{ "YV12",  V4L2_PIX_FMT_YVU420, 1, 3 },
+	{ "NV12",  V4L2_PIX_FMT_NV12,   1, 3 },
+	{ "NV21",  V4L2_PIX_FMT_NV21,   1, 3 },
+	{ NULL, 0, 0, 0 }
+};
+
+const char *gstVideoFormat(v4l2_pix_format &pix)
+{
+	for (unsigned i = 0; tapFormats[i].name; i++) {
+		if (tapFormats[i].pixelformat != pix.pixelformat)
+			continue;
+		pix.bytesperline = GST_ROUND_UP_4(pix.width * tapFormats[i].bytes);
+		pix.sizeimage = pix.bytesperline * pix.height * tapFormats[i].planes / 2;
+		return tapFormats[i].name;
+	}
+	return NULL;
+}
+
+GstFrameTap::GstFrameTap(QObject *parent) :
+	QObject(parent),
+	m_pad(NULL),
+	m_probe(0),
+	m_changed(false),
+	m_spare(NULL)
+{
+	memset(&m_format, 0, sizeof(m_format));
+	memset(m_pool, 0, sizeof(m_pool));
+	m_free.init(FRAME_POOL_SIZE);
+	m_ready.init(FRAME_POOL_SIZE);
+}
+
+GstFrameTap::~GstFrameTap()
+{
+	detach();
+	freePool();
+}
+
+void GstFrameTap::freePool()
+{
+	for (unsigned i = 0; i < FRAME_POOL_SIZE; i++)
+		free(m_pool[i].store);
+	memset(m_pool, 0, sizeof(m_pool));
+}
+
+void GstFrameTap::attach(GstElement *element)
+{
+	detach();
+	m_pad = gst_element_get_static_pad(element, "sink");
+	if (m_pad == NULL)
+		return;
+	// the pool grows to the size of the frames on the streaming thread
+	freePool();
+	m_free.init(FRAME_POOL_SIZE);
+	m_ready.init(FRAME_POOL_SIZE);
+	m_spare = NULL;
+	for (unsigned i = 0; i < FRAME_POOL_SIZE; i++) {
+		m_pool[i].index = -1;
+		m_pool[i].dmabuf = -1;
+		m_free.push(&m_pool[i]);
+	}
+	m_lock.lock();
+	memset(&m_format, 0, sizeof(m_format));
+	m_changed = false;
+	m_lock.unlock();
+	m_stats.reset(FRAME_POOL_SIZE);
+	m_notify.fetchAndStoreOrdered(0);
+	m_probe = gst_pad_add_probe(m_pad, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER |
+				GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM), probe, this, NULL);
+}
+
+void GstFrameTap::detach()
+{
+	if (m_pad == NULL)
+		return;
+	gst_pad_remove_probe(m_pad, m_probe);
+	gst_object_unref(m_pad);
+	m_pad = NULL;
+	m_probe = 0;
+}
+
+CapFrame *GstFrameTap::getFrame()
+{
+	CapFrame *frame = m_ready.pop();
+
+	if (frame == NULL) {
+		m_notify.fetchAndStoreOrdered(0);
+		// A frame may have been queued just before the flag was cleared.
+		frame = m_ready.pop();
+	}
+	return frame;
+}
+
+void GstFrameTap::putFrame(CapFrame *frame)
+{
+	m_free.push(frame);
+}
+
+bool GstFrameTap::newFormat(v4l2_format &fmt)
+{
+	QMutexLocker locker(&m_lock);
+
+	if (!m_changed)
+		return false;
+	m_changed = false;
+	fmt = m_format;
+	return true;
+}
+
+// Called on the streaming thread of the pad.
+GstPadProbeReturn GstFrameTap::probe(GstPad *, GstPadProbeInfo *info, gpointer data)
+{
+	GstFrameTap *tap = (GstFrameTap *)data;
+
+	if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+		GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+
+		if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS) {
+			GstCaps *caps;
+
+			gst_event_parse_caps(event, &caps);
+			tap->setCaps(caps);
+		}
+	}
+	else if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+		tap->frame(GST_PAD_PROBE_INFO_BUFFER(info));
+	}
+	return GST_PAD_PROBE_OK;
+}
+
+// The frames are laid out the way GStreamer lays out video by default,
+// with the rows of the first plane padded to four bytes.
+void GstFrameTap::setCaps(GstCaps *caps)
+{
+	const GstStructure *s = gst_caps_get_structure(caps, 0);
+	const gchar *format = gst_structure_get_string(s, "format");
+	v4l2_format fmt;
+	gint width = 0;
+	gint height = 0;
+
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	gst_structure_get_int(s, "width", &width);
+	gst_structure_get_int(s, "height", &height);
+	fmt.fmt.pix.width = width;
+	fmt.fmt.pix.height = height;
+	fmt.fmt.pix.field = V4L2_FIELD_NONE;
+	if (gst_structure_has_name(s, "image/jpeg")) {
+		fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_MJPEG;
+	} else if (gst_structure_has_name(s, "video/x-raw") && format) {
+		for (unsigned i = 0; tapFormats[i].name; i++) {
+			if (strcmp(format, tapFormats[i].name))
+				continue;
+			fmt.fmt.pix.pixelformat = tapFormats[i].pixelformat;
+			gstVideoFormat(fmt.fmt.pix);
+			break;
+		}
+	}
+
+	QMutexLocker locker(&m_lock);
+
+	// caps are sent again on renegotiation
+	if (!memcmp(&fmt, &m_format, sizeof(fmt)))
+		return;
+	m_format = fmt;
+	m_changed = true;
+}
+
+void GstFrameTap::frame(GstBuffer *buf)
+{
+	CapFrame *frame = m_spare ? m_spare : m_free.pop();
+	v4l2_buffer vbuf;
+	struct timespec now;
+	GstMapInfo map;
+
+	memset(&vbuf, 0, sizeof(vbuf));
+	// v4l2src passes on the sequence number of the driver
+	vbuf.sequence = GST_BUFFER_OFFSET(buf);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	vbuf.timestamp.tv_sec = now.tv_sec;
+	vbuf.timestamp.tv_usec = now.tv_nsec / 1000;
+	vbuf.flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+	m_stats.frame(vbuf, GST_BUFFER_OFFSET_IS_VALID(buf));
+
+	if (frame == NULL) {
+		m_stats.skipped();
+		return;
+	}
+	// only the GUI gives frames back to m_free, keep this one here
+	m_spare = frame;
+	if (!gst_buffer_map(buf, &map, GST_MAP_READ))
+		return;
+	if (map.size > frame->length) {
+		unsigned char *store = (unsigned char *)realloc(frame->store, map.size);
+
+		if (store == NULL) {
+			gst_buffer_unmap(buf, &map);
+			m_stats.skipped();
+			return;
+		}
+		frame->store = store;
+		frame->length = map.size;
+	}
+	frame->data = frame->store;
+	memcpy(frame->data, map.data, map.size);
+	frame->size = map.size;
+	gst_buffer_unmap(buf, &map);
+	frame->sequence = vbuf.sequence;
+	frame->flags = vbuf.flags;
+	frame->timestamp = vbuf.timestamp;
+	frame->dequeued = now;
+	m_spare = NULL;
+	m_ready.push(frame);
+	if (m_notify.testAndSetOrdered(0, 1))
+		emit frameReady();
+}
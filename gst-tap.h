@@ -0,0 +1,81 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef GST_TAP_H
+#define GST_TAP_H
+
+#include <QObject>
+#include <QMutex>
+#include <QAtomicInt>
+#include <gst/gst.h>
+
+#include "capture-thread.h"
+
+// The GStreamer name of the raw video format of pix, NULL if it has none.
+// Sets bytesperline and sizeimage to the layout GStreamer gives it by
+// default, with the rows of the first plane padded to four bytes.
+const char *gstVideoFormat(v4l2_pix_format &pix);
+
+// The frames of a GStreamer pipeline as a FrameSource. A probe on the
+// sink pad of an element copies every buffer into a small frame pool on
+// the streaming thread, the same way the capture thread copies driver
+// buffers. If all pool frames are still held by the GUI the frame is
+// skipped, the pipeline is never stalled.
+class GstFrameTap : public QObject, public FrameSource
+{
+	Q_OBJECT
+
+public:
+	GstFrameTap(QObject *parent = 0);
+	virtual ~GstFrameTap();
+
+	// Taps what flows into the sink pad of element until detach(). Stop
+	// the pipeline before detaching, and give all frames back first.
+	void attach(GstElement *element);
+	void detach();
+
+	// FrameSource
+	virtual CapFrame *getFrame();
+	virtual void putFrame(CapFrame *frame);
+	virtual void stats(CapStats &stats) const { m_stats.get(stats); }
+	virtual bool newFormat(v4l2_format &fmt);
+
+signals:
+	void frameReady();
+
+private:
+	static GstPadProbeReturn probe(GstPad *pad, GstPadProbeInfo *info, gpointer data);
+	void setCaps(GstCaps *caps);
+	void frame(GstBuffer *buf);
+	void freePool();
+
+	GstPad *m_pad;
+	gulong m_probe;
+	QMutex m_lock;			// m_format and m_changed
+	v4l2_format m_format;
+	bool m_changed;
+	CaptureStats m_stats;
+	CapFrame m_pool[FRAME_POOL_SIZE];
+	FrameRing m_free;
+	FrameRing m_ready;
+	CapFrame *m_spare;		// taken from m_free but not filled
+	QAtomicInt m_notify;
+};
+
+#endif
@@ -0,0 +1,185 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "gst-worker.h"
+
+// how long a pipeline may take to drain before it is stopped anyway
+#define GST_DRAIN_MS 3000
+
+GstWorker::GstWorker(QObject *parent) :
+	QThread(parent)
+{
+	m_context = g_main_context_new();
+	m_loop = g_main_loop_new(m_context, FALSE);
+}
+
+GstWorker::~GstWorker()
+{
+	if (isRunning()) {
+		// g_main_loop_quit() is lost if the loop has not started yet
+		GSource *source = g_idle_source_new();
+
+		g_source_set_callback(source, quit, m_loop, NULL);
+		g_source_attach(source, m_context);
+		g_source_unref(source);
+		wait();
+	}
+	m_lock.lock();
+	while (!m_watches.isEmpty())
+		teardown(m_watches.first());
+	m_lock.unlock();
+	g_main_loop_unref(m_loop);
+	g_main_context_unref(m_context);
+}
+
+void GstWorker::run()
+{
+	g_main_context_push_thread_default(m_context);
+	g_main_loop_run(m_loop);
+	g_main_context_pop_thread_default(m_context);
+}
+
+gboolean GstWorker::quit(gpointer data)
+{
+	g_main_loop_quit((GMainLoop *)data);
+	return FALSE;
+}
+
+void GstWorker::play(GstElement *pipeline, LevelMeter *meter)
+{
+	Watch *watch = new Watch;
+
+	watch->pipeline = pipeline;
+	watch->bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+	watch->source = gst_bus_create_watch(watch->bus);
+	watch->drain = NULL;
+	watch->meter = meter;
+	g_source_set_callback(watch->source, (GSourceFunc)busMessage, this, NULL);
+
+	m_lock.lock();
+	m_watches.append(watch);
+	g_source_attach(watch->source, m_context);
+	m_lock.unlock();
+	if (!isRunning())
+		start();
+	gst_element_set_state(pipeline, GST_STATE_PLAYING);
+}
+
+void GstWorker::stop(GstElement *pipeline, bool eos)
+{
+	QMutexLocker locker(&m_lock);
+	Watch *watch = NULL;
+
+	for (int i = 0; i < m_watches.size(); i++)
+		if (m_watches[i]->pipeline == pipeline)
+			watch = m_watches[i];
+	if (watch == NULL || watch->drain)
+		return;
+	if (!eos) {
+		teardown(watch);
+		return;
+	}
+	// the meter is stopped by the caller
+	watch->meter = NULL;
+	// finished by busMessage() on EOS, or by the timeout
+	watch->drain = g_timeout_source_new(GST_DRAIN_MS);
+	g_source_set_callback(watch->drain, drainTimeout, this, NULL);
+	g_source_attach(watch->drain, m_context);
+	gst_element_send_event(pipeline, gst_event_new_eos());
+}
+
+// Call with m_lock held.
+void GstWorker::teardown(Watch *watch)
+{
+	m_watches.removeAll(watch);
+	g_source_destroy(watch->source);
+	g_source_unref(watch->source);
+	if (watch->drain) {
+		g_source_destroy(watch->drain);
+		g_source_unref(watch->drain);
+	}
+	gst_element_set_state(watch->pipeline, GST_STATE_NULL);
+	gst_object_unref(watch->pipeline);
+	gst_object_unref(watch->bus);
+	delete watch;
+}
+
+gboolean GstWorker::drainTimeout(gpointer data)
+{
+	GstWorker *worker = (GstWorker *)data;
+	GSource *source = g_main_current_source();
+	QMutexLocker locker(&worker->m_lock);
+
+	for (int i = 0; i < worker->m_watches.size(); i++) {
+		if (worker->m_watches[i]->drain == source) {
+			worker->teardown(worker->m_watches[i]);
+			break;
+		}
+	}
+	return FALSE;
+}
+
+// The watch is looked up by its bus under the lock rather than passed in,
+// since stop() may tear it down from the GUI thread at any time.
+gboolean GstWorker::busMessage(GstBus *bus, GstMessage *msg, gpointer data)
+{
+	GstWorker *worker = (GstWorker *)data;
+	QMutexLocker locker(&worker->m_lock);
+	Watch *watch = NULL;
+
+	for (int i = 0; i < worker->m_watches.size(); i++)
+		if (worker->m_watches[i]->bus == bus)
+			watch = worker->m_watches[i];
+	if (watch == NULL)
+		return FALSE;
+
+	switch (GST_MESSAGE_TYPE(msg)) {
+	case GST_MESSAGE_ELEMENT: {
+		const GstStructure *s = gst_message_get_structure(msg);
+
+		if (watch->meter && gst_structure_has_name(s, "level"))
+			watch->meter->post(s);
+		break;
+	}
+
+	case GST_MESSAGE_ERROR: {
+		GError *err = NULL;
+		gchar *debug = NULL;
+
+		gst_message_parse_error(msg, &err, &debug);
+		emit worker->pipelineError(QString("%1: %2")
+				.arg(GST_OBJECT_NAME(GST_MESSAGE_SRC(msg)))
+				.arg(err->message));
+		g_error_free(err);
+		g_free(debug);
+		if (watch->drain)
+			worker->teardown(watch);
+		break;
+	}
+
+	case GST_MESSAGE_EOS:
+		if (watch->drain)
+			worker->teardown(watch);
+		break;
+
+	default:
+		break;
+	}
+	return TRUE;
+}
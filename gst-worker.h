@@ -0,0 +1,77 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef GST_WORKER_H
+#define GST_WORKER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QList>
+#include <gst/gst.h>
+#include <glib.h>
+
+#include "level-meter.h"
+
+// Runs the GStreamer side of the application from its own thread with
+// its own GMainContext, so that no slot has to run a nested main loop.
+// play() and stop() return right away. Bus messages are handled on the
+// worker thread: levels go straight into a LevelMeter, errors are passed
+// on as a queued signal.
+class GstWorker : public QThread
+{
+	Q_OBJECT
+
+public:
+	GstWorker(QObject *parent = 0);
+	virtual ~GstWorker();
+
+	// Takes over the pipeline and sets it playing. Level messages on its
+	// bus go to meter, if there is one.
+	void play(GstElement *pipeline, LevelMeter *meter = NULL);
+	// With eos the pipeline is drained first, so muxers can finish their
+	// files. It is then torn down in the background.
+	void stop(GstElement *pipeline, bool eos = false);
+
+signals:
+	void pipelineError(const QString &text);
+
+protected:
+	virtual void run();
+
+private:
+	struct Watch {
+		GstElement *pipeline;
+		GstBus *bus;
+		GSource *source;
+		GSource *drain;		// timeout while draining or NULL
+		LevelMeter *meter;
+	};
+
+	static gboolean busMessage(GstBus *bus, GstMessage *msg, gpointer data);
+	static gboolean drainTimeout(gpointer data);
+	static gboolean quit(gpointer data);
+	void teardown(Watch *watch);
+
+	GMainContext *m_context;
+	GMainLoop *m_loop;
+	QList<Watch *> m_watches;
+	QMutex m_lock;
+};
+
+#endif
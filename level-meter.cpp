@@ -0,0 +1,194 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <QProgressBar>
+#include <QLabel>
+#include <math.h>
+
+#include "level-meter.h"
+#include "loudness.h"
+
+// how often the level element reports and the bars are redrawn
+#define METER_INTERVAL_MS 50
+// silence, the bottom of the bars
+#define METER_FLOOR_DB -100.0
+// dead air: below this for that many seconds
+#define METER_SILENCE_DB -60.0
+#define METER_SILENCE_S 5.0
+// the level element stopped reporting
+#define METER_STALLED_S 1.0
+// how often the loudness is shown
+#define METER_LOUDNESS_S 0.5
+
+LevelMeter::LevelMeter(QObject *parent) :
+	QObject(parent),
+	m_loudness(NULL),
+	m_loudLabel(NULL),
+	m_loudShown(0),
+	m_shown(0),
+	m_lastUpdate(0),
+	m_silenceLevel(METER_SILENCE_DB),
+	m_silence(METER_SILENCE_S)
+{
+	m_bars[0] = m_bars[1] = NULL;
+	for (unsigned i = 0; i < METER_CHANNELS; i++) {
+		store(m_peak[i], METER_FLOOR_DB);
+		store(m_rms[i], METER_FLOOR_DB);
+		store(m_decay[i], METER_FLOOR_DB);
+	}
+	m_timer.setInterval(METER_INTERVAL_MS);
+	connect(&m_timer, SIGNAL(timeout()), this, SLOT(refresh()));
+}
+
+void LevelMeter::setBars(QProgressBar *left, QProgressBar *right)
+{
+	m_bars[0] = left;
+	m_bars[1] = right;
+}
+
+void LevelMeter::setLoudness(Loudness *loudness, QLabel *label)
+{
+	m_loudness = loudness;
+	m_loudLabel = label;
+}
+
+static QString loudText(double v)
+{
+	return v == -HUGE_VAL ? QString("--") : QString::number(v, 'f', 1);
+}
+
+void LevelMeter::showLoudness()
+{
+	LoudnessValues v = m_loudness->values();
+
+	m_loudLabel->setText(QString("M %1  S %2  I %3 LUFS  LRA %4 LU  TP %5 dBTP")
+			.arg(loudText(v.momentary)).arg(loudText(v.shortTerm))
+			.arg(loudText(v.integrated)).arg(loudText(v.range))
+			.arg(loudText(v.truePeak)));
+}
+
+void LevelMeter::configure(GstElement *level)
+{
+	g_object_set(G_OBJECT(level), "post-messages", TRUE,
+			"interval", (guint64)METER_INTERVAL_MS * GST_MSECOND, NULL);
+}
+
+void LevelMeter::store(QAtomicInt &v, double dB)
+{
+	if (dB < METER_FLOOR_DB)
+		dB = METER_FLOOR_DB;
+	v.fetchAndStoreRelease((int)(dB * 100));
+}
+
+void LevelMeter::setSilence(double dB, double seconds)
+{
+	m_silenceLevel = dB;
+	m_silence.setHold(seconds);
+}
+
+void LevelMeter::start()
+{
+	m_lastUpdate = AlarmTrigger::now();
+	m_loudShown = 0;
+	m_timer.start();
+}
+
+void LevelMeter::stop()
+{
+	m_timer.stop();
+	if (m_silence.reset())
+		emit silence(false);
+	if (m_loudLabel)
+		m_loudLabel->clear();
+	for (unsigned i = 0; i < METER_CHANNELS; i++) {
+		store(m_peak[i], METER_FLOOR_DB);
+		store(m_rms[i], METER_FLOOR_DB);
+		store(m_decay[i], METER_FLOOR_DB);
+		if (m_bars[i]) {
+			m_bars[i]->setValue(m_bars[i]->minimum());
+			m_bars[i]->setTextVisible(false);
+		}
+	}
+}
+
+void LevelMeter::post(unsigned channel, double peak, double rms, double decay)
+{
+	if (channel >= METER_CHANNELS)
+		return;
+	if (channel >= (unsigned)m_channels.fetchAndAddAcquire(0))
+		m_channels.fetchAndStoreRelease(channel + 1);
+	store(m_peak[channel], peak);
+	store(m_rms[channel], rms);
+	store(m_decay[channel], decay);
+	m_updates.fetchAndAddRelease(1);
+}
+
+void LevelMeter::post(const GstStructure *s)
+{
+	const GValue *peak = gst_structure_get_value(s, "peak");
+	const GValue *rms = gst_structure_get_value(s, "rms");
+	const GValue *decay = gst_structure_get_value(s, "decay");
+	GValueArray *p, *r, *d;
+
+	if (!peak || !rms || !decay)
+		return;
+	p = (GValueArray *)g_value_get_boxed(peak);
+	r = (GValueArray *)g_value_get_boxed(rms);
+	d = (GValueArray *)g_value_get_boxed(decay);
+	m_channels.fetchAndStoreRelease(p->n_values);
+	for (unsigned i = 0; i < p->n_values && i < r->n_values && i < d->n_values; i++)
+		post(i, g_value_get_double(g_value_array_get_nth(p, i)),
+			g_value_get_double(g_value_array_get_nth(r, i)),
+			g_value_get_double(g_value_array_get_nth(d, i)));
+}
+
+void LevelMeter::refresh()
+{
+	int updates = m_updates.fetchAndAddAcquire(0);
+	unsigned channels = m_channels.fetchAndAddAcquire(0);
+	double now = AlarmTrigger::now();
+	bool quiet;
+
+	if (updates != m_shown)
+		m_lastUpdate = now;
+	quiet = now - m_lastUpdate > METER_STALLED_S;
+	if (!quiet) {
+		quiet = true;
+		for (unsigned i = 0; i < METER_CHANNELS && i < channels; i++)
+			if (rms(i) >= m_silenceLevel)
+				quiet = false;
+	}
+	if (m_silence.update(quiet))
+		emit silence(m_silence.active());
+	if (m_loudness && m_loudLabel && now - m_loudShown >= METER_LOUDNESS_S) {
+		m_loudShown = now;
+		showLoudness();
+	}
+
+	// nothing new since the last redraw
+	if (updates == m_shown)
+		return;
+	m_shown = updates;
+	for (unsigned i = 0; i < METER_CHANNELS && i < channels; i++) {
+		if (m_bars[i] == NULL)
+			continue;
+		m_bars[i]->setTextVisible(true);
+		m_bars[i]->setValue(peak(i));
+	}
+}
@@ -0,0 +1,96 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef LEVEL_METER_H
+#define LEVEL_METER_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QTimer>
+#include <gst/gst.h>
+
+#include "alarm-log.h"
+
+class QProgressBar;
+class QLabel;
+class Loudness;
+
+#define METER_CHANNELS 2
+
+// Audio levels of one pipeline. The bus handler stores the latest values
+// from any thread with post(), the GUI shows them at a fixed rate no
+// matter how often they arrive. While shown it also watches for silence:
+// all channels below a level, or no level messages at all, for a while.
+class LevelMeter : public QObject
+{
+	Q_OBJECT
+
+public:
+	LevelMeter(QObject *parent = 0);
+
+	void setBars(QProgressBar *left, QProgressBar *right);
+	// Shows the loudness next to the bars while the meter runs.
+	void setLoudness(Loudness *loudness, QLabel *label);
+	// Sets up a level element to report at the rate the meter shows.
+	static void configure(GstElement *level);
+
+	void start();
+	// Stops showing and puts the bars back to silence.
+	void stop();
+
+	// Any thread. All values in dB.
+	void post(unsigned channel, double peak, double rms, double decay);
+	// Takes the values out of a "level" element message.
+	void post(const GstStructure *s);
+
+	double peak(unsigned channel) const { return load(m_peak[channel]); }
+	double rms(unsigned channel) const { return load(m_rms[channel]); }
+	double decay(unsigned channel) const { return load(m_decay[channel]); }
+
+	void setSilence(double dB, double seconds);
+
+signals:
+	void silence(bool on);
+
+private slots:
+	void refresh();
+
+private:
+	// stored in hundredths of a dB
+	static double load(QAtomicInt &v) { return v.fetchAndAddAcquire(0) / 100.0; }
+	static void store(QAtomicInt &v, double dB);
+	void showLoudness();
+
+	QProgressBar *m_bars[METER_CHANNELS];
+	Loudness *m_loudness;
+	QLabel *m_loudLabel;
+	double m_loudShown;		// when the label was last updated
+	mutable QAtomicInt m_peak[METER_CHANNELS];
+	mutable QAtomicInt m_rms[METER_CHANNELS];
+	mutable QAtomicInt m_decay[METER_CHANNELS];
+	QAtomicInt m_channels;		// of the last message
+	QAtomicInt m_updates;
+	int m_shown;
+	double m_lastUpdate;
+	double m_silenceLevel;
+	AlarmTrigger m_silence;
+	QTimer m_timer;
+};
+
+#endif
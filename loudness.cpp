@@ -0,0 +1,540 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "loudness.h"
+
+// BS.1770 gates
+#define LOUD_ABS_GATE		-70.0
+#define LOUD_REL_GATE		10.0
+#define LOUD_RANGE_GATE		20.0
+
+// The 4x interpolation filter of BS.1770 annex 2, one row per phase.
+static const float tpCoef[LOUD_PHASES][LOUD_TAPS] = {
+	{  0.0017089843750,  0.0109863281250, -0.0196533203125,  0.0332031250000,
+	  -0.0594482421875,  0.1373291015625,  0.9721679687500, -0.1022949218750,
+	   0.0476074218750, -0.0266113281250,  0.0148925781250, -0.0083007812500 },
+	{ -0.0291748046875,  0.0292968750000, -0.0517578125000,  0.0891113281250,
+	  -0.1665039062500,  0.4650878906250,  0.7797851562500, -0.2003173828125,
+	   0.1015625000000, -0.0582275390625,  0.0330810546875, -0.0189208984375 },
+	{ -0.0189208984375,  0.0330810546875, -0.0582275390625,  0.1015625000000,
+	  -0.2003173828125,  0.7797851562500,  0.4650878906250, -0.1665039062500,
+	   0.0891113281250, -0.0517578125000,  0.0292968750000, -0.0291748046875 },
+	{ -0.0083007812500,  0.0148925781250, -0.0266113281250,  0.0476074218750,
+	  -0.1022949218750,  0.9721679687500,  0.1373291015625, -0.0594482421875,
+	   0.0332031250000, -0.0196533203125,  0.0109863281250,  0.0017089843750 },
+};
+
+static double loudness(double energy)
+{
+	return energy > 0 ? -0.691 + 10 * log10(energy) : -HUGE_VAL;
+}
+
+static double dB(double level)
+{
+	return level > 0 ? 20 * log10(level) : -HUGE_VAL;
+}
+
+Loudness::Loudness() :
+	m_pad(NULL),
+	m_probe(0),
+	m_log(NULL),
+	m_format(fmtNone),
+	m_rate(0),
+	m_channels(0),
+	m_sampleSize(0),
+	m_oversample(true),
+	m_kweight(simdKWeightKernel()),
+	m_blockFrames(0)
+{
+	reset();
+}
+
+Loudness::~Loudness()
+{
+	detach();
+	closeLog();
+}
+
+bool Loudness::openLog(const QString &fileName)
+{
+	FILE *f = fopen(fileName.toLocal8Bit().data(), "a");
+
+	if (f == NULL)
+		return false;
+	fseek(f, 0, SEEK_END);
+	if (ftell(f) == 0)
+		fprintf(f, "time,momentary,short-term,integrated,range,true-peak\n");
+	closeLog();
+	m_lock.lock();
+	m_log = f;
+	m_lock.unlock();
+	return true;
+}
+
+void Loudness::closeLog()
+{
+	QMutexLocker locker(&m_lock);
+
+	if (m_log)
+		fclose(m_log);
+	m_log = NULL;
+}
+
+void Loudness::attach(GstElement *element)
+{
+	detach();
+	m_pad = gst_element_get_static_pad(element, "sink");
+	if (m_pad == NULL)
+		return;
+	m_lock.lock();
+	m_format = fmtNone;
+	reset();
+	m_lock.unlock();
+	m_probe = gst_pad_add_probe(m_pad, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER |
+				GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM), probe, this, NULL);
+}
+
+void Loudness::detach()
+{
+	if (m_pad == NULL)
+		return;
+	gst_pad_remove_probe(m_pad, m_probe);
+	gst_object_unref(m_pad);
+	m_pad = NULL;
+	m_probe = 0;
+}
+
+LoudnessValues Loudness::values()
+{
+	QMutexLocker locker(&m_lock);
+	LoudnessValues v;
+
+	v.momentary = loudness(m_momentary);
+	v.shortTerm = loudness(m_shortTerm);
+	v.integrated = integrated(m_gated, LOUD_REL_GATE);
+	v.range = range(m_short);
+	v.truePeak = dB(m_peak > m_logPeak ? m_peak : m_logPeak);
+	return v;
+}
+
+// Called on the streaming thread of the pad.
+GstPadProbeReturn Loudness::probe(GstPad *, GstPadProbeInfo *info, gpointer data)
+{
+	Loudness *l = (Loudness *)data;
+
+	if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+		GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+
+		if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS) {
+			GstCaps *caps;
+
+			gst_event_parse_caps(event, &caps);
+			l->setCaps(caps);
+		}
+	}
+	else if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+		GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+		GstMapInfo map;
+
+		if (gst_buffer_map(buf, &map, GST_MAP_READ)) {
+			l->process(map.data, map.size);
+			gst_buffer_unmap(buf, &map);
+		}
+	}
+	return GST_PAD_PROBE_OK;
+}
+
+void Loudness::setCaps(GstCaps *caps)
+{
+	const GstStructure *s = gst_caps_get_structure(caps, 0);
+	const gchar *format = gst_structure_get_string(s, "format");
+	const gchar *layout = gst_structure_get_string(s, "layout");
+	SampleFormat fmt = fmtNone;
+	unsigned size = 0;
+	gint rate = 0;
+	gint channels = 0;
+
+	gst_structure_get_int(s, "rate", &rate);
+	gst_structure_get_int(s, "channels", &channels);
+	if (format == NULL)
+		;
+	else if (!strcmp(format, "S16LE"))
+		fmt = fmtS16, size = 2;
+	else if (!strcmp(format, "S32LE"))
+		fmt = fmtS32, size = 4;
+	else if (!strcmp(format, "F32LE"))
+		fmt = fmtF32, size = 4;
+	if ((layout && strcmp(layout, "interleaved")) ||
+	    rate < 8000 || channels < 1 || channels > LOUD_CHANNELS)
+		fmt = fmtNone;
+
+	QMutexLocker locker(&m_lock);
+
+	// caps are sent again on renegotiation, keep measuring if nothing changed
+	if (fmt == m_format && (unsigned)rate == m_rate && (unsigned)channels == m_channels)
+		return;
+	m_format = fmt;
+	m_rate = rate;
+	m_channels = channels;
+	m_sampleSize = size;
+	if (fmt == fmtNone) {
+		// the caps only change on renegotiation, so this is said once
+		fprintf(stderr, "loudness: cannot measure %s audio, %d Hz, %d channels\n",
+				format ? format : "unknown", rate, channels);
+		return;
+	}
+
+	// K-weighting for this rate: a high shelf for the head, then the
+	// RLB high-pass, the BS.1770 48 kHz filters derived for any rate
+	double K = tan(M_PI * 1681.974450955533 / rate);
+	double Q = 0.7071752369554196;
+	double Vh = pow(10.0, 3.999843853973347 / 20.0);
+	double Vb = pow(Vh, 0.4996667741545416);
+	double a0 = 1.0 + K / Q + K * K;
+
+	m_b[0][0] = (Vh + Vb * K / Q + K * K) / a0;
+	m_b[0][1] = 2.0 * (K * K - Vh) / a0;
+	m_b[0][2] = (Vh - Vb * K / Q + K * K) / a0;
+	m_a[0][0] = 1.0;
+	m_a[0][1] = 2.0 * (K * K - 1.0) / a0;
+	m_a[0][2] = (1.0 - K / Q + K * K) / a0;
+
+	K = tan(M_PI * 38.13547087602444 / rate);
+	Q = 0.5003270373238773;
+	a0 = 1.0 + K / Q + K * K;
+	m_b[1][0] = 1.0;
+	m_b[1][1] = -2.0;
+	m_b[1][2] = 1.0;
+	m_a[1][0] = 1.0;
+	m_a[1][1] = 2.0 * (K * K - 1.0) / a0;
+	m_a[1][2] = (1.0 - K / Q + K * K) / a0;
+	m_coef[0] = m_b[0][0];
+	m_coef[1] = m_b[0][1];
+	m_coef[2] = m_b[0][2];
+	m_coef[3] = m_a[0][1];
+	m_coef[4] = m_a[0][2];
+	m_coef[5] = m_a[1][1];
+	m_coef[6] = m_a[1][2];
+
+	// 5.1 in the GStreamer default order: no LFE, surrounds +1.5 dB
+	for (unsigned ch = 0; ch < LOUD_CHANNELS; ch++)
+		m_weight[ch] = 1.0;
+	if (channels == 6) {
+		m_weight[3] = 0.0;
+		m_weight[4] = m_weight[5] = 1.41;
+	}
+	m_blockFrames = rate / 10;
+	// above that the samples themselves are close enough
+	m_oversample = rate < 96000;
+	reset();
+}
+
+void Loudness::reset()
+{
+	memset(m_z, 0, sizeof(m_z));
+	memset(m_chunk, 0, sizeof(m_chunk));
+	memset(m_blockSum, 0, sizeof(m_blockSum));
+	memset(m_blocks, 0, sizeof(m_blocks));
+	memset(&m_gated, 0, sizeof(m_gated));
+	memset(&m_short, 0, sizeof(m_short));
+	m_blockPos = 0;
+	m_nblocks = 0;
+	m_blockIdx = 0;
+	m_logBlocks = 0;
+	m_momentary = 0;
+	m_shortTerm = 0;
+	m_peak = 0;
+	m_logPeak = 0;
+}
+
+void Loudness::process(const unsigned char *data, unsigned size)
+{
+	QMutexLocker locker(&m_lock);
+
+	if (m_format == fmtNone)
+		return;
+
+	unsigned frames = size / (m_channels * m_sampleSize);
+
+	switch (m_format) {
+	case fmtS16:
+		feed((const gint16 *)data, frames, 1.0f / 32768);
+		break;
+	case fmtS32:
+		feed((const gint32 *)data, frames, 1.0f / 2147483648.0f);
+		break;
+	case fmtF32:
+		feed((const float *)data, frames, 1.0f);
+		break;
+	default:
+		break;
+	}
+}
+
+// Scales the interleaved samples to floats, never crossing the end of a
+// 100ms block. The K-weighting runs on them as they are, the true-peak
+// filter on a chunk per channel, so that both run over plain arrays.
+template <class T> void Loudness::feed(const T *in, unsigned frames, float scale)
+{
+	while (frames) {
+		unsigned n = frames;
+
+		if (n > LOUD_CHUNK)
+			n = LOUD_CHUNK;
+		if (n > m_blockFrames - m_blockPos)
+			n = m_blockFrames - m_blockPos;
+		for (unsigned i = 0; i < n * m_channels; i++)
+			m_frames[i] = in[i] * scale;
+		filter(n);
+		for (unsigned ch = 0; ch < m_channels; ch++) {
+			float *x = m_chunk[ch] + LOUD_TAPS - 1;
+			const float *s = m_frames + ch;
+
+			for (unsigned i = 0; i < n; i++)
+				x[i] = s[i * m_channels];
+			truePeak(ch, n);
+			// keep the history of the interpolation filter
+			memmove(m_chunk[ch], m_chunk[ch] + n, (LOUD_TAPS - 1) * sizeof(float));
+		}
+		in += n * m_channels;
+		frames -= n;
+		m_blockPos += n;
+		if (m_blockPos == m_blockFrames)
+			endBlock();
+	}
+}
+
+// Runs the two K-weighting biquads of every channel and sums the squares
+// of the result.
+void Loudness::filter(unsigned n)
+{
+	const double b00 = m_b[0][0], b01 = m_b[0][1], b02 = m_b[0][2];
+	const double a01 = m_a[0][1], a02 = m_a[0][2];
+	const double a11 = m_a[1][1], a12 = m_a[1][2];
+	unsigned ch = 0;
+
+	// the recursion runs along the samples, the kernels run across channels
+	if (m_kweight)
+		ch = m_kweight(m_coef, m_z[0], LOUD_CHANNELS, m_frames, m_channels, n, m_blockSum);
+	for (; ch < m_channels; ch++) {
+		const float *x = m_frames + ch;
+		double z00 = m_z[0][ch], z01 = m_z[1][ch];
+		double z10 = m_z[2][ch], z11 = m_z[3][ch];
+		double sum = 0;
+
+		for (unsigned i = 0; i < n; i++) {
+			double v = x[i * m_channels];
+			double y = b00 * v + z00;
+
+			z00 = b01 * v - a01 * y + z01;
+			z01 = b02 * v - a02 * y;
+			v = y;
+			// the high-pass has b = 1, -2, 1
+			y = v + z10;
+			z10 = -2 * v - a11 * y + z11;
+			z11 = v - a12 * y;
+			sum += y * y;
+		}
+		m_z[0][ch] = z00;
+		m_z[1][ch] = z01;
+		m_z[2][ch] = z10;
+		m_z[3][ch] = z11;
+		m_blockSum[ch] += sum;
+	}
+}
+
+// Interpolates 4x, one phase at a time over the whole chunk so that
+// the inner loops are plain multiply-adds over arrays.
+void Loudness::truePeak(unsigned ch, unsigned n)
+{
+	const float *x = m_chunk[ch];
+	float peak = m_logPeak;
+
+	if (!m_oversample) {
+		x += LOUD_TAPS - 1;
+		for (unsigned i = 0; i < n; i++) {
+			float v = fabsf(x[i]);
+
+			peak = v > peak ? v : peak;
+		}
+		m_logPeak = peak;
+		return;
+	}
+	for (unsigned p = 0; p < LOUD_PHASES; p++) {
+		for (unsigned i = 0; i < n; i++)
+			m_acc[i] = 0;
+		for (unsigned k = 0; k < LOUD_TAPS; k++) {
+			const float c = tpCoef[p][k];
+			const float *s = x + LOUD_TAPS - 1 - k;
+
+			for (unsigned i = 0; i < n; i++)
+				m_acc[i] += c * s[i];
+		}
+		for (unsigned i = 0; i < n; i++) {
+			float v = fabsf(m_acc[i]);
+
+			peak = v > peak ? v : peak;
+		}
+	}
+	m_logPeak = peak;
+}
+
+void Loudness::endBlock()
+{
+	double e = 0;
+
+	for (unsigned ch = 0; ch < m_channels; ch++) {
+		e += m_weight[ch] * m_blockSum[ch];
+		m_blockSum[ch] = 0;
+	}
+	m_blocks[m_blockIdx] = e / m_blockFrames;
+	m_blockIdx = (m_blockIdx + 1) % LOUD_BLOCKS;
+	if (m_nblocks < LOUD_BLOCKS)
+		m_nblocks++;
+	m_blockPos = 0;
+
+	// 400ms gating blocks overlap by 75%
+	if (m_nblocks >= 4) {
+		e = 0;
+		for (unsigned i = 1; i <= 4; i++)
+			e += m_blocks[(m_blockIdx + LOUD_BLOCKS - i) % LOUD_BLOCKS];
+		m_momentary = e / 4;
+		add(m_gated, m_momentary);
+	}
+	if (m_nblocks == LOUD_BLOCKS) {
+		e = 0;
+		for (unsigned i = 0; i < LOUD_BLOCKS; i++)
+			e += m_blocks[i];
+		m_shortTerm = e / LOUD_BLOCKS;
+		add(m_short, m_shortTerm);
+	}
+
+	// do not let the filters decay into denormals on silence
+	for (unsigned k = 0; k < 4; k++)
+		for (unsigned ch = 0; ch < m_channels; ch++)
+			if (fabs(m_z[k][ch]) < 1e-30)
+				m_z[k][ch] = 0;
+
+	if (++m_logBlocks == 10) {
+		m_logBlocks = 0;
+		log();
+	}
+}
+
+void Loudness::log()
+{
+	if (m_logPeak > m_peak)
+		m_peak = m_logPeak;
+	if (m_log) {
+		struct timeval tv;
+		struct tm tm;
+		char buf[32];
+
+		gettimeofday(&tv, NULL);
+		localtime_r(&tv.tv_sec, &tm);
+		strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+		fprintf(m_log, "%s.%03u,%.1f,%.1f,%.1f,%.1f,%.1f\n", buf,
+				(unsigned)(tv.tv_usec / 1000),
+				loudness(m_momentary), loudness(m_shortTerm),
+				integrated(m_gated, LOUD_REL_GATE), range(m_short),
+				dB(m_logPeak));
+		fflush(m_log);
+	}
+	m_logPeak = 0;
+}
+
+void Loudness::add(LoudnessHistogram &h, double energy)
+{
+	double l = loudness(energy);
+	int bin;
+
+	if (l < LOUD_ABS_GATE)
+		return;
+	bin = (int)((l - LOUD_ABS_GATE) * 10);
+	if (bin >= LOUD_BINS)
+		bin = LOUD_BINS - 1;
+	h.count[bin]++;
+	h.energy[bin] += energy;
+}
+
+// The loudness of the blocks no more than gate LU below the loudness of
+// all blocks, both above the absolute gate. The relative gate is applied
+// to whole bins, so it is only exact to 0.1 LU.
+double Loudness::integrated(const LoudnessHistogram &h, double gate)
+{
+	double sum = 0;
+	unsigned long long n = 0;
+	int first;
+
+	for (unsigned i = 0; i < LOUD_BINS; i++) {
+		sum += h.energy[i];
+		n += h.count[i];
+	}
+	if (n == 0)
+		return -HUGE_VAL;
+	first = (int)floor((loudness(sum / n) - gate - LOUD_ABS_GATE) * 10);
+	if (first < 0)
+		first = 0;
+	sum = 0;
+	n = 0;
+	for (unsigned i = first; i < LOUD_BINS; i++) {
+		sum += h.energy[i];
+		n += h.count[i];
+	}
+	return loudness(sum / n);
+}
+
+// EBU Tech 3342: the spread between the 10th and the 95th percentile of
+// the short-term loudness, gated 20 LU below its average.
+double Loudness::range(const LoudnessHistogram &h)
+{
+	double sum = 0;
+	unsigned long long n = 0;
+	unsigned long long seen = 0;
+	double lo = 0;
+	int first;
+
+	for (unsigned i = 0; i < LOUD_BINS; i++) {
+		sum += h.energy[i];
+		n += h.count[i];
+	}
+	if (n == 0)
+		return -HUGE_VAL;
+	first = (int)floor((loudness(sum / n) - LOUD_RANGE_GATE - LOUD_ABS_GATE) * 10);
+	if (first < 0)
+		first = 0;
+	n = 0;
+	for (unsigned i = first; i < LOUD_BINS; i++)
+		n += h.count[i];
+	for (unsigned i = first; i < LOUD_BINS; i++) {
+		double l = LOUD_ABS_GATE + (i + 0.5) / 10;
+
+		if (seen <= n / 10 && seen + h.count[i] > n / 10)
+			lo = l;
+		seen += h.count[i];
+		if (seen > n * 95 / 100)
+			return l - lo;
+	}
+	return 0;
+}
@@ -0,0 +1,127 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include <QString>
+#include <QMutex>
+#include <stdio.h>
+#include <gst/gst.h>
+
+#include "conv-simd.h"
+
+#define LOUD_CHANNELS	8
+#define LOUD_CHUNK	512		// frames filtered in one go
+#define LOUD_TAPS	12		// per true-peak interpolation phase
+#define LOUD_PHASES	4		// true-peak oversampling factor
+#define LOUD_BLOCKS	30		// 100ms blocks of the short-term window
+#define LOUD_BINS	1000		// 0.1 LU each, from -70 LUFS up
+
+// All in LUFS, LU or dBTP; -HUGE_VAL if there is no value yet.
+struct LoudnessValues {
+	double momentary;	// last 400ms
+	double shortTerm;	// last 3s
+	double integrated;	// since attach()
+	double range;		// since attach()
+	double truePeak;	// highest since attach()
+};
+
+// Gated loudness blocks, binned by their loudness.
+struct LoudnessHistogram {
+	unsigned count[LOUD_BINS];
+	double energy[LOUD_BINS];
+};
+
+// ITU-R BS.1770 / EBU R128 loudness of the audio flowing through a pad:
+// momentary, short-term and integrated loudness, loudness range as in
+// EBU Tech 3342 and the true-peak level. Optionally writes one line of
+// CSV per second of audio.
+class Loudness
+{
+public:
+	Loudness();
+	~Loudness();
+
+	bool openLog(const QString &fileName);
+	void closeLog();
+
+	// Measures what flows into the sink pad of element until detach().
+	// The integrated loudness and range start anew.
+	void attach(GstElement *element);
+	void detach();
+
+	// Any thread.
+	LoudnessValues values();
+
+private:
+	static GstPadProbeReturn probe(GstPad *pad, GstPadProbeInfo *info, gpointer data);
+	void setCaps(GstCaps *caps);
+	void process(const unsigned char *data, unsigned size);
+	template <class T> void feed(const T *in, unsigned frames, float scale);
+	void filter(unsigned n);
+	void truePeak(unsigned ch, unsigned n);
+	void endBlock();
+	void reset();
+	void log();
+
+	static void add(LoudnessHistogram &h, double energy);
+	static double integrated(const LoudnessHistogram &h, double gate);
+	static double range(const LoudnessHistogram &h);
+
+	enum SampleFormat { fmtNone, fmtS16, fmtS32, fmtF32 };
+
+	QMutex m_lock;
+	GstPad *m_pad;
+	gulong m_probe;
+	FILE *m_log;
+
+	SampleFormat m_format;
+	unsigned m_rate;
+	unsigned m_channels;
+	unsigned m_sampleSize;
+	bool m_oversample;
+	double m_b[2][3], m_a[2][3];	// K-weighting: shelf and high-pass
+	double m_coef[7];		// the same for SimdKWeight
+	double m_z[4][LOUD_CHANNELS];	// filter state, by channel
+	double m_weight[LOUD_CHANNELS];
+	SimdKWeight m_kweight;
+
+	// the chunk as it came in, channels interleaved
+	float m_frames[LOUD_CHUNK * LOUD_CHANNELS];
+	// LOUD_TAPS - 1 samples of history, then the chunk
+	float m_chunk[LOUD_CHANNELS][LOUD_TAPS - 1 + LOUD_CHUNK];
+	float m_acc[LOUD_CHUNK];
+
+	unsigned m_blockFrames;
+	unsigned m_blockPos;
+	double m_blockSum[LOUD_CHANNELS];
+	double m_blocks[LOUD_BLOCKS];	// mean square of each 100ms block
+	unsigned m_nblocks;
+	unsigned m_blockIdx;
+	unsigned m_logBlocks;		// since the last log line
+	double m_momentary;		// mean squares
+	double m_shortTerm;
+	double m_peak;			// linear, since attach()
+	double m_logPeak;		// linear, since the last log line
+	LoudnessHistogram m_gated;	// 400ms blocks
+	LoudnessHistogram m_short;	// 3s blocks
+};
+
+#endif
@@ -21,6 +21,10 @@
 #include "general-tab.h"
 #include "vbi-tab.h"
 #include "capture-win.h"
+#include "capture-thread.h"
+#include "gst-tap.h"
+#include "ring-encoder.h"
+#include "vbi-bench.h"
 
 #include <QToolBar>
 #include <QToolButton>
@@ -43,6 +47,7 @@
 #include <QWhatsThis>
 #include <QThread>
 #include <QCloseEvent>
+#include <QInputDialog>
 
 #include <assert.h>
 #include <sys/mman.h>
@@ -55,6 +60,12 @@
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <math.h>
+#include <algorithm>
+
+// conversion failures in a row before the picture alarms give up
+#define GRID_MAX_ERRORS 25
+// JPEG quality of the frames in the ring, about 35 kB for a 720x576 frame
+#define RING_JPEG_QUALITY 50
 
 int leftchan = 0;
 int rightchan = 0;
@@ -66,12 +77,27 @@ ApplicationWindow::ApplicationWindow() :
     setAttribute(Qt::WA_DeleteOnClose, true);
 
     this->resize(this->width() + 350, this->height());
-    m_capNotifier = NULL;
+    m_capThread = NULL;
+    m_frames = NULL;
+    m_shownFrame = NULL;
     m_capImage = NULL;
-    m_frameData = NULL;
+    m_capShown = NULL;
     m_nbuffers = 0;
     m_buffers = NULL;
     m_makeSnapshot = false;
+    m_numBuffers = 0;
+    m_adaptiveBuffers = false;
+    m_previewFps = 0;
+    m_capEngine = engineGStreamer;
+    m_rawDirect = false;
+    m_gridRaw = false;
+    m_gridBuf = NULL;
+    m_gridErrors = 0;
+    m_lastPreview = 0;
+    m_encProfile = encDefaultProfile();
+    m_encThreads = 0;
+    // only lines that carry a service are sliced every frame
+    m_vbiSlicer.setLearning(VBI_LEARN_FRAMES);
 
     QAction *openAct = new QAction(QIcon(":/fileopen.png"), "&Open Device", this);
     openAct->setStatusTip("Open a v4l device, use libv4l2 wrapper if possible");
@@ -100,6 +126,13 @@ ApplicationWindow::ApplicationWindow() :
     m_saveRawAct->setChecked(false);
     connect(m_saveRawAct, SIGNAL(toggled(bool)), this, SLOT(capStart2(bool)));
     //connect(m_saveRawAct, SIGNAL(toggled(bool)), this, SLOT(saveRaw(bool)));
+    connect(m_saveRaw.writer(), SIGNAL(writeError(const QString &)), this, SLOT(rawWriteError(const QString &)));
+
+    m_exportAct = new QAction(QIcon(":/saveraw.png"), "&Export Recent Frames...", this);
+    m_exportAct->setStatusTip("Save the last minutes of the ring recording to a raw file.");
+    m_exportAct->setDisabled(true);
+    connect(m_exportAct, SIGNAL(triggered()), this, SLOT(exportRing()));
+    connect(&m_ringExport, SIGNAL(exported(int, bool)), this, SLOT(ringExported(int, bool)));
 
     progbar1left = new QProgressBar();
     progbar1right = new QProgressBar();
@@ -113,8 +146,23 @@ ApplicationWindow::ApplicationWindow() :
     progbar1right->setFormat("%v dB");
     progbar1left->setTextVisible(false);
     progbar1right->setTextVisible(false);
+    loudlabel1 = new QLabel();
 
     gst_init(NULL, NULL);
+    m_gst = new GstWorker(this);
+    m_tap = new GstFrameTap(this);
+    connect(m_tap, SIGNAL(frameReady()), this, SLOT(capFrame()));
+    m_ringEnc = new RingEncoder(&m_ring);
+    m_ringPipe = NULL;
+    m_tvVideo = NULL;
+    m_tvAudio = NULL;
+    m_tvMeter = new LevelMeter(this);
+    m_tvMeter->setBars(progbar1left, progbar1right);
+    m_tvMeter->setLoudness(&m_loudness, loudlabel1);
+    m_radioMeter = new LevelMeter(this);
+    connect(m_tvMeter, SIGNAL(silence(bool)), this, SLOT(audioSilence(bool)));
+    connect(m_radioMeter, SIGNAL(silence(bool)), this, SLOT(audioSilence(bool)));
+    connect(m_gst, SIGNAL(pipelineError(const QString &)), this, SLOT(gstError(const QString &)));
 
     m_showFramesAct = new QAction(QIcon(":/video-television.png"), "Show &Frames", this);
     m_showFramesAct->setStatusTip("Only show captured frames if set.");
@@ -138,6 +186,7 @@ ApplicationWindow::ApplicationWindow() :
     fileMenu->addAction(m_capStartAct);
     fileMenu->addAction(m_snapshotAct);
     fileMenu->addAction(m_saveRawAct);
+    fileMenu->addAction(m_exportAct);
     fileMenu->addAction(m_showFramesAct);
     fileMenu->addSeparator();
     fileMenu->addAction(quitAct);
@@ -170,8 +219,123 @@ ApplicationWindow::ApplicationWindow() :
 ApplicationWindow::~ApplicationWindow()
 {
     closeDevice();
+    delete m_ringEnc;
+}
+
+
+void ApplicationWindow::setBuffers(unsigned count, bool adaptive)
+{
+    m_numBuffers = count;
+    m_adaptiveBuffers = adaptive;
+}
+
+void ApplicationWindow::setPreviewRate(unsigned fps)
+{
+    m_previewFps = fps;
+}
+
+void ApplicationWindow::setCapEngine(CapEngine engine)
+{
+    m_capEngine = engine;
+}
+
+void ApplicationWindow::setRawDirect(bool direct)
+{
+    m_rawDirect = direct;
 }
 
+void ApplicationWindow::setEncProfile(const EncProfile *profile, unsigned threads)
+{
+    m_encProfile = profile;
+    m_encThreads = threads;
+}
+
+void ApplicationWindow::setAlarmLog(const QString &target)
+{
+    if (!m_alarms.open(target))
+        error(QString("Cannot open alarm log %1").arg(target));
+}
+
+void ApplicationWindow::setFreezeTime(double seconds)
+{
+    m_freezeAlarm.setHold(seconds);
+}
+
+void ApplicationWindow::setBlackTime(double seconds)
+{
+    m_blackAlarm.setHold(seconds);
+}
+
+void ApplicationWindow::setSilence(double dB, double seconds)
+{
+    m_tvMeter->setSilence(dB, seconds);
+    m_radioMeter->setSilence(dB, seconds);
+}
+
+// Opened by the VBI tab of each device that has one.
+void ApplicationWindow::setCaptionLog(const QString &fileName)
+{
+    m_captionLog = fileName;
+}
+
+void ApplicationWindow::setLoudnessLog(const QString &fileName)
+{
+    if (!m_loudness.openLog(fileName))
+        error(QString("Cannot open loudness log %1").arg(fileName));
+}
+
+void ApplicationWindow::setRingFile(const QString &fileName, unsigned sizeMB)
+{
+    m_ringExport.cancel();
+    if (!m_ring.open(fileName, (unsigned long long)sizeMB << 20)) {
+        error(QString("Cannot open ring file %1").arg(fileName));
+        return;
+    }
+    m_exportAct->setEnabled(true);
+}
+
+void ApplicationWindow::exportRing()
+{
+    bool ok;
+    unsigned held = m_ring.span() / 1000000000ULL;
+    // the ring size sets how far back it goes, not the dialog
+    int minutes = QInputDialog::getInt(this, "Export Recent Frames",
+                                       QString("The ring holds %1:%2 minutes.\nMinutes to export:")
+                                       .arg(held / 60).arg(held % 60, 2, 10, QChar('0')),
+                                       qMin(30U, held / 60 + 1), 1, 24 * 60, 1, &ok);
+
+    if (!ok)
+        return;
+    if ((unsigned)minutes * 60 > held)
+        QMessageBox::warning(this, "Export Recent Frames",
+                             QString("The ring only goes back %1 seconds, a larger ring (-s) "
+                                     "keeps more. All of it is exported.").arg(held));
+
+    QString s = QFileDialog::getSaveFileName(this, "Export Recent Frames");
+
+    if (s.isEmpty())
+        return;
+
+    __u64 now = RingRecorder::wallclock();
+
+    // capturing goes on into the ring while the export runs
+    m_exportAct->setEnabled(false);
+    m_exportFile = s;
+    m_ringExport.exportRange(&m_ring, s, now - minutes * 60000000000ULL, now);
+    statusBar()->showMessage(QString("Exporting to %1").arg(s));
+}
+
+void ApplicationWindow::ringExported(int frames, bool overrun)
+{
+    m_exportAct->setEnabled(m_ring.isOpen());
+    if (frames < 0)
+        error(QString("Cannot export to %1").arg(m_exportFile));
+    else if (overrun)
+        error(QString("%1 frames exported, the ring overwrote the rest before it was saved")
+              .arg(frames));
+    else
+        statusBar()->showMessage(QString("%1 frames exported").arg(frames), 5000);
+}
 
 void ApplicationWindow::setDevice(const QString &device, bool rawOpen)
 {
@@ -187,13 +351,16 @@ void ApplicationWindow::setDevice(const QString &device, bool rawOpen)
     connect(m_capture, SIGNAL(close()), this, SLOT(closeCaptureWin()));
 
     QWidget *w = new QWidget(m_tabs);
-    m_genTab = new GeneralTab(device, *this, 4, w, progbar1left, progbar1right);
+    m_genTab = new GeneralTab(device, *this, 4, w, progbar1left, progbar1right, loudlabel1);
+    m_genTab->setBuffers(m_numBuffers, m_adaptiveBuffers);
     m_tabs->addTab(w, "TV"); // new in 2017 rename General tab to TV
 
     addTabs();
     if (caps() & (V4L2_CAP_VBI_CAPTURE | V4L2_CAP_SLICED_VBI_CAPTURE)) {
         w = new QWidget(m_tabs);
         m_vbiTab = new VbiTab(w);
+        if (!m_captionLog.isEmpty())
+            m_vbiTab->setCaptionLog(m_captionLog);
         m_tabs->addTab(w, "VBI");
     }
     if (QWidget *current = m_tabs->currentWidget()) {
@@ -275,6 +442,9 @@ void ApplicationWindow::setDevice(const QString &device, bool rawOpen)
     progbar2right->setFormat("%v dB");
     progbar2right->setValue(progbar2right->minimum());
     progbar2right->setTextVisible(false);
+    m_radioMeter->setBars(progbar2left, progbar2right);
+    loudlabel2 = new QLabel();
+    m_radioMeter->setLoudness(&m_loudness, loudlabel2);
 
     proglabel = new QLabel();
     proglabel->setText("Audio Level, peak");
@@ -282,6 +452,7 @@ void ApplicationWindow::setDevice(const QString &device, bool rawOpen)
     QVBoxLayout *channelsproglayout = new QVBoxLayout();
     channelsproglayout->addWidget(progbar2left);
     channelsproglayout->addWidget(progbar2right);
+    channelsproglayout->addWidget(loudlabel2);
     proglayout->addWidget(proglabel);
     proglayout->addLayout(channelsproglayout);
     vbox->addLayout(proglayout);
@@ -323,7 +494,8 @@ void ApplicationWindow::setrowradiofreq(int r) {
 
 void ApplicationWindow::opendev()
 {
-    QFileDialog d(this, "Select v4l device", "/dev", "V4L Devices (video* vbi* radio*)");
+    QFileDialog d(this, "Select v4l device", "/dev",
+                  "V4L Devices (video* vbi* radio*);;Raw Recordings (*)");
 
     d.setFilter(QDir::AllDirs | QDir::Files | QDir::System);
     d.setFileMode(QFileDialog::ExistingFile);
@@ -344,247 +516,274 @@ void ApplicationWindow::openrawdev()
 void ApplicationWindow::capVbiFrame()
 {
     __u32 buftype = m_genTab->bufType();
-    v4l2_buffer buf;
-    __u8 *data = NULL;
-    int s = 0;
-    bool again;
-
-    switch (m_capMethod) {
-    case methodRead:
-        s = read(m_frameData, m_vbiSize);
-        if (s < 0) {
-            if (errno != EAGAIN) {
-                error("read");
-                m_capStartAct->setChecked(false);
-            }
-            return;
-        }
-        data = m_frameData;
-        break;
-
-    case methodMmap:
-        if (!dqbuf_mmap(buf, buftype, again)) {
-            error("dqbuf");
-            m_capStartAct->setChecked(false);
-            return;
-        }
-        if (again)
-            return;
-        data = (__u8 *)m_buffers[buf.index].start;
-        s = buf.bytesused;
-        break;
+    CapFrame *frame;
+    unsigned frames = 0;
+    bool show;
 
-    case methodUser:
-        if (!dqbuf_user(buf, buftype, again)) {
-            error("dqbuf");
+    // a notification may still be queued after capturing was stopped
+    if (m_capThread == NULL)
+        return;
+    show = previewDue();
+    while ((frame = m_capThread->getFrame())) {
+        __u8 *data = frame->data;
+        int s = frame->size;
+
+        if (buftype == V4L2_BUF_TYPE_VBI_CAPTURE && s != m_vbiSize) {
+            m_capThread->putFrame(frame);
+            error("incorrect vbi size");
             m_capStartAct->setChecked(false);
             return;
         }
-        if (again)
-            return;
-        data = (__u8 *)buf.m.userptr;
-        s = buf.bytesused;
-        break;
-    }
-    if (buftype == V4L2_BUF_TYPE_VBI_CAPTURE && s != m_vbiSize) {
-        error("incorrect vbi size");
-        m_capStartAct->setChecked(false);
-        return;
-    }
-    if (m_showFrames) {
-        for (unsigned y = 0; y < m_vbiHeight; y++) {
-            __u8 *p = data + y * m_vbiWidth;
-            __u8 *q = m_capImage->bits() + y * m_capImage->bytesPerLine();
-
-            for (unsigned x = 0; x < m_vbiWidth; x++) {
-                *q++ = *p;
-                *q++ = *p;
-                *q++ = *p++;
+        // raw VBI recordings replay and make a corpus for the slicer
+        if (buftype == V4L2_BUF_TYPE_VBI_CAPTURE && m_saveRaw.isOpen())
+            m_saveRaw.write(frame->data, frame->size, frame->sequence,
+                            frame->flags, frame->timestamp);
+        if (show) {
+            for (unsigned y = 0; y < m_vbiHeight; y++) {
+                __u8 *p = data + y * m_vbiWidth;
+                __u8 *q = m_capImage->bits() + y * m_capImage->bytesPerLine();
+
+                for (unsigned x = 0; x < m_vbiWidth; x++) {
+                    *q++ = *p;
+                    *q++ = *p;
+                    *q++ = *p++;
+                }
             }
         }
-    }
-
-    struct v4l2_sliced_vbi_format sfmt;
-    struct v4l2_sliced_vbi_data sdata[m_vbiHandle.count[0] + m_vbiHandle.count[1]];
-    struct v4l2_sliced_vbi_data *p;
-
-    if (buftype == V4L2_BUF_TYPE_SLICED_VBI_CAPTURE) {
-        p = (struct v4l2_sliced_vbi_data *)data;
-    } else {
-        vbi_parse(&m_vbiHandle, data, &sfmt, sdata);
-        s = sizeof(sdata);
-        p = sdata;
-    }
-
-    if (m_capMethod != methodRead)
-        qbuf(buf);
 
-    m_vbiTab->slicedData(p, s / sizeof(p[0]));
+        struct v4l2_sliced_vbi_format sfmt;
+        struct v4l2_sliced_vbi_data sdata[m_vbiSlicer.lines()];
+        struct v4l2_sliced_vbi_data *p;
 
-    QString status, curStatus;
-    struct timeval tv, res;
+        if (buftype == V4L2_BUF_TYPE_SLICED_VBI_CAPTURE) {
+            p = (struct v4l2_sliced_vbi_data *)data;
+        } else {
+            m_vbiSlicer.parse(data, &sfmt, sdata);
+            s = sizeof(sdata);
+            p = sdata;
+        }
 
-    if (m_frame == 0)
-        gettimeofday(&m_tv, NULL);
-    gettimeofday(&tv, NULL);
-    timersub(&tv, &m_tv, &res);
-    if (res.tv_sec) {
-        m_fps = (100 * (m_frame - m_lastFrame)) /
-            (res.tv_sec * 100 + res.tv_usec / 10000);
-        m_lastFrame = m_frame;
-        m_tv = tv;
+        m_vbiTab->slicedData(p, s / sizeof(p[0]));
+        m_timing.frames(1, frame->timestamp, frame->flags);
+        m_capThread->putFrame(frame);
+        frames++;
     }
+    if (frames == 0)
+        return;
+    frameTiming(frames, show ? m_capImage : NULL);
+}
 
-    status = QString("Frame: %1 Fps: %2").arg(++m_frame).arg(m_fps);
-    if (m_showFrames)
-        m_capture->setImage(*m_capImage, status);
-    curStatus = statusBar()->currentMessage();
-    if (curStatus.isEmpty() || curStatus.startsWith("Frame: "))
-        statusBar()->showMessage(status);
-    if (m_frame == 1)
-        refresh();
+// Whether the newest frame should be shown. Nothing is converted while
+// the capture window is hidden, minimized or, as far as Qt can tell,
+// covered, and at most m_previewFps frames are shown per second.
+bool ApplicationWindow::previewDue()
+{
+    long long now, interval;
+
+    if (!m_showFrames || m_capture == NULL)
+        return false;
+    if (!m_capture->isVisible() || m_capture->isMinimized() ||
+        m_capture->visibleRegion().isEmpty())
+        return false;
+    if (m_previewFps == 0)
+        return true;
+    now = FrameTiming::now();
+    interval = 1000000 / m_previewFps;
+    if (now - m_lastPreview < interval)
+        return false;
+    // keep to the rate on average unless we fell behind
+    if (now - m_lastPreview < 2 * interval)
+        m_lastPreview += interval;
+    else
+        m_lastPreview = now;
+    return true;
 }
 
-// main capture loop
+// main capture loop, called whenever the capture thread has queued frames
 void ApplicationWindow::capFrame()
 {
-    __u32 buftype = m_genTab->bufType();
-    v4l2_buffer buf;
-    int s = 0;
+    CapFrame *frame, *last = NULL, *shown = NULL;
+    unsigned frames = 0;
+    QImage image;
+    bool show;
     int err = 0;
-    bool again;
 
-    switch (m_capMethod) {
-    case methodRead:
-        s = read(m_frameData, m_capSrcFormat.fmt.pix.sizeimage);
-        if (s < 0) {
-            if (errno != EAGAIN) {
-                error("read");
-                m_capStartAct->setChecked(false);
-            }
-            return;
-        }
-        if (m_makeSnapshot)
-            makeSnapshot((unsigned char *)m_frameData, s);
-        if (m_saveRaw.openMode())
-            m_saveRaw.write((const char *)m_frameData, s);
+    if (m_frames == NULL)
+        return;
+    // the GStreamer engine only learns the format from the stream
+    if (m_frames->newFormat(m_capSrcFormat))
+        startFrames();
+
+    // Every frame is saved, but only the most recent one is shown, and
+    // only if the preview wants it at all.
+    show = previewDue();
+    while ((frame = m_frames->getFrame())) {
+        // queued for the writer thread, dropped if the disk falls behind
+        if (m_saveRaw.isOpen())
+            m_saveRaw.write(frame->data, frame->size, frame->sequence,
+                            frame->flags, frame->timestamp);
+        // compressed on a streaming thread, dropped if it falls behind
+        if (m_ringPipe)
+            m_ringEnc->push(frame);
+        else if (m_ring.isOpen())
+            m_ring.write(frame->data, frame->size, frame->sequence,
+                         frame->flags, frame->timestamp);
+        if (m_gridRaw ? m_grid.analyze(frame->data, frame->size) : gridConvert(frame))
+            checkPicture();
+        if (last)
+            m_frames->putFrame(last);
+        last = frame;
+        frames++;
+    }
+    if (last == NULL)
+        return;
 
-        if (!m_showFrames)
-            break;
-        if (m_mustConvert)
-            err = v4lconvert_convert(m_convertData, &m_capSrcFormat, &m_capDestFormat,
-                m_frameData, s,
+    if (show && !m_mustConvert && last->index >= 0) {
+        // Show the driver buffer as it is. It stays on screen, and away
+        // from the driver, until the next frame replaces it.
+        v4l2_pix_format &srcPix = m_capSrcFormat.fmt.pix;
+
+        image = QImage((const uchar *)last->data, srcPix.width, srcPix.height,
+                srcPix.bytesperline ? srcPix.bytesperline : m_capImage->bytesPerLine(),
+                m_capImage->format());
+        shown = last;
+    } else if (show) {
+        if (m_mustConvert && m_convEngine.isActive())
+            err = m_convEngine.convert(last->data, last->size,
+                m_capImage->bits(), m_capImage->numBytes());
+        else if (m_mustConvert)
+            err = v4lconvert_convert(m_convertData,
+                &m_capSrcFormat, &m_capDestFormat,
+                last->data, last->size,
                 m_capImage->bits(), m_capDestFormat.fmt.pix.sizeimage);
         if (!m_mustConvert || err < 0)
-            memcpy(m_capImage->bits(), m_frameData, std::min(s, m_capImage->numBytes()));
-        break;
-
-    case methodMmap:
-        if (!dqbuf_mmap(buf, buftype, again)) {
-            error("dqbuf");
-            m_capStartAct->setChecked(false);
-            return;
-        }
-        if (again)
-            return;
+            memcpy(m_capImage->bits(), last->data,
+                   std::min(last->size, (unsigned)m_capImage->numBytes()));
+    }
+    if (m_makeSnapshot)
+        makeSnapshot(last);
+
+    if (err == -1 && m_timing.count() == 0)
+        error(m_convEngine.isActive() ? "Frame too short to convert" :
+              v4lconvert_get_error_message(m_convertData));
+
+    m_timing.frames(frames, last->timestamp, last->flags);
+    frameTiming(frames, shown ? &image : (show ? m_capImage : NULL));
+    // the previous frame is no longer referenced by the capture window
+    if (show) {
+        if (m_shownFrame)
+            m_frames->putFrame(m_shownFrame);
+        m_shownFrame = shown;
+    }
+    if (last != shown)
+        m_frames->putFrame(last);
+}
 
-        if (m_showFrames) {
-            if (m_mustConvert)
-                err = v4lconvert_convert(m_convertData,
-                    &m_capSrcFormat, &m_capDestFormat,
-                    (unsigned char *)m_buffers[buf.index].start, buf.bytesused,
-                    m_capImage->bits(), m_capDestFormat.fmt.pix.sizeimage);
-            if (!m_mustConvert || err < 0)
-                memcpy(m_capImage->bits(),
-                       (unsigned char *)m_buffers[buf.index].start,
-                       std::min(buf.bytesused, (unsigned)m_capImage->numBytes()));
-        }
-        if (m_makeSnapshot) {
-            makeSnapshot((unsigned char *)m_buffers[buf.index].start, buf.bytesused);
-        }
-        if (m_saveRaw.openMode()) {
-            // videowriter
+void ApplicationWindow::checkPicture()
+{
+    bool black = m_black.check(m_grid);
+    // a black picture is still as well, the black alarm covers that
+    bool frozen = m_freeze.check(m_grid) && !black;
+
+    if (m_blackAlarm.update(black))
+        alarm("video", m_blackAlarm.active(),
+              m_blackAlarm.active() ? "black picture" : "picture is back");
+    if (m_freezeAlarm.update(frozen))
+        alarm("video", m_freezeAlarm.active(),
+              m_freezeAlarm.active() ? "frozen picture" : "picture moves again");
+}
 
-            m_saveRaw.write((const char *)m_buffers[buf.index].start, buf.bytesused);
-        }
-        qbuf(buf);
-        break;
+// Status bar, and the alarm log if there is one. Alarms stay on the status
+// bar until they are cleared.
+void ApplicationWindow::alarm(const char *source, bool on, const QString &text)
+{
+    if (on) {
+        m_alarms.raise(source, text);
+        statusBar()->showMessage(QString("ALARM %1: %2").arg(source).arg(text));
+    }
+    else {
+        m_alarms.clear(source, text);
+        statusBar()->showMessage(QString("%1: %2").arg(source).arg(text), 5000);
+    }
+}
 
-    case methodUser:
-        if (!dqbuf_user(buf, buftype, again)) {
-            error("dqbuf");
-            m_capStartAct->setChecked(false);
-            return;
-        }
-        if (again)
-            return;
+void ApplicationWindow::audioSilence(bool on)
+{
+    const char *source = sender() == m_radioMeter ? "radio" : "audio";
 
-        if (m_showFrames) {
-            if (m_mustConvert)
-                err = v4lconvert_convert(m_convertData,
-                    &m_capSrcFormat, &m_capDestFormat,
-                    (unsigned char *)buf.m.userptr, buf.bytesused,
-                    m_capImage->bits(), m_capDestFormat.fmt.pix.sizeimage);
-            if (!m_mustConvert || err < 0)
-                memcpy(m_capImage->bits(), (unsigned char *)buf.m.userptr,
-                       std::min(buf.bytesused, (unsigned)m_capImage->numBytes()));
-        }
+    alarm(source, on, on ? "silence" : "sound is back");
+}
 
-        if (m_makeSnapshot)
-            makeSnapshot((unsigned char *)buf.m.userptr, buf.bytesused);
-        if (m_saveRaw.openMode())
-            m_saveRaw.write((const char *)buf.m.userptr, buf.bytesused);
+// Shows the image, if any, and updates the frame counters. The status
+// texts are only rebuilt a few times per second.
+void ApplicationWindow::frameTiming(unsigned frames, const QImage *image)
+{
+    bool update = m_timing.update();
 
-        qbuf(buf);
-        break;
+    if (image) {
+        m_capture->setImage(*image);
+        m_timing.displayed();
+        if (image == m_capImage)
+            std::swap(m_capImage, m_capShown);
     }
-    if (err == -1 && m_frame == 0)
-        error(v4lconvert_get_error_message(m_convertData));
-
-    QString status, curStatus;
-    struct timeval tv, res;
-
-    if (m_frame == 0)
-        gettimeofday(&m_tv, NULL);
-    gettimeofday(&tv, NULL);
-    timersub(&tv, &m_tv, &res);
-    if (res.tv_sec) {
-        m_fps = (100 * (m_frame - m_lastFrame)) /
-            (res.tv_sec * 100 + res.tv_usec / 10000);
-        m_lastFrame = m_frame;
-        m_tv = tv;
+    if (update && m_showFrames)
+        m_capture->setStatus(m_timing.status());
+    if (update) {
+        QString curStatus = statusBar()->currentMessage();
+
+        if (curStatus.isEmpty() || curStatus.startsWith("Frame: "))
+            statusBar()->showMessage(m_timing.status());
+        updateStats();
     }
-    status = QString("Frame: %1 Fps: %2").arg(++m_frame).arg(m_fps);
-    if (m_showFrames)
-        m_capture->setImage(*m_capImage, status);
-    curStatus = statusBar()->currentMessage();
-    if (curStatus.isEmpty() || curStatus.startsWith("Frame: "))
-        statusBar()->showMessage(status);
-    if (m_frame == 1)
+    if (m_timing.count() == frames)
         refresh();
 }
 
+void ApplicationWindow::newCapImages(int width, int height, QImage::Format format)
+{
+    deleteCapImages();
+    m_capImage = new QImage(width, height, format);
+    m_capImage->fill(0);
+    m_capShown = new QImage(width, height, format);
+    m_capShown->fill(0);
+    m_capture->setImage(*m_capShown, "No frame");
+}
+
+void ApplicationWindow::deleteCapImages()
+{
+    delete m_capImage;
+    delete m_capShown;
+    m_capImage = NULL;
+    m_capShown = NULL;
+}
+
 bool ApplicationWindow::startCapture(unsigned buffer_size)
 {
     __u32 buftype = m_genTab->bufType();
     v4l2_requestbuffers req;
     unsigned int i;
+    unsigned count;
 
     memset(&req, 0, sizeof(req));
 
     switch (m_capMethod) {
     case methodRead:
-        m_snapshotAct->setEnabled(true);
         /* Nothing to do. */
-        return true;
+        goto started;
 
     case methodMmap:
-        if (!reqbufs_mmap(req, buftype, 3)) {
+    case methodDmabuf:
+        count = m_genTab->numBuffers();
+        // exported buffers are never copied, with too few of them the
+        // frame the GUI shows would starve the driver
+        if (m_capMethod == methodDmabuf && count < CAP_DMABUF_BUFFERS)
+            count = CAP_DMABUF_BUFFERS;
+        if (!reqbufs_mmap(req, buftype, count)) {
             error("Cannot capture");
             break;
         }
 
-        if (req.count < 2) {
+        if (req.count < 2 || (m_capMethod == methodDmabuf && req.count < CAP_DMABUF_BUFFERS)) {
             error("Too few buffers");
             reqbufs_mmap(req, buftype);
             break;
@@ -613,7 +812,17 @@ bool ApplicationWindow::startCapture(unsigned buffer_size)
             }
 
             m_buffers[m_nbuffers].length = buf.length;
-            m_buffers[m_nbuffers].start = mmap(buf.length, buf.m.offset);
+            if (m_capMethod == methodDmabuf) {
+                // consumers read the exported buffer, not the V4L2 mapping
+                if (!expbuf(buftype, m_nbuffers, m_buffers[m_nbuffers].fd)) {
+                    perror("VIDIOC_EXPBUF");
+                    goto error;
+                }
+                m_buffers[m_nbuffers].start = ::mmap(NULL, buf.length, PROT_READ,
+                        MAP_SHARED, m_buffers[m_nbuffers].fd, 0);
+            } else {
+                m_buffers[m_nbuffers].start = mmap(buf.length, buf.m.offset);
+            }
 
             if (MAP_FAILED == m_buffers[m_nbuffers].start) {
                 perror("mmap");
@@ -630,11 +839,10 @@ bool ApplicationWindow::startCapture(unsigned buffer_size)
             perror("VIDIOC_STREAMON");
             goto error;
         }
-        m_snapshotAct->setEnabled(true);
-        return true;
+        goto started;
 
     case methodUser:
-        if (!reqbufs_user(req, buftype, 3)) {
+        if (!reqbufs_user(req, buftype, m_genTab->numBuffers())) {
             error("Cannot capture");
             break;
         }
@@ -670,13 +878,31 @@ bool ApplicationWindow::startCapture(unsigned buffer_size)
             perror("VIDIOC_STREAMON");
             goto error;
         }
-        m_snapshotAct->setEnabled(true);
-        return true;
+        goto started;
     }
 
 error:
     m_capStartAct->setChecked(false);
     return false;
+
+started:
+    // DQBUF/QBUF run in their own thread so a busy GUI cannot starve the driver
+    m_capThread = new CaptureThread(*this, this);
+    connect(m_capThread, SIGNAL(captureError(const QString &)), this, SLOT(capError(const QString &)));
+    if (m_genTab->isVbi())
+        connect(m_capThread, SIGNAL(frameReady()), this, SLOT(capVbiFrame()));
+    else
+        connect(m_capThread, SIGNAL(frameReady()), this, SLOT(capFrame()));
+    m_capThread->setAdaptiveBuffers(m_genTab->adaptiveBuffers());
+    // frames that need no conversion are shown straight from the buffer
+    m_capThread->setZeroCopy(!m_genTab->isVbi() && m_showFrames && !m_mustConvert);
+    if (!m_capThread->startCapture(m_capMethod, buftype, m_buffers, m_nbuffers, buffer_size)) {
+        error("Out of memory");
+        goto error;
+    }
+    m_frames = m_capThread;
+    m_snapshotAct->setEnabled(true);
+    return true;
 }
 
 void ApplicationWindow::stopCapture()
@@ -686,6 +912,24 @@ void ApplicationWindow::stopCapture()
     v4l2_encoder_cmd cmd;
     unsigned i;
 
+    // stop dequeueing before the buffers go away
+    if (m_capThread) {
+        // the capture window must not point into a buffer that goes away
+        if (m_shownFrame) {
+            memcpy(m_capImage->bits(), m_shownFrame->data,
+                   std::min(m_shownFrame->size, (unsigned)m_capImage->numBytes()));
+            m_capture->setImage(*m_capImage);
+            std::swap(m_capImage, m_capShown);
+            m_capThread->putFrame(m_shownFrame);
+            m_shownFrame = NULL;
+        }
+        m_capThread->stopCapture();
+        m_buffers = m_capThread->buffers();
+        m_nbuffers = m_capThread->numBuffers();
+        delete m_capThread;
+        m_capThread = NULL;
+        m_frames = NULL;
+    }
     m_snapshotAct->setDisabled(true);
     switch (m_capMethod) {
     case methodRead:
@@ -695,13 +939,21 @@ void ApplicationWindow::stopCapture()
         break;
 
     case methodMmap:
+    case methodDmabuf:
         if (m_buffers == NULL)
             break;
         if (!streamoff(buftype))
             perror("VIDIOC_STREAMOFF");
-        for (i = 0; i < m_nbuffers; ++i)
-            if (-1 == munmap(m_buffers[i].start, m_buffers[i].length))
+        for (i = 0; i < m_nbuffers; ++i) {
+            if (m_capMethod == methodDmabuf) {
+                // the driver can only free buffers that are no longer exported
+                if (-1 == ::munmap(m_buffers[i].start, m_buffers[i].length))
+                    perror("munmap");
+                ::close(m_buffers[i].fd);
+            } else if (-1 == munmap(m_buffers[i].start, m_buffers[i].length)) {
                 perror("munmap");
+            }
+        }
         // Free all buffers.
         reqbufs_mmap(reqbufs, buftype, 1);  // videobuf workaround
         reqbufs_mmap(reqbufs, buftype, 0);
@@ -735,150 +987,58 @@ void ApplicationWindow::closeCaptureWin()
     m_capStartAct->setChecked(false);
 }
 
-// 2017
-
-static gboolean message_handlermain(GstBus * bus, GstMessage * message, gpointer pbpointer)
+void ApplicationWindow::updateStats()
 {
-    if (message->type == GST_MESSAGE_ELEMENT) {
-        const GstStructure *s = gst_message_get_structure (message);
-        const gchar *name = gst_structure_get_name (s);
-        if (strcmp (name, "level") == 0) {
-
-            gint channels;
-            gdouble peak_dB;
-            const GValue *array_val;
-            GValueArray *peak_arr;
-            const GValue *value;
-            gint i;
-            array_val = gst_structure_get_value (s, "peak");
-            peak_arr = (GValueArray *) g_value_get_boxed (array_val);
-
-            channels = peak_arr->n_values;
-            for (i = 0; i < channels; ++i) {
-                value = g_value_array_get_nth (peak_arr, i);
-                peak_dB = g_value_get_double (value);
-                //g_print("%f\n",peak_dB);
-                GetProgBarPointer* pbp = static_cast<GetProgBarPointer*>(pbpointer);
-                QProgressBar* progbar2left = static_cast<QProgressBar*>(pbp->leftbar);
-                QProgressBar* progbar2right = static_cast<QProgressBar*>(pbp->rightbar);
-                if (i == 0) {
-                    progbar2left->setTextVisible(true);
-                    progbar2left->setValue(peak_dB);
-                }
-                else if (i == 1) {
-                    progbar2right->setTextVisible(true);
-                    progbar2right->setValue(peak_dB);
-                }
-            }
-
-        }
-    }
-    return TRUE;
+    CapStats stats;
+    QString text;
+
+    m_frames->stats(stats);
+    text = stats.toString();
+    if (m_saveRaw.isOpen())
+        text += QString(" Disk: %1 MB queued, %2 dropped")
+            .arg(m_saveRaw.backlog() / 1048576.0, 0, 'f', 1)
+            .arg(m_saveRaw.dropped());
+    m_capture->setStats(text);
 }
 
-
-// catch errors
-static gboolean bus_call(GstBus *bus, GstMessage *msg, gpointer data)
+void ApplicationWindow::capError(const QString &text)
 {
-    GMainLoop *loop = (GMainLoop *) data;
-    switch (GST_MESSAGE_TYPE(msg)) {
-        case GST_MESSAGE_EOS:
-            g_print("End of stream\n");
-            g_main_loop_quit(loop);
-            break;
-        case GST_MESSAGE_ERROR:
-            g_print("Error\n");
-            GError *err; err = NULL;
-            gchar *dbg_info; dbg_info = NULL;
-            gst_message_parse_error (msg, &err, &dbg_info);
-            g_printerr ("ERROR from element %s: %s\n",GST_OBJECT_NAME (msg->src), err->message);
-            g_printerr ("Debugging info: %s\n", (dbg_info) ? dbg_info : "none");
-            g_error_free (err);
-            g_free (dbg_info);
-
-            g_main_loop_quit(loop);
-            break;
-        default:
-            break;
-    }
-
-    return TRUE;
+    error(text);
+    m_capStartAct->setChecked(false);
 }
 
-static gboolean message_handler (GstBus * bus, GstMessage * message, gpointer pbpointer)
+void ApplicationWindow::rawWriteError(const QString &text)
 {
-    if (message->type == GST_MESSAGE_ELEMENT) {
-        const GstStructure *s = gst_message_get_structure (message);
-        const gchar *name = gst_structure_get_name (s);
-        if (strcmp (name, "level") == 0) {
-            gint channels;
-            GstClockTime endtime;
-            gdouble rms_dB;
-            gdouble peak_dB; //, decay_dB;
-            //gdouble rms;
-            const GValue *array_val;
-            const GValue *value;
-            GValueArray *rms_arr, *peak_arr, *decay_arr;
-            gint i;
-            if (!gst_structure_get_clock_time (s, "endtime", &endtime))
-                g_warning ("Could not parse endtime");
-            /* the values are packed into GValueArrays with the value per channel */
-            array_val = gst_structure_get_value (s, "rms");
-            rms_arr = (GValueArray *) g_value_get_boxed (array_val);
-            array_val = gst_structure_get_value (s, "peak");
-            peak_arr = (GValueArray *) g_value_get_boxed (array_val);
-            array_val = gst_structure_get_value (s, "decay");
-            decay_arr = (GValueArray *) g_value_get_boxed (array_val);
-            /* we can get the number of channels as the length of any of the value
-                   * arrays */
-            channels = rms_arr->n_values;
-            //g_print ("endtime: %" GST_TIME_FORMAT ", channels: %d\n", GST_TIME_ARGS (endtime), channels);
-            for (i = 0; i < channels; ++i) {
-                //g_print ("channel %d\n", i);
-                value = g_value_array_get_nth (rms_arr, i);
-                rms_dB = g_value_get_double (value);
-                value = g_value_array_get_nth (peak_arr, i);
-                peak_dB = g_value_get_double (value);
-
-                GetProgBarPointer* pbp = static_cast<GetProgBarPointer*>(pbpointer);
-
-                QProgressBar* progbar2left = static_cast<QProgressBar*>(pbp->leftbar);
-                QProgressBar* progbar2right = static_cast<QProgressBar*>(pbp->rightbar);
-                // set variables for the indicator
-                if (i == 0) {
-
-                    progbar2left->setTextVisible(true);
-                    //g_print("%f\n",rms_dB);
-                    progbar2left->setValue(peak_dB);
-
-                }
-                if (i == 1) {
-                    progbar2right->setTextVisible(true);
-                    progbar2right->setValue(peak_dB);
-                }
-
-                //value = g_value_array_get_nth (decay_arr, i);
-                //decay_dB = g_value_get_double (value);
-                //g_print ("    RMS: %f dB, peak: %f dB, decay: %f dB\n", rms_dB, peak_dB, decay_dB);
-                /* converting from dB to normal gives us a value between 0.0 and 1.0 */
-                //rms = pow (10, rms_dB / 20);
-                //g_print ("    normalized rms value: %f\n", rms);
-
-
-            }
-        }
-    }
-    return TRUE;
+    error(text);
+    m_saveRawAct->setChecked(false);
 }
 
+void ApplicationWindow::gstError(const QString &text)
+{
+    error(text);
+}
 
 void ApplicationWindow::capStart2(bool start)
 {
     int tab = m_tabs->currentIndex();
 
+    if (tab == 0 && (m_capEngine == engineNative || isReplay())) {
+        // the native engine records the raw frames it captures
+        saveRaw(start);
+        return;
+    }
     if (tab == 0) {
         if (start) {
-            loop = g_main_loop_new(NULL,FALSE);
+            // the encoder may be missing, so make it before anything that
+            // would have to be freed again
+            videoenc = encCreate(m_encProfile, m_encThreads);
+            if (videoenc == NULL) {
+                error(QString("Cannot create %1").arg(m_encProfile->encoder));
+                m_saveRawAct->blockSignals(true);
+                m_saveRawAct->setChecked(false);
+                m_saveRawAct->blockSignals(false);
+                return;
+            }
             pline = gst_pipeline_new("tunervid");
             v4l2src = gst_element_factory_make("v4l2src","v4l2src");
             videoqueue = gst_element_factory_make("queue","queue for video");
@@ -887,19 +1047,18 @@ void ApplicationWindow::capStart2(bool start)
             videoconvert = gst_element_factory_make("videoconvert","videoconvert");
             audioconvert = gst_element_factory_make("audioconvert","audioconvert");
             videorate = gst_element_factory_make("videorate","videorate");
-            theoraenc = gst_element_factory_make("theoraenc","theoraenc");
             vorbisenc = gst_element_factory_make("vorbisenc","vorbisenc");
-            oggmux = gst_element_factory_make("oggmux","oggmux");
+            mux = gst_element_factory_make(m_encProfile->muxer, "mux");
             filesink = gst_element_factory_make("filesink","filesink");
             level = gst_element_factory_make ("level", "level");
             // set params
             g_object_set(G_OBJECT(v4l2src), "device", "/dev/video0", NULL);
             g_object_set(G_OBJECT(alsasrc), "device","hw:1,0",NULL);
             // get filename
-            QString saveto = QFileDialog::getSaveFileName(this, tr("Save video to..."),"~/record.ogg",tr("(*.ogg)"));
+            QString ext = m_encProfile->extension;
+            QString saveto = QFileDialog::getSaveFileName(this, tr("Save video to..."), "~/record." + ext, "(*." + ext + ")");
             g_object_set(G_OBJECT(filesink), "location",saveto.toStdString().c_str(), NULL);
-            g_object_set(G_OBJECT(theoraenc), "quality",63,NULL);
-            g_object_set (G_OBJECT (level), "post-messages", TRUE, NULL);
+            LevelMeter::configure(level);
 
             GstCaps *vcaps;
 
@@ -915,16 +1074,16 @@ void ApplicationWindow::capStart2(bool start)
     //        gst_pad_set_caps(sinkpad,caps);
 
             //gboolean vlink_ok;
-            //vlink_ok = gst_element_link_filtered(videoconvert,theoraenc, vcaps);
+            //vlink_ok = gst_element_link_filtered(videoconvert,videoenc, vcaps);
             //gst_caps_unref (vcaps);
 
-            //g_object_set(G_OBJECT(theoraenc), ""
+            //g_object_set(G_OBJECT(videoenc), ""
 
-            gst_bin_add_many(GST_BIN (pline), v4l2src, videoqueue, videoconvert, videorate, theoraenc, oggmux, alsasrc, audioqueue, audioconvert, level, vorbisenc, filesink, NULL);
+            gst_bin_add_many(GST_BIN (pline), v4l2src, videoqueue, videoconvert, videorate, videoenc, mux, alsasrc, audioqueue, audioconvert, level, vorbisenc, filesink, NULL);
 
-            gst_element_link_many(v4l2src, videoqueue, videoconvert, videorate, theoraenc, oggmux, NULL);
-            gst_element_link_many(alsasrc, audioqueue, audioconvert, level, vorbisenc, oggmux, NULL);
-            gst_element_link(oggmux,filesink);
+            gst_element_link_many(v4l2src, videoqueue, videoconvert, videorate, videoenc, mux, NULL);
+            gst_element_link_many(alsasrc, audioqueue, audioconvert, level, vorbisenc, mux, NULL);
+            gst_element_link(mux,filesink);
 
             GstCaps *caps;
             caps = gst_caps_from_string("audio/x-raw,format=S16LE,rate=44100,channels=1");
@@ -933,17 +1092,9 @@ void ApplicationWindow::capStart2(bool start)
             link_ok = gst_element_link_filtered (alsasrc, audioqueue, caps);
             gst_caps_unref (caps);
 
-            bus = gst_pipeline_get_bus(GST_PIPELINE(pline));
-            //gst_bus_add_watch(bus, bus_call, loop);
-            getpbpointer = new GetProgBarPointer();
-            getpbpointer->leftbar = progbar1left;
-            getpbpointer->rightbar = progbar1right;
-
-            gst_bus_add_watch(bus,message_handlermain,(gpointer)getpbpointer);
-            gst_object_unref(bus);
-
-            gst_element_set_state(pline, GST_STATE_PLAYING);
-            g_main_loop_run(loop);
+            m_loudness.attach(level);
+            m_gst->play(pline, m_tvMeter);
+            m_tvMeter->start();
 
 
             // build a gstreamer chain
@@ -959,11 +1110,8 @@ void ApplicationWindow::capStart2(bool start)
 
         }
         else {
-            delete getpbpointer;
-            progbar1left->setValue(progbar1left->minimum());
-            progbar1right->setValue(progbar1right->minimum());
-            progbar1left->setTextVisible(false);
-            progbar1right->setTextVisible(false);
+            m_tvMeter->stop();
+            m_loudness.detach();
             stopCapture2();
         }
     }
@@ -982,7 +1130,6 @@ void ApplicationWindow::capStart2(bool start)
                 sfreq = 107100000;
 
             // write audio
-            loop2 = g_main_loop_new(NULL,FALSE);
             pline2 = gst_pipeline_new("tuneraudiorecord");
             alsasrc = gst_element_factory_make("alsasrc","alsasrc");
             audioconvert = gst_element_factory_make("audioconvert","audioconvert");
@@ -997,7 +1144,7 @@ void ApplicationWindow::capStart2(bool start)
             g_object_set(G_OBJECT(v4l2radio), "frequency", sfreq, NULL);
 
             g_object_set(G_OBJECT(alsasrc), "device","hw:1,0",NULL);
-            g_object_set (G_OBJECT (level), "post-messages", TRUE, NULL);
+            LevelMeter::configure(level);
 
             QString saveto = QFileDialog::getSaveFileName(this, tr("Save video to..."),"record.wav",tr("(*.wav)"));
 
@@ -1005,237 +1152,316 @@ void ApplicationWindow::capStart2(bool start)
 
             gst_bin_add_many(GST_BIN(pline2), alsasrc, audioconvert, level, audioresample, wavenc, filesink, NULL);
             gst_element_link_many(alsasrc, audioconvert, level, audioresample, wavenc, filesink, NULL);
-            bus = gst_pipeline_get_bus(GST_PIPELINE(pline2));
-            getpbpointer = new GetProgBarPointer();
-            getpbpointer->leftbar = (gpointer)progbar2left;
-            getpbpointer->rightbar = (gpointer)progbar2right;
-            guint watch_id = gst_bus_add_watch (bus, message_handler, (gpointer)getpbpointer);
-            gst_bus_add_watch(bus, bus_call, loop2);
-            gst_object_unref(bus);
 
             pline = gst_pipeline_new("tuneraudiosetfreq");
             gst_bin_add(GST_BIN(pline),v4l2radio);
-            gst_element_set_state(pline, GST_STATE_PLAYING);
-            gst_element_link(pline,pline2);
-
-            gst_element_set_state(pline2, GST_STATE_PLAYING);
-            g_main_loop_run(loop2);
-            g_source_remove (watch_id);
-            g_main_loop_unref (loop2);
+            m_gst->play(pline);
+            m_loudness.attach(level);
+            m_gst->play(pline2, m_radioMeter);
+            m_radioMeter->start();
         }
         else {
-            gst_element_send_event(pline2,gst_event_new_eos());
-            gst_element_set_state(pline,GST_STATE_NULL);
-            gst_element_set_state(pline2,GST_STATE_NULL);
-            progbar2left->setValue(progbar2left->minimum());
-            progbar2right->setValue(progbar2right->minimum());
-            delete getpbpointer;
-            g_main_loop_quit(loop2);
+            // let wavenc write its header before the file is closed
+            m_gst->stop(pline2, true);
+            m_gst->stop(pline);
+            m_radioMeter->stop();
+            m_loudness.detach();
         }
     }
 }
 
 void ApplicationWindow::stopCapture2()
 {
-    g_main_loop_quit(loop);
-    gst_element_set_state(pline,GST_STATE_NULL);
-    // gst_object_unref
+    // the muxer needs EOS to finish the file
+    m_gst->stop(pline, true);
 }
 
-void ApplicationWindow::capStart(bool start)
+// The picture detectors and the ring follow the format of the frames in
+// m_capSrcFormat, for either engine.
+void ApplicationWindow::startFrames()
 {
-    int tab = m_tabs->currentIndex();
-    if (tab == 0) {
-        if (start) {
-            // new capture via gstreamer api
-            loop2 = g_main_loop_new(NULL,FALSE);
-            pline = gst_pipeline_new("tunervideoplayimage");
-            pline2 = gst_pipeline_new("tunervideoplaysound");
-            v4l2src = gst_element_factory_make("v4l2src","v4l2src");
-            xvimagesink = gst_element_factory_make("xvimagesink","xvimagesink");
-            alsasrc = gst_element_factory_make("alsasrc","alsasrc");
-            level = gst_element_factory_make ("level", "level");
-            audioconvert = gst_element_factory_make("audioconvert","audioconvert");
-            alsasink = gst_element_factory_make("alsasink","alsasink");
+    v4l2_pix_format &gridPix = m_gridFormat.fmt.pix;
+
+    stopRing();
+    if (m_ring.isOpen()) {
+        m_ringPipe = m_ringEnc->create(m_capSrcFormat, RING_JPEG_QUALITY);
+        if (m_ringPipe) {
+            m_gst->play(m_ringPipe);
+        } else {
+            m_ring.setFormat(m_capSrcFormat);
+            error("The ring cannot compress this format, it only holds minutes of it");
+        }
+    }
+    m_gridRaw = m_grid.setFormat(m_capSrcFormat.fmt.pix);
+    m_freeze.reset();
+    free(m_gridBuf);
+    m_gridBuf = NULL;
+    m_gridErrors = 0;
+    if (m_gridRaw)
+        return;
+    // frames without a luma to read, such as MJPEG, are converted to RGB
+    m_gridFormat = m_capSrcFormat;
+    gridPix.pixelformat = V4L2_PIX_FMT_RGB24;
+    gridPix.bytesperline = gridPix.width * 3;
+    gridPix.sizeimage = gridPix.bytesperline * gridPix.height;
+    if (m_capSrcFormat.fmt.pix.pixelformat && m_grid.setFormat(gridPix))
+        m_gridBuf = (unsigned char *)malloc(gridPix.sizeimage);
+    if (m_gridBuf == NULL)
+        error("No black or frozen picture alarms for this format");
+}
 
-            g_object_set(G_OBJECT(v4l2src), "device", "/dev/video0", NULL);
-            g_object_set(G_OBJECT(alsasrc), "device","hw:1,0",NULL);
-            g_object_set (G_OBJECT (level), "post-messages", TRUE, NULL);
+// The detectors see every frame, so compressed frames are converted for
+// them on their own, whether or not the preview shows them.
+bool ApplicationWindow::gridConvert(const CapFrame *frame)
+{
+    if (m_gridBuf == NULL)
+        return false;
+    if (v4lconvert_convert(m_convertData, &m_capSrcFormat, &m_gridFormat,
+                frame->data, frame->size, m_gridBuf, m_gridFormat.fmt.pix.sizeimage) < 0) {
+        // a corrupt frame now and then is fine, a format that never
+        // converts would silently keep the alarms from ever going off
+        if (++m_gridErrors < GRID_MAX_ERRORS)
+            return false;
+        free(m_gridBuf);
+        m_gridBuf = NULL;
+        error(QString("No black or frozen picture alarms: %1")
+              .arg(v4lconvert_get_error_message(m_convertData)));
+        return false;
+    }
+    m_gridErrors = 0;
+    return m_grid.analyze(m_gridBuf, m_gridFormat.fmt.pix.sizeimage);
+}
 
-            gst_bin_add_many(GST_BIN(pline),v4l2src,xvimagesink,NULL);
-            gst_bin_add_many(GST_BIN(pline2),alsasrc,audioconvert,level,alsasink,NULL);
+void ApplicationWindow::stopRing()
+{
+    if (m_ringPipe == NULL)
+        return;
+    // torn down right away, so nothing writes to the ring after this
+    m_gst->stop(m_ringPipe);
+    m_ringPipe = NULL;
+    m_ringEnc->release();
+}
 
-            gst_element_link_many(v4l2src,xvimagesink,NULL);
-            gst_element_link_many(alsasrc,audioconvert,level,alsasink,NULL);
-            bus = gst_pipeline_get_bus(GST_PIPELINE(pline2));
-            getpbpointer = new GetProgBarPointer();
-            getpbpointer->leftbar = (gpointer)progbar1left;
-            getpbpointer->rightbar = (gpointer)progbar1right;
-            guint watch_id = gst_bus_add_watch (bus, message_handler, (gpointer)getpbpointer);
-            gst_bus_add_watch(bus, bus_call, loop2);
-            gst_object_unref(bus);
-
-            gst_element_set_state(pline, GST_STATE_PLAYING);
-            gst_element_set_state(pline2, GST_STATE_PLAYING);
-            g_main_loop_run(loop2);
-            g_source_remove (watch_id);
-            g_main_loop_unref (loop2);
-        }
-        else {
-            gst_element_set_state(pline,GST_STATE_NULL);
-            gst_element_set_state(pline2,GST_STATE_NULL);
-            progbar1left->setValue(progbar1left->minimum());
-            progbar1right->setValue(progbar1right->minimum());
-            delete getpbpointer;
-            g_main_loop_quit(loop2);
-        }
-        // old capture via v4l2 api
-        /*
-        static const struct {
-            __u32 v4l2_pixfmt;
-            QImage::Format qt_pixfmt;
-        } supported_fmts[] = {
-    #if Q_BYTE_ORDER == Q_BIG_ENDIAN
-            { V4L2_PIX_FMT_RGB32, QImage::Format_RGB32 },
-            { V4L2_PIX_FMT_RGB24, QImage::Format_RGB888 },
-            { V4L2_PIX_FMT_RGB565X, QImage::Format_RGB16 },
-            { V4L2_PIX_FMT_RGB555X, QImage::Format_RGB555 },
-    #else
-            { V4L2_PIX_FMT_BGR32, QImage::Format_RGB32 },
-            { V4L2_PIX_FMT_RGB24, QImage::Format_RGB888 },
-            { V4L2_PIX_FMT_RGB565, QImage::Format_RGB16 },
-            { V4L2_PIX_FMT_RGB555, QImage::Format_RGB555 },
-            { V4L2_PIX_FMT_RGB444, QImage::Format_RGB444 },
-    #endif
-            { 0, QImage::Format_Invalid }
-        };
-        QImage::Format dstFmt = QImage::Format_RGB888;
-        struct v4l2_fract interval;
-        v4l2_pix_format &srcPix = m_capSrcFormat.fmt.pix;
-        v4l2_pix_format &dstPix = m_capDestFormat.fmt.pix;
-
-        if (!start) {
-            stopCapture();
-            delete m_capNotifier;
-            m_capNotifier = NULL;
-            delete m_capImage;
-            m_capImage = NULL;
+void ApplicationWindow::stopFrames()
+{
+    stopRing();
+    free(m_gridBuf);
+    m_gridBuf = NULL;
+    bool active = m_blackAlarm.reset();
+
+    if (m_freezeAlarm.reset() || active)
+        alarm("video", false, "capture stopped");
+}
+
+// The sound of the TV tab into the level meter, the loudness engine and
+// the speakers, whichever engine captures the picture.
+void ApplicationWindow::audioMonitor(bool start)
+{
+    if (start) {
+        m_tvAudio = gst_pipeline_new("tunervideoplaysound");
+        alsasrc = gst_element_factory_make("alsasrc","alsasrc");
+        level = gst_element_factory_make ("level", "level");
+        audioconvert = gst_element_factory_make("audioconvert","audioconvert");
+        alsasink = gst_element_factory_make("alsasink","alsasink");
+
+        g_object_set(G_OBJECT(alsasrc), "device","hw:1,0",NULL);
+        LevelMeter::configure(level);
+
+        gst_bin_add_many(GST_BIN(m_tvAudio),alsasrc,audioconvert,level,alsasink,NULL);
+        gst_element_link_many(alsasrc,audioconvert,level,alsasink,NULL);
+
+        m_loudness.attach(level);
+        m_gst->play(m_tvAudio, m_tvMeter);
+        m_tvMeter->start();
+    }
+    else if (m_tvAudio) {
+        m_gst->stop(m_tvAudio);
+        m_tvAudio = NULL;
+        m_tvMeter->stop();
+        m_loudness.detach();
+    }
+}
+
+// Live view through GStreamer: v4l2src straight into xvimagesink. The
+// frames on their way to the sink are tapped for capFrame().
+void ApplicationWindow::capStartGst(bool start)
+{
+    if (start) {
+        // new capture via gstreamer api
+        m_tvVideo = gst_pipeline_new("tunervideoplayimage");
+        v4l2src = gst_element_factory_make("v4l2src","v4l2src");
+        xvimagesink = gst_element_factory_make("xvimagesink","xvimagesink");
+
+        g_object_set(G_OBJECT(v4l2src), "device", "/dev/video0", NULL);
+
+        gst_bin_add_many(GST_BIN(m_tvVideo),v4l2src,xvimagesink,NULL);
+        gst_element_link_many(v4l2src,xvimagesink,NULL);
+
+        // xvimagesink shows the picture, capFrame() only looks at it
+        m_showFrames = false;
+        m_mustConvert = false;
+        m_gridRaw = false;
+        memset(&m_capSrcFormat, 0, sizeof(m_capSrcFormat));
+        m_timing.reset();
+        m_tap->attach(xvimagesink);
+        m_frames = m_tap;
+        m_gst->play(m_tvVideo);
+        audioMonitor(true);
+    }
+    else if (m_tvVideo) {
+        // stopped before the probe goes, see GstFrameTap::detach()
+        m_gst->stop(m_tvVideo);
+        m_tvVideo = NULL;
+        m_tap->detach();
+        m_frames = NULL;
+        stopFrames();
+        audioMonitor(false);
+    }
+}
+
+// Live view through the native V4L2 capture thread, see startCapture().
+void ApplicationWindow::capStartNative(bool start)
+{
+    static const struct {
+        __u32 v4l2_pixfmt;
+        QImage::Format qt_pixfmt;
+    } supported_fmts[] = {
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+        { V4L2_PIX_FMT_RGB32, QImage::Format_RGB32 },
+        { V4L2_PIX_FMT_RGB24, QImage::Format_RGB888 },
+        { V4L2_PIX_FMT_RGB565X, QImage::Format_RGB16 },
+        { V4L2_PIX_FMT_RGB555X, QImage::Format_RGB555 },
+#else
+        { V4L2_PIX_FMT_BGR32, QImage::Format_RGB32 },
+        { V4L2_PIX_FMT_RGB24, QImage::Format_RGB888 },
+        { V4L2_PIX_FMT_RGB565, QImage::Format_RGB16 },
+        { V4L2_PIX_FMT_RGB555, QImage::Format_RGB555 },
+        { V4L2_PIX_FMT_RGB444, QImage::Format_RGB444 },
+#endif
+        { 0, QImage::Format_Invalid }
+    };
+    QImage::Format dstFmt = QImage::Format_RGB888;
+    struct v4l2_fract interval;
+    v4l2_pix_format &srcPix = m_capSrcFormat.fmt.pix;
+    v4l2_pix_format &dstPix = m_capDestFormat.fmt.pix;
+
+    if (!start) {
+        stopCapture();
+        deleteCapImages();
+        stopFrames();
+        audioMonitor(false);
+        return;
+    }
+    m_showFrames = m_showFramesAct->isChecked();
+    m_timing.reset();
+    m_lastPreview = 0;
+    m_capMethod = m_genTab->capMethod();
+
+    if (m_genTab->isSlicedVbi()) {
+        v4l2_format fmt;
+        v4l2_std_id std;
+
+        m_showFrames = false;
+        g_fmt_sliced_vbi(fmt);
+        g_std(std);
+        fmt.fmt.sliced.service_set = (std & V4L2_STD_625_50) ?
+            V4L2_SLICED_VBI_625 : V4L2_SLICED_VBI_525;
+        s_fmt(fmt);
+        m_vbiSlicer.clear();
+        m_vbiTab->slicedFormat(fmt.fmt.sliced);
+        m_vbiSize = fmt.fmt.sliced.io_size;
+        startCapture(m_vbiSize);
+        return;
+    }
+    if (m_genTab->isVbi()) {
+        v4l2_format fmt;
+        v4l2_std_id std;
+
+        g_fmt_vbi(fmt);
+        if (fmt.fmt.vbi.sample_format != V4L2_PIX_FMT_GREY) {
+            error("non-grey pixelformat not supported for VBI\n");
             return;
         }
-        m_showFrames = m_showFramesAct->isChecked();
-        m_frame = m_lastFrame = m_fps = 0;
-        m_capMethod = m_genTab->capMethod();
-
-        if (m_genTab->isSlicedVbi()) {
-            v4l2_format fmt;
-            v4l2_std_id std;
-
-            m_showFrames = false;
-            g_fmt_sliced_vbi(fmt);
-            g_std(std);
-            fmt.fmt.sliced.service_set = (std & V4L2_STD_625_50) ?
-                V4L2_SLICED_VBI_625 : V4L2_SLICED_VBI_525;
-            s_fmt(fmt);
-            memset(&m_vbiHandle, 0, sizeof(m_vbiHandle));
-            m_vbiTab->slicedFormat(fmt.fmt.sliced);
-            m_vbiSize = fmt.fmt.sliced.io_size;
-            m_frameData = new unsigned char[m_vbiSize];
-            if (startCapture(m_vbiSize)) {
-                m_capNotifier = new QSocketNotifier(fd(), QSocketNotifier::Read, m_tabs);
-                connect(m_capNotifier, SIGNAL(activated(int)), this, SLOT(capVbiFrame()));
-            }
+        s_fmt(fmt);
+        g_std(std);
+        if (!m_vbiSlicer.prepare(fmt.fmt.vbi, std)) {
+            error("no services possible\n");
             return;
         }
-        if (m_genTab->isVbi()) {
-            v4l2_format fmt;
-            v4l2_std_id std;
-
-            g_fmt_vbi(fmt);
-            if (fmt.fmt.vbi.sample_format != V4L2_PIX_FMT_GREY) {
-                error("non-grey pixelformat not supported for VBI\n");
-                return;
-            }
-            s_fmt(fmt);
-            g_std(std);
-            if (!vbi_prepare(&m_vbiHandle, &fmt.fmt.vbi, std)) {
-                error("no services possible\n");
-                return;
-            }
-            m_vbiTab->rawFormat(fmt.fmt.vbi);
-            m_vbiWidth = fmt.fmt.vbi.samples_per_line;
-            if (fmt.fmt.vbi.flags & V4L2_VBI_INTERLACED)
-                m_vbiHeight = fmt.fmt.vbi.count[0];
-            else
-                m_vbiHeight = fmt.fmt.vbi.count[0] + fmt.fmt.vbi.count[1];
-            m_vbiSize = m_vbiWidth * m_vbiHeight;
-            m_frameData = new unsigned char[m_vbiSize];
-            if (m_showFrames) {
-                m_capture->setMinimumSize(m_vbiWidth, m_vbiHeight);
-                m_capImage = new QImage(m_vbiWidth, m_vbiHeight, dstFmt);
-                m_capImage->fill(0);
-                m_capture->setImage(*m_capImage, "No frame");
-                m_capture->show();
-            }
-            statusBar()->showMessage("No frame");
-            if (startCapture(m_vbiSize)) {
-                m_capNotifier = new QSocketNotifier(fd(), QSocketNotifier::Read, m_tabs);
-                connect(m_capNotifier, SIGNAL(activated(int)), this, SLOT(capVbiFrame()));
-            }
-            return;
+        m_vbiTab->rawFormat(fmt.fmt.vbi);
+        m_vbiWidth = fmt.fmt.vbi.samples_per_line;
+        if (fmt.fmt.vbi.flags & V4L2_VBI_INTERLACED)
+            m_vbiHeight = fmt.fmt.vbi.count[0];
+        else
+            m_vbiHeight = fmt.fmt.vbi.count[0] + fmt.fmt.vbi.count[1];
+        m_vbiSize = m_vbiWidth * m_vbiHeight;
+        if (m_showFrames) {
+            m_capture->setMinimumSize(m_vbiWidth, m_vbiHeight);
+            newCapImages(m_vbiWidth, m_vbiHeight, dstFmt);
+            m_capture->show();
         }
+        statusBar()->showMessage("No frame");
+        startCapture(m_vbiSize);
+        return;
+    }
 
-        g_fmt_cap(m_capSrcFormat);
-        s_fmt(m_capSrcFormat);
-        if (m_genTab->get_interval(interval))
-            set_interval(interval);
+    g_fmt_cap(m_capSrcFormat);
+    s_fmt(m_capSrcFormat);
+    if (m_genTab->get_interval(interval))
+        set_interval(interval);
+    startFrames();
 
-        m_mustConvert = m_showFrames;
-        m_frameData = new unsigned char[srcPix.sizeimage];
-        if (m_showFrames) {
-            m_capDestFormat = m_capSrcFormat;
-            dstPix.pixelformat = V4L2_PIX_FMT_RGB24;
-
-            for (int i = 0; supported_fmts[i].v4l2_pixfmt; i++) {
-                if (supported_fmts[i].v4l2_pixfmt == srcPix.pixelformat) {
-                    dstPix.pixelformat = supported_fmts[i].v4l2_pixfmt;
-                    dstFmt = supported_fmts[i].qt_pixfmt;
-                    m_mustConvert = false;
-                    break;
-                }
-            }
-            if (m_mustConvert) {
-                v4l2_format copy = m_capSrcFormat;
-
-                // check this line 2017
-                v4lconvert_try_format(m_convertData, &m_capDestFormat, &m_capSrcFormat);
-                // v4lconvert_try_format sometimes modifies the source format if it thinks
-                // that there is a better format available. Restore our selected source
-                // format since we do not want that happening.
-                m_capSrcFormat = copy;
+    m_mustConvert = m_showFrames;
+    if (m_showFrames) {
+        m_capDestFormat = m_capSrcFormat;
+        dstPix.pixelformat = V4L2_PIX_FMT_RGB24;
+
+        for (int i = 0; supported_fmts[i].v4l2_pixfmt; i++) {
+            if (supported_fmts[i].v4l2_pixfmt == srcPix.pixelformat) {
+                dstPix.pixelformat = supported_fmts[i].v4l2_pixfmt;
+                dstFmt = supported_fmts[i].qt_pixfmt;
+                m_mustConvert = false;
+                break;
             }
-
-            m_capture->setMinimumSize(dstPix.width, dstPix.height);
-            m_capImage = new QImage(dstPix.width, dstPix.height, dstFmt);
-            m_capImage->fill(0);
-            m_capture->setImage(*m_capImage, "No frame");
-            m_capture->show();
         }
-
-        statusBar()->showMessage("No frame");
-        if (startCapture(srcPix.sizeimage)) {
-            m_capNotifier = new QSocketNotifier(fd(), QSocketNotifier::Read, m_tabs);
-            connect(m_capNotifier, SIGNAL(activated(int)), this, SLOT(capFrame()));
+        if (m_mustConvert) {
+            v4l2_format copy = m_capSrcFormat;
+
+            v4lconvert_try_format(m_convertData, &m_capDestFormat, &m_capSrcFormat);
+            // v4lconvert_try_format sometimes modifies the source format if it thinks
+            // that there is a better format available. Restore our selected source
+            // format since we do not want that happening.
+            m_capSrcFormat = copy;
+            // the common YUV formats are converted on all cores
+            m_convEngine.setFormat(m_capSrcFormat, m_capDestFormat);
         }
-        */
 
+        m_capture->setMinimumSize(dstPix.width, dstPix.height);
+        newCapImages(dstPix.width, dstPix.height, dstFmt);
+        m_capture->show();
+    }
+
+    statusBar()->showMessage("No frame");
+    // a recording has no sound to listen to
+    if (startCapture(srcPix.sizeimage) && !isReplay())
+        audioMonitor(true);
+}
+
+void ApplicationWindow::capStart(bool start)
+{
+    int tab = m_tabs->currentIndex();
+    if (tab == 0) {
+        // GStreamer cannot read recordings
+        if (m_capEngine == engineNative || isReplay())
+            capStartNative(start);
+        else
+            capStartGst(start);
     }
     else if (tab == 2) {
         // listen to the radio without writing an audio file
 
         if (start)
         {
-
-            loop2 = g_main_loop_new(NULL,FALSE);
             pline2 = gst_pipeline_new("tuneraudioplay");
             pline = gst_pipeline_new("tuneraudiosetfreq");
             alsasrc = gst_element_factory_make("alsasrc","alsasrc");
@@ -1262,7 +1488,7 @@ void ApplicationWindow::capStart(bool start)
 
             g_object_set(G_OBJECT(v4l2radio), "frequency", sfreq, NULL);
             g_object_set(G_OBJECT(alsasrc), "device","hw:1,0",NULL);
-            g_object_set(G_OBJECT(level), "post-messages", TRUE, NULL);
+            LevelMeter::configure(level);
 
 
 
@@ -1276,33 +1502,19 @@ void ApplicationWindow::capStart(bool start)
             gboolean link_ok;
             link_ok = gst_element_link_filtered (alsasrc, audioconvert, caps);
 
-            bus = gst_element_get_bus(pline2);
-            getpbpointer = new GetProgBarPointer();
-            getpbpointer->leftbar = (gpointer)progbar2left;
-            getpbpointer->rightbar = (gpointer)progbar2right;
-
             gst_bin_add(GST_BIN(pline),v4l2radio);
             //gst_element_link(pline,pline2);
 
-            guint watch_id;
-            watch_id = gst_bus_add_watch(bus, message_handler, getpbpointer);
-            gst_bus_add_watch(bus, bus_call, loop2);
-            gst_object_unref(bus);
-            gst_element_set_state(pline, GST_STATE_PLAYING);
-            gst_element_set_state(pline2, GST_STATE_PLAYING);
-
-            g_main_loop_run(loop2);
-            g_main_loop_unref (loop2);
-
+            m_gst->play(pline);
+            m_loudness.attach(level);
+            m_gst->play(pline2, m_radioMeter);
+            m_radioMeter->start();
         }
         else {
-            gst_element_send_event(pline2,gst_event_new_eos());
-            gst_element_set_state(pline,GST_STATE_NULL);
-            gst_element_set_state(pline2,GST_STATE_NULL);
-            progbar2left->setValue(progbar2left->minimum());
-            progbar2right->setValue(progbar2right->minimum());
-            delete getpbpointer;
-            g_main_loop_quit(loop2);
+            m_gst->stop(pline);
+            m_gst->stop(pline2);
+            m_radioMeter->stop();
+            m_loudness.detach();
         }
     }
 }
@@ -1314,19 +1526,22 @@ void ApplicationWindow::closeDevice()
     m_capStartAct->setEnabled(false);
     m_capStartAct->setChecked(false);
     if (fd() >= 0) {
-        if (m_capNotifier) {
-            delete m_capNotifier;
-            delete m_capImage;
-            m_capNotifier = NULL;
-            m_capImage = NULL;
+        if (m_capThread) {
+            delete m_capThread;
+            deleteCapImages();
+            m_capThread = NULL;
+            m_frames = NULL;
+            m_shownFrame = NULL;
         }
-        delete m_frameData;
-        m_frameData = NULL;
         v4lconvert_destroy(m_convertData);
         v4l2::close();
         delete m_capture;
         m_capture = NULL;
     }
+    m_loudness.detach();
+    // the radio bars go away with their tab
+    m_radioMeter->stop();
+    m_radioMeter->setBars(NULL, NULL);
     while (QWidget *page = m_tabs->widget(0)) {
         m_tabs->removeTab(0);
         delete page;
@@ -1336,41 +1551,49 @@ void ApplicationWindow::closeDevice()
     m_classMap.clear();
 }
 
-bool SaveDialog::setBuffer(unsigned char *buf, unsigned size)
-{
-    m_buf = new unsigned char[size];
-    m_size = size;
-    if (m_buf == NULL)
-        return false;
-    memcpy(m_buf, buf, size);
-    return true;
-}
-
 void SaveDialog::selected(const QString &s)
 {
-    if (!s.isEmpty()) {
-        tmpImage->save(s + ".jpg","JPG");
-        //file.open(QIODevice::WriteOnly | QIODevice::Truncate);
-        //file.write((const char *)m_buf, m_size);
-        //file.close();
-    }
-    delete [] m_buf;
+    if (!s.isEmpty())
+        m_image.save(s + ".jpg","JPG");
 }
 
-void ApplicationWindow::makeSnapshot(unsigned char *buf, unsigned size)
+// The snapshot is converted from the frame itself, whether or not the
+// preview shows it, and the dialog keeps its own copy while it is open.
+void ApplicationWindow::makeSnapshot(const CapFrame *frame)
 {
+    v4l2_format dstFormat = m_capSrcFormat;
+    v4l2_pix_format &dstPix = dstFormat.fmt.pix;
+    unsigned char *rgb;
+
     m_makeSnapshot = false;
+    dstPix.pixelformat = V4L2_PIX_FMT_RGB24;
+    dstPix.bytesperline = dstPix.width * 3;
+    dstPix.sizeimage = dstPix.bytesperline * dstPix.height;
+    // the GStreamer engine has no format before its first frame
+    if (dstPix.sizeimage == 0)
+        return;
+    rgb = (unsigned char *)malloc(dstPix.sizeimage);
+    if (rgb == NULL) {
+        error("No memory to make snapshot\n");
+        return;
+    }
+    if (v4lconvert_convert(m_convertData, &m_capSrcFormat, &dstFormat,
+                           frame->data, frame->size, rgb, dstPix.sizeimage) < 0) {
+        free(rgb);
+        error(QString("Cannot make snapshot: %1")
+              .arg(v4lconvert_get_error_message(m_convertData)));
+        return;
+    }
+
     SaveDialog *dlg = new SaveDialog(this, "Save Snapshot");
     dlg->setAttribute(Qt::WA_DeleteOnClose);
     dlg->setFileMode(QFileDialog::AnyFile);
     dlg->setAcceptMode(QFileDialog::AcceptSave);
     dlg->setModal(false);
-    if (!dlg->setBuffer(buf, size)) {
-        delete dlg;
-        error("No memory to make snapshot\n");
-        return;
-    }
-    dlg->tmpImage =  m_capImage; // this pointer is a workaround
+    // copy() gives the dialog an image that owns its pixels
+    dlg->setImage(QImage(rgb, dstPix.width, dstPix.height, dstPix.bytesperline,
+                         QImage::Format_RGB888).copy());
+    free(rgb);
     connect(dlg, SIGNAL(fileSelected(const QString &)), dlg, SLOT(selected(const QString &)));
     dlg->show();
 }
@@ -1387,15 +1610,20 @@ void ApplicationWindow::rejectedRawFile()
 
 void ApplicationWindow::openRawFile(const QString &s)
 {
+    v4l2_format fmt;
+
     if (s.isEmpty())
         return;
 
-    if (m_saveRaw.openMode()) {
-
-        m_saveRaw.close();
+    if (m_genTab->isVbi())
+        g_fmt_vbi(fmt);
+    else
+        g_fmt_cap(fmt);
+    if (!m_saveRaw.open(s, m_rawDirect, fmt)) {
+        error(QString("Cannot open %1").arg(s));
+        m_saveRawAct->setChecked(false);
+        return;
     }
-    m_saveRaw.setFileName(s);
-    m_saveRaw.open(QIODevice::WriteOnly | QIODevice::Truncate);
 
     m_saveRawAct->setChecked(true);
 }
@@ -1403,8 +1631,11 @@ void ApplicationWindow::openRawFile(const QString &s)
 void ApplicationWindow::saveRaw(bool checked)
 {
     if (!checked) {
-        if (m_saveRaw.openMode())
+        if (m_saveRaw.isOpen()) {
             m_saveRaw.close();
+            fprintf(stderr, "%u raw frames (%llu bytes) written, %u frames dropped\n",
+                    m_saveRaw.frames(), m_saveRaw.written(), m_saveRaw.dropped());
+        }
         return;
     }
 
@@ -1474,6 +1705,26 @@ int main(int argc, char **argv)
     QString device = "/dev/video0";
     bool raw = false;
     bool help = false;
+    unsigned buffers = 0;
+    bool adaptive = false;
+    unsigned bench = 0;
+    unsigned preview = 0;
+    CapEngine engine = engineGStreamer;
+    bool direct = false;
+    bool realtime = true;
+    QString ring;
+    QString loudLog;
+    QString alarmLog;
+    QString captionLog;
+    double freezeTime = 10;
+    double blackTime = 2;
+    double silenceLevel = -60;
+    double silenceTime = 5;
+    unsigned ringSize = 2048;
+    const EncProfile *profile = encDefaultProfile();
+    unsigned encThreads = 0;
+    unsigned encBench = 0;
+    unsigned vbiBench = 0;
     int i;
 
     a.setWindowIcon(QIcon(":/qv4l2.png"));
@@ -1487,15 +1738,143 @@ int main(int argc, char **argv)
             raw = true;
         else if (!strcmp(arg, "-h"))
             help = true;
+        else if (!strcmp(arg, "-n") && i + 1 < argc)
+            buffers = strtoul(a.argv()[++i], NULL, 0);
+        else if (!strcmp(arg, "-a"))
+            adaptive = true;
+        else if (!strcmp(arg, "-b") && i + 1 < argc)
+            bench = strtoul(a.argv()[++i], NULL, 0);
+        else if (!strcmp(arg, "-p") && i + 1 < argc)
+            preview = strtoul(a.argv()[++i], NULL, 0);
+        else if (!strcmp(arg, "-e") && i + 1 < argc) {
+            const char *s = a.argv()[++i];
+
+            if (!strcmp(s, "gst"))
+                engine = engineGStreamer;
+            else if (!strcmp(s, "native"))
+                engine = engineNative;
+            else {
+                fprintf(stderr, "unknown capture engine %s\n", s);
+                return 1;
+            }
+        }
+        else if (!strcmp(arg, "-d"))
+            direct = true;
+        else if (!strcmp(arg, "-m"))
+            realtime = false;
+        else if (!strcmp(arg, "-l") && i + 1 < argc)
+            ring = a.argv()[++i];
+        else if (!strcmp(arg, "-s") && i + 1 < argc)
+            ringSize = strtoul(a.argv()[++i], NULL, 0);
+        else if (!strcmp(arg, "-c") && i + 1 < argc) {
+            QString s = a.argv()[++i];
+
+            profile = encProfile(s.section(':', 0, 0).toAscii().data());
+            encThreads = s.section(':', 1, 1).toUInt();
+            if (profile == NULL) {
+                fprintf(stderr, "unknown encoder profile %s\n", s.toAscii().data());
+                return 1;
+            }
+        }
+        else if (!strcmp(arg, "-B") && i + 1 < argc)
+            encBench = strtoul(a.argv()[++i], NULL, 0);
+        else if (!strcmp(arg, "-V") && i + 1 < argc)
+            vbiBench = strtoul(a.argv()[++i], NULL, 0);
+        else if (!strcmp(arg, "-L") && i + 1 < argc)
+            loudLog = a.argv()[++i];
+        else if (!strcmp(arg, "-A") && i + 1 < argc)
+            alarmLog = a.argv()[++i];
+        else if (!strcmp(arg, "-F") && i + 1 < argc) {
+            const char *s = a.argv()[++i];
+            char *end;
+
+            freezeTime = strtod(s, &end);
+            if (end == s || *end || !(freezeTime > 0)) {
+                fprintf(stderr, "invalid frozen picture time %s\n", s);
+                return 1;
+            }
+        }
+        else if (!strcmp(arg, "-K") && i + 1 < argc) {
+            const char *s = a.argv()[++i];
+            char *end;
+
+            blackTime = strtod(s, &end);
+            if (end == s || *end || !(blackTime > 0)) {
+                fprintf(stderr, "invalid black picture time %s\n", s);
+                return 1;
+            }
+        }
+        else if (!strcmp(arg, "-S") && i + 1 < argc) {
+            const char *s = a.argv()[++i];
+            char *end;
+
+            silenceLevel = strtod(s, &end);
+            if (end != s && *end == ':')
+                silenceTime = strtod(end + 1, &end);
+            if (end == s || *end || !(silenceLevel < 0) || !(silenceTime > 0)) {
+                fprintf(stderr, "invalid silence threshold %s\n", s);
+                return 1;
+            }
+        }
+        else if (!strcmp(arg, "-C") && i + 1 < argc)
+            captionLog = a.argv()[++i];
         else if (arg[0] != '-')
             device = arg;
     }
     if (help) {
-        printf("qv4l2 [-r] [-h] [device node]\n\n"
+        printf("qv4l2 [-r] [-h] [-n buffers] [-a] [-p fps] [-e engine] [-d] [-m] [-l file] [-s MB]\n"
+               "      [-c profile[:threads]] [-L file] [-A target] [-F seconds] [-K seconds]\n"
+               "      [-S dB[:seconds]] [-C file]\n"
+               "      [-b frames] [-B frames] [-V loops] [device node or recording]\n\n"
                "-h\tthis help message\n"
-               "-r\topen device node in raw mode\n");
+               "-r\topen device node in raw mode\n"
+               "-n\tnumber of streaming buffers (default 3)\n"
+               "-a\tadd streaming buffers when frames are dropped\n"
+               "-p\tshow at most this many frames per second (default all)\n"
+               "-e\tcapture engine: gst (default) or native\n"
+               "-d\tsave raw frames with O_DIRECT, bypassing the page cache\n"
+               "-m\treplay a raw recording as fast as possible instead of in real time\n"
+               "-l\tkeep the most recent frames in this ring file\n"
+               "-s\tsize of the ring file in MB (default 2048, about 30 minutes of 720x576 as JPEG)\n"
+               "-c\tencoder profile for recording (%s, default %s),\n"
+               "\toptionally with the number of encoder threads\n"
+               "-L\tlog the loudness of the audio to this CSV file once a second\n"
+               "-A\twrite picture and silence alarms to this file, or to udp:host:port\n"
+               "-F\traise the frozen picture alarm after this many seconds (default 10)\n"
+               "-K\traise the black picture alarm after this many seconds (default 2)\n"
+               "-S\traise the silence alarm when the audio stays below this level,\n"
+               "\toptionally for this many seconds (default -60 dB for 5 seconds)\n"
+               "-C\tlog the closed captions shown in the VBI tab to this CSV file\n"
+               "-b\tbenchmark format conversion against libv4lconvert and exit\n"
+               "-B\tbenchmark the encoder profiles and exit\n"
+               "-V\tbenchmark the VBI slicer on a raw VBI recording, or on generated\n"
+               "\tframes, and exit\n",
+               encProfileNames(), encDefaultProfile()->name);
         return 0;
     }
+    if (bench)
+        return ConvEngine::benchmark(device.toAscii().data(), bench);
+    if (encBench)
+        return encBenchmark(encBench);
+    if (vbiBench)
+        return vbiBenchmark(device.toAscii().data(), vbiBench);
+    g_mw->setBuffers(buffers, adaptive);
+    g_mw->setPreviewRate(preview);
+    g_mw->setCapEngine(engine);
+    g_mw->setRawDirect(direct);
+    g_mw->setReplayRealtime(realtime);
+    g_mw->setEncProfile(profile, encThreads);
+    if (!ring.isEmpty())
+        g_mw->setRingFile(ring, ringSize);
+    if (!loudLog.isEmpty())
+        g_mw->setLoudnessLog(loudLog);
+    if (!alarmLog.isEmpty())
+        g_mw->setAlarmLog(alarmLog);
+    g_mw->setFreezeTime(freezeTime);
+    g_mw->setBlackTime(blackTime);
+    g_mw->setSilence(silenceLevel, silenceTime);
+    if (!captionLog.isEmpty())
+        g_mw->setCaptionLog(captionLog);
     g_mw->setDevice(device, raw);
     g_mw->show();
     a.connect(&a, SIGNAL(lastWindowClosed()), &a, SLOT(quit()));
@@ -25,7 +25,6 @@
 #include <QSignalMapper>
 #include <QLabel>
 #include <QGridLayout>
-#include <QSocketNotifier>
 #include <QImage>
 #include <QFileDialog>
 #include <map>
@@ -34,7 +33,16 @@
 #include <QProgressBar>
 
 #include "v4l2-api.h"
-#include "raw2sliced.h"
+#include "vbi-slicer.h"
+#include "frame-timing.h"
+#include "conv-engine.h"
+#include "raw-container.h"
+#include "ring-recorder.h"
+#include "enc-profile.h"
+#include "gst-worker.h"
+#include "loudness.h"
+#include "video-detect.h"
+#include "alarm-log.h"
 
 // gstreamer
 #include <gst/gst.h>
@@ -46,6 +54,11 @@ class GeneralTab;
 class VbiTab;
 class QCloseEvent;
 class CaptureWin;
+class CaptureThread;
+class GstFrameTap;
+class RingEncoder;
+class FrameSource;
+struct CapFrame;
 
 typedef std::vector<unsigned> ClassIDVec;
 typedef std::map<unsigned, ClassIDVec> ClassMap;
@@ -62,18 +75,22 @@ enum {
 enum CapMethod {
     methodRead,
     methodMmap,
-    methodUser
+    methodUser,
+    methodDmabuf
+};
+
+// How the TV tab captures: through a GStreamer pipeline or with the
+// native V4L2 capture thread. Either way the frames reach capFrame()
+// through a FrameSource and the sound goes through the audio monitor.
+enum CapEngine {
+    engineGStreamer,
+    engineNative
 };
 
 struct buffer {
     void   *start;
     size_t  length;
-};
-
-class GetProgBarPointer {
-public:
-    gpointer leftbar;
-    gpointer rightbar;
+    int     fd;     // exported DMA buffer (methodDmabuf only)
 };
 
 class ApplicationWindow: public QMainWindow, public v4l2
@@ -92,7 +109,18 @@ private slots:
 
 public:
     void setDevice(const QString &device, bool rawOpen);
-    GetProgBarPointer *getpbpointer;
+    void setBuffers(unsigned count, bool adaptive);
+    void setPreviewRate(unsigned fps);
+    void setCapEngine(CapEngine engine);
+    void setRawDirect(bool direct);
+    void setRingFile(const QString &fileName, unsigned sizeMB);
+    void setEncProfile(const EncProfile *profile, unsigned threads);
+    void setLoudnessLog(const QString &fileName);
+    void setAlarmLog(const QString &target);
+    void setFreezeTime(double seconds);
+    void setBlackTime(double seconds);
+    void setSilence(double dB, double seconds);
+    void setCaptionLog(const QString &fileName);
     // capturing
 private:
     CaptureWin *m_capture;
@@ -104,22 +132,26 @@ private:
     GstElement *v4l2src;
     GstElement *videoqueue;
     GstElement *videoconvert;
-    GstElement *theoraenc;
+    GstElement *videoenc;
     GstElement *alsasrc;
     GstElement *audioqueue;
     GstElement *audioconvert;
     GstElement *videorate;
     GstElement *vorbisenc;
-    GstElement *oggmux;
+    GstElement *mux;
     GstElement *filesink;
-    GMainLoop *loop;
-    GstBus *bus;
+    GstWorker *m_gst;
+    GstFrameTap *m_tap;
+    GstElement *m_tvVideo;          // live view of the GStreamer engine
+    GstElement *m_tvAudio;          // audio monitor of the TV tab
+    LevelMeter *m_tvMeter;
+    LevelMeter *m_radioMeter;
+    Loudness m_loudness;
 
     GstElement *v4l2radio;
     GstElement *wavenc;
     GstElement *audioresample;
     GstElement *pline2;
-    GMainLoop *loop2;
     GstElement *level;
     GstElement *rqueue;
     GstElement *alsasink;
@@ -128,27 +160,47 @@ private:
 
     bool startCapture(unsigned buffer_size);
     void stopCapture();
+    void startFrames();
+    void stopFrames();
+    void stopRing();
+    bool gridConvert(const CapFrame *frame);
+    void audioMonitor(bool start);
+    void newCapImages(int width, int height, QImage::Format format);
+    void deleteCapImages();
     void stopCapture2();
     void startOutput(unsigned buffer_size);
     void stopOutput();
     struct buffer *m_buffers;
     struct v4l2_format m_capSrcFormat;
     struct v4l2_format m_capDestFormat;
-    unsigned char *m_frameData;
     unsigned m_nbuffers;
     struct v4lconvert_data *m_convertData;
+    ConvEngine m_convEngine;
     bool m_mustConvert;
     CapMethod m_capMethod;
     bool m_makeSnapshot;
+    unsigned m_numBuffers;
+    bool m_adaptiveBuffers;
+    unsigned m_previewFps;
+    long long m_lastPreview;
+    CapEngine m_capEngine;
+    const EncProfile *m_encProfile;
+    unsigned m_encThreads;
 
 private slots:
     void capStart(bool);
     void capFrame();
+    void capError(const QString &text);
+    void rawWriteError(const QString &text);
     void snapshot();
     void capVbiFrame();
     void saveRaw(bool);
+    void exportRing();
+    void ringExported(int frames, bool overrun);
     // gstreamer
     void capStart2(bool);
+    void gstError(const QString &text);
+    void audioSilence(bool on);
 
     // gui
 private slots:
@@ -173,6 +225,7 @@ public:
 
     QProgressBar *progbar1left;
     QProgressBar *progbar1right;
+    QLabel *loudlabel1;
 
 private:
     void addWidget(QGridLayout *grid, QWidget *w, Qt::Alignment align = Qt::AlignLeft);
@@ -186,7 +239,14 @@ private:
     void updateCtrl(unsigned id);
     void refresh(unsigned ctrl_class);
     void refresh();
-    void makeSnapshot(unsigned char *buf, unsigned size);
+    void updateStats();
+    bool previewDue();
+    void frameTiming(unsigned frames, const QImage *image);
+    void checkPicture();
+    void alarm(const char *source, bool on, const QString &text);
+    void capStartGst(bool start);
+    void capStartNative(bool start);
+    void makeSnapshot(const CapFrame *frame);
     void setDefaults(unsigned ctrl_class);
     int getVal(unsigned id);
     long long getVal64(unsigned id);
@@ -210,12 +270,18 @@ private:
     QAction *m_capStartAct;
     QAction *m_snapshotAct;
     QAction *m_saveRawAct;
+    QAction *m_exportAct;
     QAction *m_showFramesAct;
     QString m_filename;
     QSignalMapper *m_sigMapper;
     QTabWidget *m_tabs;
-    QSocketNotifier *m_capNotifier;
+    CaptureThread *m_capThread;
+    FrameSource *m_frames;          // m_capThread or m_tap while capturing
+    CapFrame *m_shownFrame;
+    // The capture window keeps a shallow copy of the image it shows, so
+    // frames go into the other image, or writing would detach a copy.
     QImage *m_capImage;
+    QImage *m_capShown;
     int m_row, m_col, m_cols;
     CtrlMap m_ctrlMap;
     WidgetMap m_widgetMap;
@@ -225,17 +291,33 @@ private:
     int m_vbiSize;
     unsigned m_vbiWidth;
     unsigned m_vbiHeight;
-    struct vbi_handle m_vbiHandle;
-    unsigned m_frame;
-    unsigned m_lastFrame;
-    unsigned m_fps;
-    struct timeval m_tv;
-    QFile m_saveRaw;
+    VbiSlicer m_vbiSlicer;
+    FrameTiming m_timing;
+    RawRecorder m_saveRaw;
+    bool m_rawDirect;
+    RingRecorder m_ring;
+    // after m_ring, so that an export is stopped before the ring closes
+    RingExporter m_ringExport;
+    RingEncoder *m_ringEnc;
+    GstElement *m_ringPipe;         // compresses the frames for m_ring or NULL
+    QString m_exportFile;
+    LumaGrid m_grid;
+    bool m_gridRaw;                 // m_grid reads the frames as they are
+    v4l2_format m_gridFormat;       // or converted into m_gridBuf
+    unsigned char *m_gridBuf;
+    unsigned m_gridErrors;
+    BlackDetector m_black;
+    AlarmTrigger m_blackAlarm;
+    FreezeDetector m_freeze;
+    AlarmTrigger m_freezeAlarm;
+    AlarmLog m_alarms;
+    QString m_captionLog;
     QTabWidget *r_tabs;
     QTableWidget *radiofreqtable;
     QLabel *proglabel;
     QProgressBar *progbar2left;
     QProgressBar *progbar2right;
+    QLabel *loudlabel2;
 };
 
 extern ApplicationWindow *g_mw;
@@ -245,18 +327,16 @@ class SaveDialog : public QFileDialog
     Q_OBJECT
 
 public:
-    QImage *tmpImage;
     SaveDialog(QWidget *parent, const QString &caption) :
-        QFileDialog(parent, caption), m_buf(NULL) {}
+        QFileDialog(parent, caption) {}
     virtual ~SaveDialog() {}
-    bool setBuffer(unsigned char *buf, unsigned size);
+    void setImage(const QImage &image) { m_image = image; }
 
 public slots:
     void selected(const QString &s);
 
 private:
-    unsigned char *m_buf;
-    unsigned m_size;
+    QImage m_image;
 };
 
 #endif
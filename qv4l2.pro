@@ -7,8 +7,8 @@ INCLUDEPATH += . ../libv4l2util ../../lib/include ../../include
 CONFIG += debug
 
 # Input
-HEADERS += qv4l2.h general-tab.h v4l2-api.h capture-win.h vbi-tab.h raw2sliced.h
-SOURCES += qv4l2.cpp general-tab.cpp ctrl-tab.cpp v4l2-api.cpp capture-win.cpp vbi-tab.cpp raw2sliced.cpp
+HEADERS += qv4l2.h general-tab.h v4l2-api.h capture-win.h vbi-tab.h raw2sliced.h capture-thread.h capture-stats.h frame-timing.h conv-engine.h conv-simd.h raw-writer.h raw-container.h raw-replay.h ring-recorder.h ring-encoder.h enc-profile.h gst-worker.h gst-tap.h level-meter.h loudness.h video-detect.h alarm-log.h vbi-bench.h vbi-slicer.h teletext.h caption.h
+SOURCES += qv4l2.cpp general-tab.cpp ctrl-tab.cpp v4l2-api.cpp capture-win.cpp vbi-tab.cpp raw2sliced.cpp capture-thread.cpp capture-stats.cpp frame-timing.cpp conv-engine.cpp conv-simd.cpp raw-writer.cpp raw-container.cpp raw-replay.cpp ring-recorder.cpp ring-encoder.cpp enc-profile.cpp gst-worker.cpp gst-tap.cpp level-meter.cpp loudness.cpp video-detect.cpp alarm-log.cpp vbi-bench.cpp vbi-slicer.cpp teletext.cpp caption.cpp
 LIBS += -L../../lib/libv4l2 -lv4l2 -L../../lib/libv4lconvert -lv4lconvert -lrt -L../libv4l2util -lv4l2util -ldl -ljpeg
 
 RESOURCES += qv4l2.qrc
@@ -0,0 +1,230 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "raw-container.h"
+
+#define RAW_PAD(n) (((n) + 7) & ~7U)
+
+bool RawRecorder::open(const QString &fileName, bool direct, const v4l2_format &fmt)
+{
+	if (!m_writer.open(fileName, direct))
+		return false;
+	m_fileName = fileName;
+	memset(&m_header, 0, sizeof(m_header));
+	memcpy(m_header.magic, RAW_FILE_MAGIC, sizeof(m_header.magic));
+	m_header.headerSize = sizeof(m_header);
+	m_header.type = fmt.type;
+	memcpy(m_header.format, &fmt.fmt, sizeof(m_header.format));
+	m_index.clear();
+	m_offset = 0;
+	if (!m_writer.write(&m_header, sizeof(m_header))) {
+		m_writer.close();
+		return false;
+	}
+	m_offset = sizeof(m_header);
+	return true;
+}
+
+bool RawRecorder::write(const unsigned char *data, unsigned size, __u32 sequence,
+		__u32 flags, const struct timeval &timestamp)
+{
+	static const unsigned char zeroes[8] = { 0 };
+	RawFrameHeader hdr;
+	RawIndexEntry entry;
+	struct iovec iov[3];
+
+	hdr.magic = RAW_FRAME_MAGIC;
+	hdr.size = size;
+	hdr.sequence = sequence;
+	hdr.flags = flags;
+	hdr.timestamp = timestamp.tv_sec * 1000000000ULL + timestamp.tv_usec * 1000ULL;
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = (void *)data;
+	iov[1].iov_len = size;
+	iov[2].iov_base = (void *)zeroes;
+	iov[2].iov_len = RAW_PAD(size) - size;
+	if (!m_writer.writev(iov, 3))
+		return false;
+	entry.offset = m_offset;
+	entry.timestamp = hdr.timestamp;
+	m_index.append(entry);
+	m_offset += sizeof(hdr) + RAW_PAD(size);
+	return true;
+}
+
+void RawRecorder::close()
+{
+	int fd;
+
+	if (!m_writer.isOpen())
+		return;
+	m_writer.close();
+
+	// The writer may have lost the tail of the file after a write error,
+	// then the header is left alone and readers rebuild the index.
+	if (m_writer.written() != m_offset)
+		return;
+	fd = ::open(m_fileName.toLocal8Bit().data(), O_WRONLY);
+	if (fd < 0)
+		return;
+	m_header.indexOffset = m_offset;
+	m_header.frames = m_index.size();
+	if (pwrite(fd, m_index.constData(), m_index.size() * sizeof(RawIndexEntry),
+				m_offset) == (ssize_t)(m_index.size() * sizeof(RawIndexEntry)))
+		pwrite(fd, &m_header, sizeof(m_header), 0);
+	::close(fd);
+}
+
+RawReader::RawReader() :
+	m_map(NULL),
+	m_size(0),
+	m_index(NULL),
+	m_frames(0),
+	m_complete(false)
+{
+	memset(&m_format, 0, sizeof(m_format));
+}
+
+bool RawReader::open(const QString &fileName)
+{
+	const RawFileHeader *hdr;
+	struct stat st;
+	void *p;
+	int fd;
+
+	close();
+	fd = ::open(fileName.toLocal8Bit().data(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(RawFileHeader)) {
+		::close(fd);
+		return false;
+	}
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED)
+		return false;
+	m_map = (unsigned char *)p;
+	m_size = st.st_size;
+
+	hdr = (const RawFileHeader *)m_map;
+	if (memcmp(hdr->magic, RAW_FILE_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->headerSize < sizeof(RawFileHeader) || hdr->headerSize > m_size) {
+		close();
+		return false;
+	}
+	m_format.type = hdr->type;
+	memcpy(&m_format.fmt, hdr->format, sizeof(hdr->format));
+
+	if (hdr->indexOffset && !(hdr->indexOffset & 7) &&
+	    hdr->indexOffset <= m_size &&
+	    hdr->frames <= (m_size - hdr->indexOffset) / sizeof(RawIndexEntry)) {
+		m_index = (const RawIndexEntry *)(m_map + hdr->indexOffset);
+		m_frames = hdr->frames;
+		m_complete = true;
+		return true;
+	}
+	if (!scan()) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+// Walks the frame records of a recording that was not closed properly.
+// A truncated last frame is left out.
+bool RawReader::scan()
+{
+	const RawFileHeader *hdr = (const RawFileHeader *)m_map;
+	size_t offset = RAW_PAD(hdr->headerSize);
+
+	m_scanned.clear();
+	while (offset + sizeof(RawFrameHeader) <= m_size) {
+		const RawFrameHeader *frame = (const RawFrameHeader *)(m_map + offset);
+		RawIndexEntry entry;
+
+		if (frame->magic != RAW_FRAME_MAGIC ||
+		    frame->size > m_size - offset - sizeof(RawFrameHeader))
+			break;
+		entry.offset = offset;
+		entry.timestamp = frame->timestamp;
+		m_scanned.append(entry);
+		offset += sizeof(RawFrameHeader) + RAW_PAD(frame->size);
+	}
+	m_index = m_scanned.constData();
+	m_frames = m_scanned.size();
+	m_complete = false;
+	return true;
+}
+
+void RawReader::close()
+{
+	if (m_map)
+		munmap(m_map, m_size);
+	m_map = NULL;
+	m_size = 0;
+	m_index = NULL;
+	m_scanned.clear();
+	m_frames = 0;
+	m_complete = false;
+}
+
+bool RawReader::frame(unsigned index, RawFrame &frame) const
+{
+	const RawFrameHeader *hdr;
+	__u64 offset;
+
+	if (index >= m_frames)
+		return false;
+	offset = m_index[index].offset;
+	if (offset > m_size - sizeof(RawFrameHeader))
+		return false;
+	hdr = (const RawFrameHeader *)(m_map + offset);
+	if (hdr->magic != RAW_FRAME_MAGIC ||
+	    hdr->size > m_size - offset - sizeof(RawFrameHeader))
+		return false;
+	frame.data = (const unsigned char *)(hdr + 1);
+	frame.size = hdr->size;
+	frame.sequence = hdr->sequence;
+	frame.flags = hdr->flags;
+	frame.timestamp = hdr->timestamp;
+	return true;
+}
+
+unsigned RawReader::find(__u64 timestamp) const
+{
+	unsigned lo = 0, hi = m_frames;
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+
+		if (m_index[mid].timestamp < timestamp)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
@@ -0,0 +1,135 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef RAW_CONTAINER_H
+#define RAW_CONTAINER_H
+
+#include <QString>
+#include <QVector>
+#include <sys/time.h>
+#include <linux/videodev2.h>
+
+#include "raw-writer.h"
+
+// Layout of a raw recording, all fields in host byte order:
+//
+//	RawFileHeader
+//	RawFrameHeader, frame data, padding to 8 bytes	(for each frame)
+//	RawIndexEntry					(for each frame)
+//
+// indexOffset and frames in the file header are filled in when the
+// recording is closed. If they are still zero the recording was cut
+// short and the index is rebuilt by walking the frame records.
+
+#define RAW_FILE_MAGIC "QV4LRAW1"
+#define RAW_FRAME_MAGIC 0x52465651	// "QVFR"
+
+struct RawFileHeader {
+	char	magic[8];
+	__u32	headerSize;		// offset of the first frame record
+	__u32	type;			// v4l2_format.type
+	__u8	format[200];		// v4l2_format.fmt
+	__u64	indexOffset;
+	__u32	frames;
+	__u32	reserved;
+};
+
+struct RawFrameHeader {
+	__u32	magic;
+	__u32	size;			// bytes used
+	__u32	sequence;
+	__u32	flags;			// v4l2_buffer.flags
+	__u64	timestamp;		// nsec, clock given by the flags
+};
+
+struct RawIndexEntry {
+	__u64	offset;			// of the RawFrameHeader
+	__u64	timestamp;
+};
+
+// Records frames into the container through a RawWriter.
+class RawRecorder
+{
+public:
+	RawRecorder() : m_offset(0) {}
+
+	bool open(const QString &fileName, bool direct, const v4l2_format &fmt);
+	// Appends the index and fills in the file header.
+	void close();
+	bool isOpen() const { return m_writer.isOpen(); }
+
+	// Returns false if the frame was dropped, it is not indexed then.
+	bool write(const unsigned char *data, unsigned size, __u32 sequence,
+			__u32 flags, const struct timeval &timestamp);
+
+	unsigned backlog() const { return m_writer.backlog(); }
+	unsigned long long written() const { return m_writer.written(); }
+	unsigned dropped() const { return m_writer.dropped(); }
+	unsigned frames() const { return m_index.size(); }
+	RawWriter *writer() { return &m_writer; }
+
+private:
+	RawWriter m_writer;
+	QString m_fileName;
+	RawFileHeader m_header;
+	QVector<RawIndexEntry> m_index;
+	unsigned long long m_offset;
+};
+
+struct RawFrame {
+	const unsigned char *data;	// points into the mapped file
+	unsigned size;
+	__u32 sequence;
+	__u32 flags;
+	__u64 timestamp;
+};
+
+// Maps a recording read-only. Any frame can be reached in constant
+// time through the index.
+class RawReader
+{
+public:
+	RawReader();
+	~RawReader() { close(); }
+
+	bool open(const QString &fileName);
+	void close();
+	bool isOpen() const { return m_map != NULL; }
+	// false if the index had to be rebuilt
+	bool complete() const { return m_complete; }
+
+	const v4l2_format &format() const { return m_format; }
+	unsigned frames() const { return m_frames; }
+	bool frame(unsigned index, RawFrame &frame) const;
+	// First frame at or after timestamp, frames() if there is none.
+	unsigned find(__u64 timestamp) const;
+
+private:
+	bool scan();
+
+	unsigned char *m_map;
+	size_t m_size;
+	v4l2_format m_format;
+	const RawIndexEntry *m_index;
+	QVector<RawIndexEntry> m_scanned;
+	unsigned m_frames;
+	bool m_complete;
+};
+
+#endif
@@ -0,0 +1,543 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+
+#include "raw-replay.h"
+
+static __u64 monotonic()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+RawReplay::RawReplay() :
+	m_realtime(true),
+	m_fd(-1),
+	m_frameSize(0),
+	m_first(0),
+	m_length(0),
+	m_firstSeq(0),
+	m_seqLength(0),
+	m_memory(0),
+	m_nbuffers(0),
+	m_bufSize(0),
+	m_qhead(0),
+	m_nqueued(0),
+	m_streaming(false),
+	m_armed(false),
+	m_next(0),
+	m_base(0),
+	m_seqBase(0)
+{
+	memset(&m_format, 0, sizeof(m_format));
+	memset(m_buffers, 0, sizeof(m_buffers));
+	m_interval.numerator = 1;
+	m_interval.denominator = 25;
+}
+
+RawReplay::~RawReplay()
+{
+	close();
+}
+
+bool RawReplay::isRecording(const QString &fileName)
+{
+	RawFileHeader hdr;
+	int fd = ::open(fileName.toLocal8Bit().data(), O_RDONLY);
+	bool ok;
+
+	if (fd < 0)
+		return false;
+	ok = ::read(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+		!memcmp(hdr.magic, RAW_FILE_MAGIC, sizeof(hdr.magic));
+	::close(fd);
+	return ok;
+}
+
+int RawReplay::open(const QString &fileName, bool realtime)
+{
+	RawFrame first, last;
+	unsigned n;
+
+	close();
+	if (!m_reader.open(fileName) || m_reader.frames() == 0 ||
+	    !m_reader.frame(0, first) || !m_reader.frame(m_reader.frames() - 1, last)) {
+		m_reader.close();
+		return -1;
+	}
+	m_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (m_fd < 0) {
+		m_reader.close();
+		return -1;
+	}
+	m_name = fileName;
+	m_realtime = realtime;
+	m_format = m_reader.format();
+	if (m_format.type == V4L2_BUF_TYPE_VBI_CAPTURE)
+		m_frameSize = (m_format.fmt.vbi.count[0] + m_format.fmt.vbi.count[1]) *
+			m_format.fmt.vbi.samples_per_line;
+	else
+		m_frameSize = m_format.fmt.pix.sizeimage;
+
+	// The recording loops, one average frame interval after its last frame.
+	n = m_reader.frames();
+	m_first = first.timestamp;
+	m_length = last.timestamp - first.timestamp;
+	if (n > 1 && m_length) {
+		m_length += m_length / (n - 1);
+		m_interval.numerator = m_length / n / 1000;
+		m_interval.denominator = 1000000;
+	} else {
+		m_length = 40000000;
+	}
+	m_firstSeq = first.sequence;
+	m_seqLength = last.sequence - first.sequence + 1;
+	// read() may be polled for before it is first called
+	start();
+	return m_fd;
+}
+
+void RawReplay::close()
+{
+	stop();
+	freeBuffers();
+	if (m_fd >= 0)
+		::close(m_fd);
+	m_fd = -1;
+	m_reader.close();
+}
+
+void RawReplay::freeBuffers()
+{
+	for (unsigned i = 0; i < m_nbuffers; i++)
+		if (m_buffers[i].mem)
+			::munmap(m_buffers[i].mem, m_bufSize);
+	memset(m_buffers, 0, sizeof(m_buffers));
+	m_nbuffers = 0;
+	m_qhead = m_nqueued = 0;
+}
+
+// True if the timer expired, which also clears it.
+bool RawReplay::due()
+{
+	uint64_t expired;
+
+	if (!m_armed)
+		return false;
+	if (::read(m_fd, &expired, sizeof(expired)) != sizeof(expired))
+		return false;
+	m_armed = false;
+	return true;
+}
+
+void RawReplay::arm()
+{
+	struct itimerspec its;
+	RawFrame frame;
+	__u64 when = 1;		// already passed, so it fires right away
+
+	if (m_realtime && m_reader.frame(m_next, frame))
+		when = m_base + frame.timestamp - m_first;
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = when / 1000000000;
+	its.it_value.tv_nsec = when % 1000000000;
+	m_armed = timerfd_settime(m_fd, TFD_TIMER_ABSTIME, &its, NULL) == 0;
+}
+
+void RawReplay::start()
+{
+	m_streaming = true;
+	m_next = 0;
+	m_base = monotonic();
+	m_seqBase = 0;
+	arm();
+}
+
+void RawReplay::stop()
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	if (m_fd >= 0)
+		timerfd_settime(m_fd, 0, &its, NULL);
+	m_streaming = false;
+	m_armed = false;
+	for (unsigned i = 0; i < m_nbuffers; i++)
+		m_buffers[i].queued = false;
+	m_qhead = m_nqueued = 0;
+}
+
+// Skips the frames the consumer was too late for, so that at most keep
+// of them are still due, as a driver would have overwritten them.
+void RawReplay::catchUp(unsigned keep)
+{
+	RawFrame frame;
+	__u64 now = monotonic();
+	__u64 due, target;
+	unsigned count;
+
+	if (!m_realtime || !m_reader.frame(m_next, frame))
+		return;
+	due = m_base + frame.timestamp - m_first;
+	if (now < due)
+		return;
+	if (now - due >= m_length) {
+		__u64 loops = (now - due) / m_length;
+
+		m_base += loops * m_length;
+		m_seqBase += loops * m_seqLength;
+	}
+	target = now - m_base + m_first;
+	count = m_reader.find(target + 1) - m_next;
+	// the first frames of the next loop may be due as well
+	if (m_next + count == m_reader.frames() && target - m_first >= m_length)
+		count += m_reader.find(target - m_length + 1);
+	while (count-- > keep)
+		advance();
+}
+
+void RawReplay::advance()
+{
+	if (++m_next < m_reader.frames())
+		return;
+	m_next = 0;
+	m_base += m_length;
+	m_seqBase += m_seqLength;
+}
+
+// Copies the frame that is due and moves on to the next one.
+unsigned RawReplay::deliver(unsigned char *p, unsigned size, v4l2_buffer *buf)
+{
+	RawFrame frame;
+	__u64 now = monotonic();
+	unsigned n = 0;
+
+	memset(&frame, 0, sizeof(frame));
+	if (m_reader.frame(m_next, frame)) {
+		n = frame.size < size ? frame.size : size;
+		memcpy(p, frame.data, n);
+	}
+	if (buf) {
+		buf->bytesused = n;
+		buf->sequence = m_seqBase + frame.sequence - m_firstSeq;
+		buf->flags &= ~(V4L2_BUF_FLAG_QUEUED | V4L2_BUF_FLAG_TIMESTAMP_MASK);
+		buf->flags |= V4L2_BUF_FLAG_DONE | V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+		if (n < frame.size)
+			buf->flags |= V4L2_BUF_FLAG_ERROR;
+		buf->field = V4L2_FIELD_NONE;
+		buf->timestamp.tv_sec = now / 1000000000;
+		buf->timestamp.tv_usec = (now % 1000000000) / 1000;
+	}
+	advance();
+	return n;
+}
+
+int RawReplay::read(unsigned char *p, int size)
+{
+	QMutexLocker locker(&m_lock);
+	int n;
+
+	if (m_nbuffers) {
+		errno = EBUSY;
+		return -1;
+	}
+	if (!m_streaming)
+		start();
+	if (!due()) {
+		errno = EAGAIN;
+		return -1;
+	}
+	catchUp(1);
+	n = deliver(p, size, NULL);
+	arm();
+	return n;
+}
+
+void *RawReplay::mmap(size_t length, int64_t offset)
+{
+	QMutexLocker locker(&m_lock);
+	unsigned i = m_bufSize ? offset / m_bufSize : 0;
+
+	if (m_memory != V4L2_MEMORY_MMAP || i >= m_nbuffers ||
+	    offset % m_bufSize || length > m_bufSize) {
+		errno = EINVAL;
+		return MAP_FAILED;
+	}
+	return m_buffers[i].mem;
+}
+
+int RawReplay::reqbufs(v4l2_requestbuffers *req)
+{
+	long page = sysconf(_SC_PAGESIZE);
+
+	if (req->type != m_format.type ||
+	    (req->memory != V4L2_MEMORY_MMAP && req->memory != V4L2_MEMORY_USERPTR)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (m_streaming && m_nbuffers) {
+		errno = EBUSY;
+		return -1;
+	}
+	// ends read() mode as well
+	stop();
+	freeBuffers();
+	if (req->count > VIDEO_MAX_FRAME)
+		req->count = VIDEO_MAX_FRAME;
+	m_memory = req->memory;
+	m_bufSize = (m_frameSize + page - 1) / page * page;
+	for (m_nbuffers = 0; m_nbuffers < req->count; m_nbuffers++) {
+		Buffer &b = m_buffers[m_nbuffers];
+
+		b.length = m_frameSize;
+		if (m_memory != V4L2_MEMORY_MMAP)
+			continue;
+		b.mem = (unsigned char *)::mmap(NULL, m_bufSize, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (b.mem == MAP_FAILED) {
+			b.mem = NULL;
+			break;
+		}
+	}
+	req->count = m_nbuffers;
+	if (m_nbuffers == 0)
+		start();
+	return 0;
+}
+
+int RawReplay::querybuf(v4l2_buffer *buf)
+{
+	if (buf->type != m_format.type || buf->index >= m_nbuffers) {
+		errno = EINVAL;
+		return -1;
+	}
+	buf->memory = m_memory;
+	buf->length = m_buffers[buf->index].length;
+	buf->flags = m_buffers[buf->index].queued ? V4L2_BUF_FLAG_QUEUED : 0;
+	if (m_memory == V4L2_MEMORY_MMAP) {
+		buf->m.offset = buf->index * m_bufSize;
+		buf->flags |= V4L2_BUF_FLAG_MAPPED;
+	}
+	return 0;
+}
+
+int RawReplay::qbuf(v4l2_buffer *buf)
+{
+	Buffer *b;
+
+	if (buf->type != m_format.type || buf->memory != m_memory ||
+	    buf->index >= m_nbuffers || m_buffers[buf->index].queued) {
+		errno = EINVAL;
+		return -1;
+	}
+	b = &m_buffers[buf->index];
+	if (m_memory == V4L2_MEMORY_USERPTR) {
+		if (buf->m.userptr == 0) {
+			errno = EINVAL;
+			return -1;
+		}
+		b->user = (unsigned char *)buf->m.userptr;
+		b->length = buf->length;
+	}
+	b->queued = true;
+	m_queue[(m_qhead + m_nqueued++) % VIDEO_MAX_FRAME] = buf->index;
+	buf->flags |= V4L2_BUF_FLAG_QUEUED;
+	if (m_streaming && !m_armed)
+		arm();
+	return 0;
+}
+
+int RawReplay::dqbuf(v4l2_buffer *buf)
+{
+	Buffer *b;
+	unsigned index;
+
+	if (buf->type != m_format.type || buf->memory != m_memory || !m_streaming) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (!due()) {
+		errno = EAGAIN;
+		return -1;
+	}
+	if (m_nqueued == 0) {
+		// Without realtime the timer is armed again by the next QBUF.
+		if (m_realtime) {
+			advance();
+			arm();
+		}
+		errno = EAGAIN;
+		return -1;
+	}
+	catchUp(m_nqueued);
+	index = m_queue[m_qhead];
+	m_qhead = (m_qhead + 1) % VIDEO_MAX_FRAME;
+	m_nqueued--;
+	b = &m_buffers[index];
+	b->queued = false;
+	buf->index = index;
+	buf->length = b->length;
+	if (m_memory == V4L2_MEMORY_MMAP)
+		buf->m.offset = index * m_bufSize;
+	else
+		buf->m.userptr = (unsigned long)b->user;
+	deliver(b->mem ? b->mem : b->user, b->length, buf);
+	if (m_realtime || m_nqueued)
+		arm();
+	return 0;
+}
+
+int RawReplay::ioctl(unsigned cmd, void *arg)
+{
+	QMutexLocker locker(&m_lock);
+	bool video = m_format.type == V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+	switch (cmd) {
+	case VIDIOC_QUERYCAP: {
+		v4l2_capability *cap = (v4l2_capability *)arg;
+		QByteArray name = m_name.section('/', -1).toLocal8Bit();
+
+		memset(cap, 0, sizeof(*cap));
+		strcpy((char *)cap->driver, "qv4l2-replay");
+		strncpy((char *)cap->card, name.data(), sizeof(cap->card) - 1);
+		strcpy((char *)cap->bus_info, "file");
+		cap->device_caps = V4L2_CAP_STREAMING | V4L2_CAP_READWRITE |
+			(video ? V4L2_CAP_VIDEO_CAPTURE : V4L2_CAP_VBI_CAPTURE);
+		cap->capabilities = cap->device_caps | V4L2_CAP_DEVICE_CAPS;
+		return 0;
+	}
+
+	case VIDIOC_G_FMT:
+	case VIDIOC_S_FMT:
+	case VIDIOC_TRY_FMT: {
+		v4l2_format *fmt = (v4l2_format *)arg;
+
+		// only the recorded format can be played back
+		if (fmt->type != m_format.type)
+			break;
+		*fmt = m_format;
+		return 0;
+	}
+
+	case VIDIOC_ENUM_FMT: {
+		v4l2_fmtdesc *desc = (v4l2_fmtdesc *)arg;
+
+		if (!video || desc->type != m_format.type || desc->index)
+			break;
+		memset(desc->description, 0, sizeof(desc->description));
+		strcpy((char *)desc->description, "Recorded");
+		desc->pixelformat = m_format.fmt.pix.pixelformat;
+		desc->flags = 0;
+		return 0;
+	}
+
+	case VIDIOC_ENUM_FRAMESIZES: {
+		v4l2_frmsizeenum *frm = (v4l2_frmsizeenum *)arg;
+
+		if (!video || frm->index || frm->pixel_format != m_format.fmt.pix.pixelformat)
+			break;
+		frm->type = V4L2_FRMSIZE_TYPE_DISCRETE;
+		frm->discrete.width = m_format.fmt.pix.width;
+		frm->discrete.height = m_format.fmt.pix.height;
+		return 0;
+	}
+
+	case VIDIOC_ENUM_FRAMEINTERVALS: {
+		v4l2_frmivalenum *frm = (v4l2_frmivalenum *)arg;
+
+		if (!video || frm->index || frm->pixel_format != m_format.fmt.pix.pixelformat)
+			break;
+		frm->type = V4L2_FRMIVAL_TYPE_DISCRETE;
+		frm->discrete = m_interval;
+		return 0;
+	}
+
+	case VIDIOC_G_PARM:
+	case VIDIOC_S_PARM: {
+		v4l2_streamparm *parm = (v4l2_streamparm *)arg;
+
+		if (!video || parm->type != m_format.type)
+			break;
+		memset(&parm->parm, 0, sizeof(parm->parm));
+		parm->parm.capture.capability = V4L2_CAP_TIMEPERFRAME;
+		parm->parm.capture.timeperframe = m_interval;
+		return 0;
+	}
+
+	case VIDIOC_ENUMINPUT: {
+		v4l2_input *in = (v4l2_input *)arg;
+
+		if (in->index)
+			break;
+		memset(in, 0, sizeof(*in));
+		strcpy((char *)in->name, "Recording");
+		in->type = V4L2_INPUT_TYPE_CAMERA;
+		return 0;
+	}
+
+	case VIDIOC_G_INPUT:
+		*(int *)arg = 0;
+		return 0;
+
+	case VIDIOC_S_INPUT:
+		if (*(int *)arg)
+			break;
+		return 0;
+
+	case VIDIOC_REQBUFS:
+		return reqbufs((v4l2_requestbuffers *)arg);
+
+	case VIDIOC_QUERYBUF:
+		return querybuf((v4l2_buffer *)arg);
+
+	case VIDIOC_QBUF:
+		return qbuf((v4l2_buffer *)arg);
+
+	case VIDIOC_DQBUF:
+		return dqbuf((v4l2_buffer *)arg);
+
+	case VIDIOC_STREAMON:
+		if (*(int *)arg != (int)m_format.type || m_nbuffers == 0)
+			break;
+		if (!m_streaming)
+			start();
+		return 0;
+
+	case VIDIOC_STREAMOFF:
+		if (*(int *)arg != (int)m_format.type)
+			break;
+		stop();
+		return 0;
+
+	default:
+		errno = ENOTTY;
+		return -1;
+	}
+	errno = EINVAL;
+	return -1;
+}
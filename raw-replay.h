@@ -0,0 +1,100 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef RAW_REPLAY_H
+#define RAW_REPLAY_H
+
+#include <QString>
+#include <QMutex>
+#include <linux/videodev2.h>
+
+#include "raw-container.h"
+
+// Plays a raw recording back as if it came from a capture device. The
+// v4l2 class passes its ioctl(), read() and mmap() calls here instead of
+// to a driver. The file descriptor it polls is a timerfd that becomes
+// readable when the next frame is due, either at the recorded pace or,
+// without realtime, as soon as a buffer is queued. The recording loops.
+//
+// In realtime mode frames are skipped when no buffer is queued in time,
+// as a driver would, and the sequence numbers show the gap. read() works
+// from the moment the recording is opened.
+class RawReplay
+{
+public:
+	RawReplay();
+	~RawReplay();
+
+	// Returns the descriptor to poll or -1.
+	int open(const QString &fileName, bool realtime);
+	void close();
+
+	// Same conventions as the system calls: -1 and errno on failure.
+	int ioctl(unsigned cmd, void *arg);
+	int read(unsigned char *p, int size);
+	void *mmap(size_t length, int64_t offset);
+
+	static bool isRecording(const QString &fileName);
+
+private:
+	struct Buffer {
+		unsigned char *mem;	// MMAP buffers only
+		unsigned char *user;	// USERPTR buffers only
+		unsigned length;
+		bool queued;
+	};
+
+	int reqbufs(v4l2_requestbuffers *req);
+	int querybuf(v4l2_buffer *buf);
+	int qbuf(v4l2_buffer *buf);
+	int dqbuf(v4l2_buffer *buf);
+	void freeBuffers();
+	bool due();
+	void arm();
+	void start();
+	void stop();
+	void catchUp(unsigned keep);
+	void advance();
+	unsigned deliver(unsigned char *p, unsigned size, v4l2_buffer *buf);
+
+	RawReader m_reader;
+	QString m_name;
+	bool m_realtime;
+	int m_fd;
+	v4l2_format m_format;
+	unsigned m_frameSize;
+	v4l2_fract m_interval;
+	__u64 m_first, m_length;	// timestamps of the recording, nsec
+	__u32 m_firstSeq, m_seqLength;
+
+	QMutex m_lock;
+	__u32 m_memory;
+	Buffer m_buffers[VIDEO_MAX_FRAME];
+	unsigned m_nbuffers;
+	unsigned m_bufSize;		// MMAP buffers, page aligned
+	unsigned m_queue[VIDEO_MAX_FRAME];
+	unsigned m_qhead, m_nqueued;
+	bool m_streaming;
+	bool m_armed;
+	unsigned m_next;		// next frame of the recording
+	__u64 m_base;			// monotonic time that m_first maps to
+	__u32 m_seqBase;
+};
+
+#endif
@@ -0,0 +1,99 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "raw-writer.h"
+
+// Fills the chunk pool of a RawWriter while the disk never catches up:
+// the file is a pipe that nobody reads, so the first chunk handed to the
+// writer thread is never given back. Frames that end exactly on a chunk
+// boundary are the case that used to take a chunk from an empty pool.
+static int fill(const char *fifo, unsigned frameSize)
+{
+	unsigned char *frame = (unsigned char *)malloc(frameSize);
+	unsigned pool = RAW_CHUNKS * RAW_CHUNK_SIZE;
+	unsigned accepted = 0;
+	unsigned frames = 2 * pool / frameSize;
+	RawWriter w;
+	int fd;
+	int ret = 0;
+
+	memset(frame, 0x80, frameSize);
+	// the read end first, or opening the write end would block
+	fd = open(fifo, O_RDONLY | O_NONBLOCK);
+	if (fd < 0 || !w.open(fifo, false)) {
+		perror(fifo);
+		free(frame);
+		return 1;
+	}
+	for (unsigned i = 0; i < frames; i++)
+		if (w.write(frame, frameSize))
+			accepted++;
+	// one chunk is with the writer thread, the current one must keep
+	// a byte free
+	if ((unsigned long long)accepted * frameSize >= pool) {
+		fprintf(stderr, "%u byte frames: %u accepted, more than the pool holds\n",
+				frameSize, accepted);
+		ret = 1;
+	}
+	if (accepted + w.dropped() != frames) {
+		fprintf(stderr, "%u byte frames: %u accepted and %u dropped of %u\n",
+				frameSize, accepted, w.dropped(), frames);
+		ret = 1;
+	}
+	// lets the writer thread fail and finish
+	::close(fd);
+	w.close();
+	free(frame);
+	return ret;
+}
+
+int main(int, char **)
+{
+	char dir[] = "/tmp/raw-writer-test.XXXXXX";
+	char fifo[sizeof(dir) + 8];
+	int ret = 0;
+
+	signal(SIGPIPE, SIG_IGN);
+	if (mkdtemp(dir) == NULL) {
+		perror(dir);
+		return 1;
+	}
+	snprintf(fifo, sizeof(fifo), "%s/fifo", dir);
+	if (mkfifo(fifo, 0600) < 0) {
+		perror(fifo);
+		rmdir(dir);
+		return 1;
+	}
+	// a quarter of a chunk, then 720x576 YUYV, which only meets a
+	// chunk boundary every 2048 frames, then a frame larger than a chunk
+	ret |= fill(fifo, RAW_CHUNK_SIZE / 4);
+	ret |= fill(fifo, 720 * 576 * 2);
+	ret |= fill(fifo, 2 * RAW_CHUNK_SIZE);
+	unlink(fifo);
+	rmdir(dir);
+	return ret;
+}
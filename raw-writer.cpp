@@ -0,0 +1,290 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "raw-writer.h"
+
+// alignment O_DIRECT needs for buffers, sizes and file offsets
+#define RAW_ALIGN 4096
+// disk space is reserved ahead of the data in steps of this size
+#define RAW_PREALLOC (256ULL << 20)
+
+RawWriter::RawWriter(QObject *parent) :
+	QThread(parent),
+	m_fd(-1),
+	m_direct(false),
+	m_stop(false),
+	m_failed(false),
+	m_blocking(false),
+	m_current(NULL),
+	m_nfree(0),
+	m_fullHead(0),
+	m_nfull(0),
+	m_queued(0),
+	m_written(0),
+	m_allocated(0),
+	m_dropped(0)
+{
+	memset(m_chunks, 0, sizeof(m_chunks));
+}
+
+RawWriter::~RawWriter()
+{
+	close();
+}
+
+bool RawWriter::open(const QString &fileName, bool direct)
+{
+	int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	QByteArray name = fileName.toLocal8Bit();
+
+	close();
+	// not every file system can do O_DIRECT, tmpfs for one
+	if (direct)
+		m_fd = ::open(name.data(), flags | O_DIRECT, 0666);
+	m_direct = m_fd >= 0;
+	if (m_fd < 0)
+		m_fd = ::open(name.data(), flags, 0666);
+	if (m_fd < 0)
+		return false;
+
+	m_nfree = 0;
+	for (unsigned i = 0; i < RAW_CHUNKS; i++) {
+		if (posix_memalign((void **)&m_chunks[i].data, RAW_ALIGN, RAW_CHUNK_SIZE)) {
+			m_chunks[i].data = NULL;
+			close();
+			return false;
+		}
+		m_chunks[i].used = 0;
+		m_free[m_nfree++] = &m_chunks[i];
+	}
+	m_current = m_free[--m_nfree];
+	m_fullHead = m_nfull = 0;
+	m_queued = 0;
+	m_written = 0;
+	m_allocated = 0;
+	m_dropped = 0;
+	m_failed = false;
+	m_stop = false;
+	preallocate(0);
+	start();
+	return true;
+}
+
+void RawWriter::close()
+{
+	if (m_fd < 0)
+		return;
+	if (isRunning()) {
+		m_lock.lock();
+		m_stop = true;
+		m_work.wakeOne();
+		m_lock.unlock();
+		wait();
+	}
+	// The partly filled chunk is written last. Its size is not aligned,
+	// so O_DIRECT has to go first.
+	if (m_current && m_current->used && !m_failed) {
+		if (m_direct)
+			fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_DIRECT);
+		if (writeChunk(m_current))
+			m_written += m_current->used;
+	}
+	// give back what was reserved beyond the end of the data
+	if (m_allocated != ~0ULL && ftruncate(m_fd, m_written) < 0)
+		perror("ftruncate");
+	::close(m_fd);
+	m_fd = -1;
+	m_current = NULL;
+	for (unsigned i = 0; i < RAW_CHUNKS; i++) {
+		free(m_chunks[i].data);
+		m_chunks[i].data = NULL;
+	}
+}
+
+bool RawWriter::write(const void *data, unsigned size)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void *)data;
+	iov.iov_len = size;
+	return writev(&iov, 1);
+}
+
+bool RawWriter::writev(const struct iovec *iov, unsigned count)
+{
+	unsigned size = 0;
+	unsigned room;
+
+	if (m_fd < 0)
+		return false;
+	for (unsigned i = 0; i < count; i++)
+		size += iov[i].iov_len;
+	m_lock.lock();
+	// A chunk that is filled up is replaced at once, so a frame ending
+	// exactly on the last free byte would still need another chunk: the
+	// frame has to be smaller than the room.
+	room = RAW_CHUNK_SIZE - m_current->used + m_nfree * RAW_CHUNK_SIZE;
+	while (m_blocking && !m_failed && size >= room &&
+	       size <= (RAW_CHUNKS - 1) * RAW_CHUNK_SIZE) {
+		m_room.wait(&m_lock);
+		room = RAW_CHUNK_SIZE - m_current->used + m_nfree * RAW_CHUNK_SIZE;
+	}
+	if (m_failed || size >= room) {
+		m_dropped++;
+		m_lock.unlock();
+		return false;
+	}
+	m_lock.unlock();
+
+	// Only the writer thread adds free chunks, so the room counted above
+	// cannot shrink. The current chunk belongs to this thread alone.
+	for (unsigned i = 0; i < count; i++) {
+		const unsigned char *p = (const unsigned char *)iov[i].iov_base;
+
+		size = iov[i].iov_len;
+		while (size) {
+			unsigned n = RAW_CHUNK_SIZE - m_current->used;
+
+			if (n > size)
+				n = size;
+			memcpy(m_current->data + m_current->used, p, n);
+			m_current->used += n;
+			p += n;
+			size -= n;
+			if (m_current->used < RAW_CHUNK_SIZE)
+				break;
+
+			QMutexLocker locker(&m_lock);
+
+			m_full[(m_fullHead + m_nfull++) % RAW_CHUNKS] = m_current;
+			m_queued += m_current->used;
+			m_current = m_free[--m_nfree];
+			m_work.wakeOne();
+		}
+	}
+	return true;
+}
+
+unsigned RawWriter::backlog() const
+{
+	QMutexLocker locker(&m_lock);
+
+	return m_fd < 0 ? 0 : m_queued + m_current->used;
+}
+
+unsigned long long RawWriter::written() const
+{
+	QMutexLocker locker(&m_lock);
+
+	return m_written;
+}
+
+unsigned RawWriter::dropped() const
+{
+	QMutexLocker locker(&m_lock);
+
+	return m_dropped;
+}
+
+// Reserve disk space well ahead of the data so the file system does not
+// have to find blocks in the middle of a recording. The file size is
+// kept, so readers only ever see what was actually written.
+void RawWriter::preallocate(unsigned long long end)
+{
+	if (end + RAW_CHUNK_SIZE <= m_allocated)
+		return;
+	if (fallocate(m_fd, FALLOC_FL_KEEP_SIZE, m_allocated, RAW_PREALLOC) < 0) {
+		// not supported here, do not try again
+		m_allocated = ~0ULL;
+		return;
+	}
+	m_allocated += RAW_PREALLOC;
+}
+
+bool RawWriter::writeChunk(Chunk *chunk)
+{
+	const unsigned char *p = chunk->data;
+	unsigned len = chunk->used;
+
+	while (len) {
+		ssize_t s = ::write(m_fd, p, len);
+
+		if (s < 0 && errno == EINTR)
+			continue;
+		if (s <= 0)
+			return false;
+		p += s;
+		len -= s;
+	}
+	return true;
+}
+
+void RawWriter::run()
+{
+	for (;;) {
+		Chunk *chunk;
+		int err = 0;
+		bool ok;
+
+		m_lock.lock();
+		while (m_nfull == 0 && !m_stop)
+			m_work.wait(&m_lock);
+		if (m_nfull == 0) {
+			m_lock.unlock();
+			break;
+		}
+		chunk = m_full[m_fullHead];
+		ok = !m_failed;
+		m_lock.unlock();
+
+		if (ok) {
+			preallocate(m_written + chunk->used);
+			ok = writeChunk(chunk);
+			if (!ok)
+				err = errno;
+		}
+
+		m_lock.lock();
+		m_fullHead = (m_fullHead + 1) % RAW_CHUNKS;
+		m_nfull--;
+		m_queued -= chunk->used;
+		if (ok)
+			m_written += chunk->used;
+		chunk->used = 0;
+		m_free[m_nfree++] = chunk;
+		m_room.wakeAll();
+		// report only the first failure, later chunks are discarded
+		if (!ok && !m_failed) {
+			m_failed = true;
+			m_lock.unlock();
+			emit writeError(QString("Cannot write raw frames: %1").arg(strerror(err)));
+			continue;
+		}
+		m_lock.unlock();
+	}
+}
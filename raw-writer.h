@@ -0,0 +1,100 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef RAW_WRITER_H
+#define RAW_WRITER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QString>
+#include <sys/uio.h>
+
+#define RAW_CHUNKS 16
+#define RAW_CHUNK_SIZE (4 << 20)
+
+// Writes a byte stream to disk from its own thread, so a slow disk never
+// stalls the capture loop. write() copies into a pool of page aligned
+// chunks and the thread writes each chunk once it is full, one large
+// write at a time. If all chunks are waiting for the disk a frame is
+// dropped as a whole rather than blocking the caller.
+class RawWriter : public QThread
+{
+	Q_OBJECT
+
+public:
+	RawWriter(QObject *parent = 0);
+	virtual ~RawWriter();
+
+	// With direct set the file is opened with O_DIRECT, if the file
+	// system supports it, to keep the recording out of the page cache.
+	bool open(const QString &fileName, bool direct);
+	// Writes whatever is still queued and closes the file.
+	void close();
+	bool isOpen() const { return m_fd >= 0; }
+
+	// Wait for the disk instead of dropping frames, for offline writing.
+	void setBlocking(bool blocking) { m_blocking = blocking; }
+
+	// Only call from one thread. Returns false if the frame was dropped.
+	bool write(const void *data, unsigned size);
+	// All parts are queued or none are.
+	bool writev(const struct iovec *iov, unsigned count);
+
+	// Bytes accepted but not yet on disk.
+	unsigned backlog() const;
+	unsigned long long written() const;
+	unsigned dropped() const;
+
+signals:
+	void writeError(const QString &text);
+
+protected:
+	virtual void run();
+
+private:
+	struct Chunk {
+		unsigned char *data;
+		unsigned used;
+	};
+
+	bool writeChunk(Chunk *chunk);
+	void preallocate(unsigned long long end);
+
+	int m_fd;
+	bool m_direct;
+	bool m_stop;
+	bool m_failed;
+	bool m_blocking;
+	Chunk m_chunks[RAW_CHUNKS];
+	Chunk *m_current;		// being filled by write()
+	Chunk *m_free[RAW_CHUNKS];
+	unsigned m_nfree;
+	Chunk *m_full[RAW_CHUNKS];	// waiting for the disk, oldest first
+	unsigned m_fullHead, m_nfull;
+	unsigned m_queued;		// bytes in m_full
+	unsigned long long m_written;
+	unsigned long long m_allocated;
+	unsigned m_dropped;
+	mutable QMutex m_lock;
+	QWaitCondition m_work;
+	QWaitCondition m_room;		// a chunk was written
+};
+
+#endif
@@ -9,6 +9,12 @@
 
 #include "raw2sliced.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#define VBI_SSE2
+#include <emmintrin.h>
+#define SSE2 __attribute__((target("sse2")))
+#endif
+
 /*
  * The slicing code was copied from libzvbi. The original copyright notice is:
  *
@@ -254,6 +260,233 @@ static bool low_pass_bit_slicer_Y8(struct vbi_bit_slicer *bs, uint8_t *buffer, c
 	return true;
 }
 
+#ifdef VBI_SSE2
+
+/*
+ * The same slicer with the CRI search and the payload sampling done 8
+ * samples at a time. The results, including the threshold carried over
+ * to the next line, are identical to low_pass_bit_slicer_Y8().
+ *
+ * The CRI search works on chunks of CRI_CHUNK samples in three passes:
+ * the adaptive threshold, which depends on the previous sample and so
+ * stays scalar, then the 0/1 decisions of all 4x oversampled points,
+ * then the CRI clock. The clock only needs attention at the 0/1
+ * transitions, between them it emits a known number of equal bits.
+ */
+
+#define CRI_CHUNK 64
+
+// bit k of m to bit 4k
+static inline uint32_t spread4(uint32_t m)
+{
+	m = (m | (m << 12)) & 0x000F000F;
+	m = (m | (m << 6)) & 0x03030303;
+	return (m | (m << 3)) & 0x11111111;
+}
+
+static inline uint8_t reverse8(uint8_t b)
+{
+	b = (b >> 4) | (b << 4);
+	b = ((b & 0xCC) >> 2) | ((b & 0x33) << 2);
+	return ((b & 0xAA) >> 1) | ((b & 0x55) << 1);
+}
+
+// Decisions of the 4 oversampled points of 8 samples, point j of sample
+// k in bit 4k + j.
+static inline SSE2 uint32_t cri_bits_sse2(const uint8_t *raw, const int16_t *tr)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i r0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)raw), zero);
+	__m128i r1 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(raw + 1)), zero);
+	__m128i d = _mm_sub_epi16(r1, r0);
+	__m128i t = _mm_add_epi16(_mm_slli_epi16(r0, 2), _mm_set1_epi16(2));
+	__m128i thr = _mm_loadu_si128((const __m128i *)tr);
+	uint32_t bits = 0;
+
+	for (unsigned j = 0; j < 4; j++) {
+		__m128i lt = _mm_cmpgt_epi16(thr, _mm_srli_epi16(t, 2));
+		unsigned m = ~_mm_movemask_epi8(_mm_packs_epi16(lt, lt)) & 0xff;
+
+		bits |= spread4(m) << j;
+		t = _mm_add_epi16(t, d);
+	}
+	return bits;
+}
+
+// The same for the last n < 8 samples of a chunk.
+static inline uint32_t cri_bits(const uint8_t *raw, const int16_t *tr, unsigned n)
+{
+	uint32_t bits = 0;
+
+	for (unsigned k = 0; k < n; k++) {
+		int d = raw[k + 1] - raw[k];
+		int t = raw[k] * 4;
+
+		for (unsigned j = 0; j < 4; j++, t += d)
+			if ((t + 2) / 4 >= tr[k])
+				bits |= 1U << (4 * k + j);
+	}
+	return bits;
+}
+
+// 8 payload bits, the first in bit 0. tr is the threshold << 8, at most
+// one more than the largest sample value.
+static inline SSE2 uint8_t payload_bits_sse2(const uint8_t *raw, unsigned i,
+		unsigned step, int tr)
+{
+	int16_t diff[16] __attribute__((aligned(16)));
+	int16_t frac[16] __attribute__((aligned(16)));
+	__m128i thr = _mm_set1_epi32(tr);
+	__m128i lo, hi;
+
+	for (unsigned q = 0; q < 8; q++, i += step) {
+		unsigned ii = i >> 8;
+
+		diff[2 * q] = raw[ii + 1] - raw[ii];
+		diff[2 * q + 1] = raw[ii];
+		frac[2 * q] = i & 255;
+		frac[2 * q + 1] = 256;
+	}
+	// (raw1 - raw0) * frac + raw0 * 256, as in vbi_sample()
+	lo = _mm_madd_epi16(_mm_load_si128((const __m128i *)diff),
+			_mm_load_si128((const __m128i *)frac));
+	hi = _mm_madd_epi16(_mm_load_si128((const __m128i *)(diff + 8)),
+			_mm_load_si128((const __m128i *)(frac + 8)));
+	lo = _mm_packs_epi32(_mm_cmpgt_epi32(thr, lo), _mm_cmpgt_epi32(thr, hi));
+	return ~_mm_movemask_epi8(_mm_packs_epi16(lo, lo));
+}
+
+static SSE2 bool low_pass_bit_slicer_Y8_sse2(struct vbi_bit_slicer *bs, uint8_t *buffer, const uint8_t *raw)
+{
+	uint32_t thresh[CRI_CHUNK + 1];
+	int16_t tr16[CRI_CHUNK];
+	unsigned int thresh0 = bs->thresh;
+	unsigned int th = bs->thresh;
+	unsigned int left = bs->cri_samples;
+	unsigned int osr = bs->oversampling_rate;
+	unsigned int rate = bs->cri_rate;
+	unsigned int cl = 0;	/* clock */
+	unsigned int c = 0;	/* current byte */
+	unsigned int b1 = 0;	/* previous bit */
+	unsigned int tr = 0;
+	unsigned int i, j, k;
+	unsigned int nbytes, tail, bits;
+	int hit = -1;		/* sample of the chunk with the CRI */
+
+	while (left && hit < 0) {
+		unsigned int n = left < CRI_CHUNK ? left : CRI_CHUNK;
+
+		for (k = 0; k < n; k++) {
+			int r = raw[k + 1] - raw[k];
+
+			tr = th >> bs->thresh_frac;
+			thresh[k] = th;
+			th += (int)(raw[k] - tr) * (r < 0 ? -r : r);
+			/* the samples never exceed 255 */
+			tr16[k] = tr > 256 ? 256 : tr;
+		}
+		thresh[n] = th;
+
+		for (k = 0; k < n && hit < 0; k += 8) {
+			unsigned int nbits = n - k >= 8 ? 32 : 4 * (n - k);
+			uint32_t w = nbits == 32 ? cri_bits_sse2(raw + k, tr16 + k) :
+				cri_bits(raw + k, tr16 + k, n - k);
+			uint32_t edges = w ^ ((w << 1) | b1);
+			unsigned int pos = 0;
+
+			if (nbits < 32)
+				edges &= (1U << nbits) - 1;
+			while (pos < nbits) {
+				uint32_t e = edges >> pos;
+				unsigned int next = e ? pos + __builtin_ctz(e) : nbits;
+				uint64_t acc = cl + (uint64_t)(next - pos) * rate;
+				unsigned int bits_out = acc / osr;
+				unsigned int m;
+
+				/* equal bits up to the next transition */
+				for (m = 1; m <= bits_out; m++) {
+					c = c * 2 + b1;
+					if ((c & bs->cri_mask) == bs->cri)
+						break;
+				}
+				if (m <= bits_out) {
+					/* the point where bit m was taken */
+					unsigned int s = ((uint64_t)m * osr - cl + rate - 1) / rate;
+
+					hit = k + (pos + s - 1) / 4;
+					break;
+				}
+				cl = acc - (uint64_t)bits_out * osr;
+				if (next == nbits)
+					break;
+				cl = osr >> 1;
+				b1 ^= 1;
+				pos = next + 1;
+			}
+			if (nbits == 32)
+				b1 = w >> 31;
+			else
+				b1 = (w >> (nbits - 1)) & 1;
+		}
+		if (hit < 0) {
+			raw += n;
+			left -= n;
+		}
+	}
+	if (hit < 0) {
+		bs->thresh = thresh0;
+		return false;
+	}
+	raw += hit;
+	tr = thresh[hit] >> bs->thresh_frac;
+	bs->thresh = thresh[hit + 1];
+
+	i = bs->phase_shift; /* current bit position << 8 */
+	tr *= 256;
+	c = 0;
+
+	for (j = bs->frc_bits; j > 0; --j) {
+		c = c * 2 + (vbi_sample(raw, i) >= tr);
+		i += bs->step; /* next bit */
+	}
+
+	if (c != bs->frc) {
+		bs->thresh = thresh0;
+		return false;
+	}
+
+	nbytes = bs->payload / 8;
+	tail = bs->payload & 7;
+	for (j = 0; j < nbytes; j++) {
+		uint8_t b = payload_bits_sse2(raw, i, bs->step, tr > 0xff00 ? 0xff01 : tr);
+
+		buffer[j] = bs->endian ? b : reverse8(b);
+		i += 8 * bs->step;
+	}
+	bits = 0;
+	for (j = 0; j < tail; j++) {
+		bits |= (vbi_sample(raw, i) >= tr) << j;
+		i += bs->step;
+	}
+	if (bs->endian)
+		buffer[nbytes] = tail ? bits : (nbytes ? buffer[nbytes - 1] : 0);
+	else
+		buffer[nbytes] = tail ? reverse8(bits) >> (8 - tail) : 0;
+	return true;
+}
+
+#endif
+
+static bool vbi_slice(const struct vbi_handle *vh, struct vbi_bit_slicer *bs,
+		uint8_t *buffer, const uint8_t *raw)
+{
+#ifdef VBI_SSE2
+	if (vh->simd)
+		return low_pass_bit_slicer_Y8_sse2(bs, buffer, raw);
+#endif
+	return low_pass_bit_slicer_Y8(bs, buffer, raw);
+}
+
 // Prepare the vbi_bit_slicer struct
 static bool vbi_bit_slicer_prepare(struct vbi_bit_slicer *bs,
 		const struct service *s,
@@ -350,7 +583,8 @@ static bool vbi_bit_slicer_prepare(struct vbi_bit_slicer *bs,
 
 bool vbi_prepare(struct vbi_handle *vh, const struct v4l2_vbi_format *fmt, v4l2_std_id std)
 {
-	unsigned i;
+	unsigned lines = fmt->count[0] + fmt->count[1];
+	unsigned i, y;
 
 	memset(vh, 0, sizeof(*vh));
 	// Sanity check
@@ -363,6 +597,10 @@ bool vbi_prepare(struct vbi_handle *vh, const struct v4l2_vbi_format *fmt, v4l2_
 	vh->start[1] = fmt->start[1];
 	vh->count[0] = fmt->count[0];
 	vh->count[1] = fmt->count[1];
+#ifdef VBI_SSE2
+	__builtin_cpu_init();
+	vh->simd = __builtin_cpu_supports("sse2");
+#endif
 	for (i = 0; i < sizeof(services) / sizeof(services[0]); i++) {
 		const struct service *s = services + i;
 		struct vbi_bit_slicer *slicer = vh->slicers + vh->services;
@@ -379,56 +617,113 @@ bool vbi_prepare(struct vbi_handle *vh, const struct v4l2_vbi_format *fmt, v4l2_
 		vbi_bit_slicer_prepare(slicer, s, fmt);
 		vh->services++;
 	}
+	for (y = 0; y < VBI_MAX_LINES && y < lines; y++)
+		for (i = 0; i < vh->services; i++)
+			if (vbi_covers(vh, i, y))
+				vh->map[y] |= 1 << i;
 	return vh->services;
 }
 
-void vbi_parse(struct vbi_handle *vh, const unsigned char *buf,
-		struct v4l2_sliced_vbi_format *vbi,
+bool vbi_covers(const struct vbi_handle *vh, unsigned i, unsigned y)
+{
+	const struct service *s = services + vh->slicers[i].service;
+	int line;
+
+	if ((int)y < vh->count[0]) {
+		line = y + vh->start[0];
+		return line >= s->first[0] && line <= s->last[0];
+	}
+	line = y - vh->count[0] + vh->start[1];
+	return line >= s->first[1] && line <= s->last[1];
+}
+
+bool vbi_parse_line(const struct vbi_handle *vh, unsigned i,
+		struct vbi_bit_slicer *bs, const unsigned char *buf, unsigned y,
 		struct v4l2_sliced_vbi_data *data)
 {
+	const struct service *s = services + vh->slicers[i].service;
 	const unsigned char *p;
+	int field = (int)y >= vh->count[0];
+	int yf = y - field * vh->count[0];	/* line of the field */
+
+	if (vh->interlaced)
+		p = buf + vh->stride * yf * 2 + field;
+	else
+		p = buf + vh->stride * y;
+	data->id = data->reserved = 0;
+	if (!vbi_slice(vh, bs, data->data, p))
+		return false;
+	data->id = s->service;
+	data->field = field;
+	data->line = yf + vh->start[field];
+	if (field)
+		data->line -= vh->start_of_field_2;
+	return true;
+}
+
+unsigned vbi_line_slicers(const struct vbi_handle *vh, unsigned y)
+{
+	unsigned mask = 0;
 	unsigned i;
-	int y;
 
-	memset(vbi, 0, sizeof(*vbi));
-	vbi->io_size = sizeof(*data) * (vh->count[0] + vh->count[1]);
-	for (i = 0; i < vh->services; i++) {
-		const struct service *s = services + vh->slicers[i].service;
+	if (y < VBI_MAX_LINES) {
+		mask = vh->map[y];
+		/* the other lines take turns to be probed again */
+		if (vh->learn && (vh->frame + y) % vh->learn)
+			mask &= vh->seen[y];
+		return mask;
+	}
+	for (i = 0; i < vh->services; i++)
+		if (vbi_covers(vh, i, y))
+			mask |= 1 << i;
+	return mask;
+}
 
-		for (y = s->first[0] - vh->start[0]; y <= s->last[0] - vh->start[0]; y++) {
-			if (y < 0 || y >= vh->count[0])
-				continue;
-			if (vh->interlaced)
-				p = buf + vh->stride * y * 2;
-			else
-				p = buf + vh->stride * y;
-			data[y].id = data[y].reserved = 0;
-			if (low_pass_bit_slicer_Y8(vh->slicers + i, data[y].data, p)) {
-				vbi->service_set |= s->service;
-				vbi->service_lines[0][y + vh->start[0]] = s->service;
-				data[y].id = s->service;
-				data[y].field = 0;
-				data[y].line = y + vh->start[0];
-			}
-		}
+void vbi_learn(struct vbi_handle *vh, unsigned i, unsigned y, bool found)
+{
+	if (!vh->learn || y >= VBI_MAX_LINES)
+		return;
+	if (found) {
+		vh->seen[y] |= 1 << i;
+		vh->misses[y][i] = 0;
+	} else if ((vh->seen[y] & (1 << i)) && ++vh->misses[y][i] >= VBI_FORGET) {
+		/* gone, back to an occasional probe */
+		vh->seen[y] &= ~(1 << i);
+		vh->misses[y][i] = 0;
+	}
+}
 
-		for (y = s->first[1] - vh->start[1]; y <= s->last[1] - vh->start[1]; y++) {
-			unsigned yy = y + vh->count[0];
+void vbi_parse(struct vbi_handle *vh, const unsigned char *buf,
+		struct v4l2_sliced_vbi_format *vbi,
+		struct v4l2_sliced_vbi_data *data)
+{
+	unsigned lines = vh->count[0] + vh->count[1];
+	unsigned i, y;
+
+	memset(vbi, 0, sizeof(*vbi));
+	vbi->io_size = sizeof(*data) * lines;
+	/* lines that are not sliced in this frame come out empty */
+	memset(data, 0, sizeof(*data) * lines);
+	/*
+	 * Field 1 before field 2, the threshold of a service carries over
+	 * from line to line. A line sliced for several services keeps the
+	 * last attempt.
+	 */
+	for (y = 0; y < lines; y++) {
+		unsigned mask = vbi_line_slicers(vh, y);
+
+		for (i = 0; mask; i++, mask >>= 1) {
+			bool found;
 
-			if (y < 0 || y >= vh->count[1])
+			if (!(mask & 1))
 				continue;
-			if (vh->interlaced)
-				p = buf + vh->stride * y * 2 + 1;
-			else
-				p = buf + vh->stride * yy;
-			data[yy].id = data[yy].reserved = 0;
-			if (low_pass_bit_slicer_Y8(vh->slicers + i, data[yy].data, p)) {
-				vbi->service_set |= s->service;
-				vbi->service_lines[1][y + vh->start[1] - vh->start_of_field_2] = s->service;
-				data[yy].id = s->service;
-				data[yy].field = 1;
-				data[yy].line = y + vh->start[1] - vh->start_of_field_2;
-			}
+			found = vbi_parse_line(vh, i, vh->slicers + i, buf, y, data + y);
+			vbi_learn(vh, i, y, found);
+			if (!found)
+				continue;
+			vbi->service_set |= data[y].id;
+			vbi->service_lines[data[y].field][data[y].line] = data[y].id;
 		}
 	}
+	vh->frame++;
 }
@@ -31,6 +31,11 @@
 #include <linux/videodev2.h>
 
 #define VBI_MAX_SERVICES (3)
+// Lines of a frame with a precomputed list of services to slice, any
+// further lines are worked out for every frame.
+#define VBI_MAX_LINES (64)
+// Frames a learned service may be missing before its line is only probed
+#define VBI_FORGET (50)
 
 // Bit slicer internal struct
 struct vbi_bit_slicer {
@@ -55,20 +60,50 @@ struct vbi_handle {
 	unsigned start_of_field_2;
 	unsigned stride;
 	bool interlaced;
+	bool simd;		// use the vectorized slicer, set by vbi_prepare
 	int start[2];
 	int count[2];
 	struct vbi_bit_slicer slicers[VBI_MAX_SERVICES];
+	// bit i set if slicer i covers the line
+	unsigned char map[VBI_MAX_LINES];
+	// Learning mode: if non-zero, a line is only sliced for the services
+	// seen on it, and for the others once every learn frames.
+	unsigned learn;
+	unsigned frame;
+	unsigned char seen[VBI_MAX_LINES];
+	unsigned char misses[VBI_MAX_LINES][VBI_MAX_SERVICES];
 };
 
 // Fills in vbi_handle based on the standard and VBI format
 // Returns true if one or more services are valid for the fmt/std combination.
+// Learning mode is off, set vh->learn afterwards to turn it on.
 bool vbi_prepare(struct vbi_handle *vh,
 		const struct v4l2_vbi_format *fmt, v4l2_std_id std);
 
 // Parses the raw buffer and fills in sliced_vbi_format and _data.
-// data must be an array of count[0] + count[1] v4l2_sliced_vbi_data structs.
+// data must be an array of count[0] + count[1] v4l2_sliced_vbi_data structs,
+// the lines not sliced in this frame are cleared.
 void vbi_parse(struct vbi_handle *vh, const unsigned char *buf,
 		struct v4l2_sliced_vbi_format *vbi,
 		struct v4l2_sliced_vbi_data *data);
 
+// The slicers to try on line y of the frame in this frame, as a bit mask.
+unsigned vbi_line_slicers(const struct vbi_handle *vh, unsigned y);
+
+// Tells learning mode whether slicer i found its service on line y.
+void vbi_learn(struct vbi_handle *vh, unsigned i, unsigned y, bool found);
+
+// Whether line y of the frame, 0 to count[0] + count[1] - 1, is one that
+// slicer i of vh looks at.
+bool vbi_covers(const struct vbi_handle *vh, unsigned i, unsigned y);
+
+// Slices line y of the frame for slicer i of vh, but with the slicer
+// state in bs, so that lines can be sliced in parallel. vbi_parse() does
+// the lines of vbi_line_slicers() in order with the state in vh, then
+// counts the frame. Returns true and fills in data if the service was
+// found, else data->id is set to 0.
+bool vbi_parse_line(const struct vbi_handle *vh, unsigned i,
+		struct vbi_bit_slicer *bs, const unsigned char *buf, unsigned y,
+		struct v4l2_sliced_vbi_data *data);
+
 #endif
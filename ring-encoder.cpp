@@ -0,0 +1,220 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <string.h>
+#include <QString>
+
+#include "ring-encoder.h"
+#include "gst-tap.h"
+
+RingEncoder::RingEncoder(RingRecorder *ring) :
+	m_ring(ring),
+	m_src(NULL),
+	m_pad(NULL),
+	m_probe(0),
+	m_first(0),
+	m_queued(0)
+{
+	memset(&m_in, 0, sizeof(m_in));
+	memset(&m_out, 0, sizeof(m_out));
+}
+
+GstElement *RingEncoder::create(const v4l2_format &fmt, int quality)
+{
+	GstElement *pipeline;
+	GstElement *sink;
+	GstCaps *caps;
+	const char *format = NULL;
+	QString desc;
+
+	release();
+	m_in = m_out = fmt.fmt.pix;
+	if (m_in.pixelformat == V4L2_PIX_FMT_MJPEG || m_in.pixelformat == V4L2_PIX_FMT_JPEG) {
+		// passed on as they are
+		m_out.sizeimage = 0;
+		caps = gst_caps_new_simple("image/jpeg",
+				"width", G_TYPE_INT, m_in.width,
+				"height", G_TYPE_INT, m_in.height, NULL);
+		desc = "appsrc name=src ! fakesink name=sink sync=false";
+	} else {
+		format = gstVideoFormat(m_out);
+		if (format == NULL)
+			return NULL;
+		if (m_in.bytesperline == 0)
+			m_in.bytesperline = m_out.bytesperline;
+		// the rows of packed formats can be moved into place, planes cannot
+		if (m_in.bytesperline != m_out.bytesperline &&
+		    m_out.sizeimage != m_out.bytesperline * m_out.height)
+			return NULL;
+		caps = gst_caps_new_simple("video/x-raw",
+				"format", G_TYPE_STRING, format,
+				"width", G_TYPE_INT, m_in.width,
+				"height", G_TYPE_INT, m_in.height,
+				"framerate", GST_TYPE_FRACTION, 0, 1, NULL);
+		desc = QString("appsrc name=src ! videoconvert ! jpegenc quality=%1 ! "
+			       "fakesink name=sink sync=false").arg(quality);
+	}
+
+	pipeline = gst_parse_launch(desc.toAscii().data(), NULL);
+	if (pipeline == NULL) {
+		gst_caps_unref(caps);
+		return NULL;
+	}
+	m_src = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+	sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+	if (m_src == NULL || sink == NULL) {
+		if (sink)
+			gst_object_unref(sink);
+		gst_caps_unref(caps);
+		gst_object_unref(pipeline);
+		release();
+		return NULL;
+	}
+	g_object_set(m_src, "caps", caps, "format", GST_FORMAT_TIME,
+		     "is-live", TRUE, NULL);
+	gst_caps_unref(caps);
+	m_pad = gst_element_get_static_pad(sink, "sink");
+	gst_object_unref(sink);
+	m_probe = gst_pad_add_probe(m_pad, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER |
+				GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM), probe, this, NULL);
+	m_first = m_queued = 0;
+	return pipeline;
+}
+
+void RingEncoder::release()
+{
+	if (m_pad) {
+		gst_pad_remove_probe(m_pad, m_probe);
+		gst_object_unref(m_pad);
+	}
+	if (m_src)
+		gst_object_unref(m_src);
+	m_pad = NULL;
+	m_probe = 0;
+	m_src = NULL;
+}
+
+bool RingEncoder::push(const CapFrame *frame)
+{
+	GstFlowReturn ret = GST_FLOW_OK;
+	GstBuffer *buf;
+	GstMapInfo map;
+	Meta meta;
+	unsigned size = frame->size;
+
+	if (m_src == NULL)
+		return false;
+	if (m_out.sizeimage) {
+		// a short frame would have videoconvert read past its end
+		if (size < (m_in.bytesperline == m_out.bytesperline ? m_out.sizeimage :
+			    m_in.bytesperline * m_out.height))
+			return false;
+		size = m_out.sizeimage;
+	}
+
+	meta.pts = frame->timestamp.tv_sec * 1000000000ULL + frame->timestamp.tv_usec * 1000ULL;
+	meta.sequence = frame->sequence;
+	meta.flags = frame->flags;
+	meta.timestamp = frame->timestamp;
+	m_lock.lock();
+	if (m_queued == RING_ENC_QUEUE) {
+		m_lock.unlock();
+		return false;
+	}
+	m_queue[(m_first + m_queued++) % RING_ENC_QUEUE] = meta;
+	m_lock.unlock();
+
+	buf = gst_buffer_new_allocate(NULL, size, NULL);
+	gst_buffer_map(buf, &map, GST_MAP_WRITE);
+	if (m_out.sizeimage == 0 || m_in.bytesperline == m_out.bytesperline) {
+		memcpy(map.data, frame->data, size);
+	} else {
+		unsigned row = qMin(m_in.bytesperline, m_out.bytesperline);
+
+		for (unsigned y = 0; y < m_out.height; y++)
+			memcpy(map.data + y * m_out.bytesperline,
+			       frame->data + y * m_in.bytesperline, row);
+	}
+	gst_buffer_unmap(buf, &map);
+	GST_BUFFER_PTS(buf) = meta.pts;
+	g_signal_emit_by_name(m_src, "push-buffer", buf, &ret);
+	gst_buffer_unref(buf);
+	return ret == GST_FLOW_OK;
+}
+
+// Called on the streaming thread of the sink.
+GstPadProbeReturn RingEncoder::probe(GstPad *, GstPadProbeInfo *info, gpointer data)
+{
+	RingEncoder *enc = (RingEncoder *)data;
+
+	if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+		GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+
+		if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS) {
+			GstCaps *caps;
+
+			gst_event_parse_caps(event, &caps);
+			enc->setCaps(caps);
+		}
+	}
+	else if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+		enc->frame(GST_PAD_PROBE_INFO_BUFFER(info));
+	}
+	return GST_PAD_PROBE_OK;
+}
+
+void RingEncoder::setCaps(GstCaps *caps)
+{
+	const GstStructure *s = gst_caps_get_structure(caps, 0);
+	v4l2_format fmt;
+	gint width = 0;
+	gint height = 0;
+
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	gst_structure_get_int(s, "width", &width);
+	gst_structure_get_int(s, "height", &height);
+	fmt.fmt.pix.width = width;
+	fmt.fmt.pix.height = height;
+	fmt.fmt.pix.field = V4L2_FIELD_NONE;
+	fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_MJPEG;
+	m_ring->setFormat(fmt);
+}
+
+void RingEncoder::frame(GstBuffer *buf)
+{
+	GstMapInfo map;
+	Meta meta;
+	bool found = false;
+
+	// jpegenc gives one frame for each frame it gets, in order, but
+	// it may skip a frame it cannot compress
+	m_lock.lock();
+	while (m_queued && !found) {
+		meta = m_queue[m_first];
+		m_first = (m_first + 1) % RING_ENC_QUEUE;
+		m_queued--;
+		found = meta.pts == GST_BUFFER_PTS(buf);
+	}
+	m_lock.unlock();
+	if (!found || !gst_buffer_map(buf, &map, GST_MAP_READ))
+		return;
+	m_ring->write(map.data, map.size, meta.sequence, meta.flags, meta.timestamp);
+	gst_buffer_unmap(buf, &map);
+}
@@ -0,0 +1,78 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef RING_ENCODER_H
+#define RING_ENCODER_H
+
+#include <QMutex>
+#include <gst/gst.h>
+
+#include "capture-thread.h"
+#include "ring-recorder.h"
+
+// Frames waiting to be compressed, further frames are dropped
+#define RING_ENC_QUEUE 8
+
+// Keeps a RingRecorder compressed: raw frames hold little more than a
+// minute and a half of SD video in the default ring, JPEG frames half an
+// hour or more. Frames go into an appsrc and through jpegenc, a probe on
+// the sink writes the JPEG frames to the ring. Frames that are
+// compressed already are passed on as they are. The streaming thread is
+// then the only one to write to the ring, it sets the format as well.
+class RingEncoder
+{
+public:
+	RingEncoder(RingRecorder *ring);
+	~RingEncoder() { release(); }
+
+	// Builds the pipeline for frames of this format, NULL if they cannot
+	// be compressed. The caller plays and stops it, see GstWorker, and
+	// calls release() once it is stopped.
+	GstElement *create(const v4l2_format &fmt, int quality);
+	void release();
+
+	// Copies the frame into the pipeline, false if it had to be dropped.
+	// Called from a single thread.
+	bool push(const CapFrame *frame);
+
+private:
+	struct Meta {
+		__u64		pts;
+		__u32		sequence;
+		__u32		flags;
+		struct timeval	timestamp;
+	};
+
+	static GstPadProbeReturn probe(GstPad *pad, GstPadProbeInfo *info, gpointer data);
+	void setCaps(GstCaps *caps);
+	void frame(GstBuffer *buf);
+
+	RingRecorder *m_ring;
+	GstElement *m_src;
+	GstPad *m_pad;
+	gulong m_probe;
+	v4l2_pix_format m_in;		// frames as they come in
+	v4l2_pix_format m_out;		// frames as the pipeline wants them
+	QMutex m_lock;			// the queue
+	Meta m_queue[RING_ENC_QUEUE];
+	unsigned m_first;
+	unsigned m_queued;
+};
+
+#endif
@@ -0,0 +1,331 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ring-recorder.h"
+#include "raw-container.h"
+
+// one index entry per this many bytes of frame data
+#define RING_BYTES_PER_ENTRY 16384
+#define RING_MIN_ENTRIES 1024
+
+RingRecorder::RingRecorder() :
+	m_fd(-1),
+	m_map(NULL),
+	m_mapSize(0),
+	m_hdr(NULL),
+	m_index(NULL),
+	m_data(NULL)
+{
+}
+
+__u64 RingRecorder::wallclock()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+bool RingRecorder::open(const QString &fileName, unsigned long long size)
+{
+	RingHeader hdr;
+	struct stat st;
+	size_t mapSize;
+	bool reuse;
+	void *p;
+
+	close();
+	m_fd = ::open(fileName.toLocal8Bit().data(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+	if (m_fd < 0)
+		return false;
+	reuse = pread(m_fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+		!memcmp(hdr.magic, RING_FILE_MAGIC, sizeof(hdr.magic)) &&
+		hdr.dataSize == size && !fstat(m_fd, &st);
+	if (reuse) {
+		mapSize = RING_HEADER_SIZE + hdr.indexEntries * sizeof(RingIndexEntry) + size;
+		reuse = (unsigned long long)st.st_size >= mapSize;
+	}
+	if (!reuse && !init(size, hdr)) {
+		close();
+		return false;
+	}
+	mapSize = RING_HEADER_SIZE + hdr.indexEntries * sizeof(RingIndexEntry) + size;
+	p = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+	if (p == MAP_FAILED) {
+		close();
+		return false;
+	}
+	m_map = (unsigned char *)p;
+	m_mapSize = mapSize;
+	m_hdr = (RingHeader *)m_map;
+	m_index = (RingIndexEntry *)(m_map + RING_HEADER_SIZE);
+	m_data = m_map + RING_HEADER_SIZE + m_hdr->indexEntries * sizeof(RingIndexEntry);
+	// a ring from before oldest was kept, or a damaged one, starts empty
+	if (m_hdr->oldest > m_hdr->frames ||
+	    m_hdr->frames - m_hdr->oldest > m_hdr->indexEntries ||
+	    (m_hdr->frames > m_hdr->oldest &&
+	     m_hdr->head - m_index[m_hdr->oldest % m_hdr->indexEntries].offset > m_hdr->dataSize))
+		m_hdr->oldest = m_hdr->frames;
+	return true;
+}
+
+// Lays out a new, empty ring. All the disk space is reserved here so the
+// mapping cannot fault for lack of space later on.
+bool RingRecorder::init(unsigned long long size, RingHeader &hdr)
+{
+	unsigned long long entries = size / RING_BYTES_PER_ENTRY;
+
+	if (entries < RING_MIN_ENTRIES)
+		entries = RING_MIN_ENTRIES;
+	if (size == 0 || ftruncate(m_fd, 0) ||
+	    posix_fallocate(m_fd, 0, RING_HEADER_SIZE + entries * sizeof(RingIndexEntry) + size))
+		return false;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, RING_FILE_MAGIC, sizeof(hdr.magic));
+	hdr.indexEntries = entries;
+	hdr.dataSize = size;
+	return pwrite(m_fd, &hdr, sizeof(hdr), 0) == sizeof(hdr);
+}
+
+void RingRecorder::close()
+{
+	if (m_map)
+		munmap(m_map, m_mapSize);
+	if (m_fd >= 0)
+		::close(m_fd);
+	m_fd = -1;
+	m_map = NULL;
+	m_mapSize = 0;
+	m_hdr = NULL;
+	m_index = NULL;
+	m_data = NULL;
+}
+
+void RingRecorder::setFormat(const v4l2_format &fmt)
+{
+	if (m_hdr == NULL)
+		return;
+	if (m_hdr->type == fmt.type && !memcmp(m_hdr->format, &fmt.fmt, sizeof(m_hdr->format)))
+		return;
+	// a ring holds frames of a single format, the counters go on so
+	// that an export in progress sees its frames go
+	m_hdr->oldest = m_hdr->frames;
+	__sync_synchronize();
+	m_hdr->type = fmt.type;
+	memcpy(m_hdr->format, &fmt.fmt, sizeof(m_hdr->format));
+}
+
+bool RingRecorder::write(const unsigned char *data, unsigned size, __u32 sequence,
+		__u32 flags, const struct timeval &timestamp)
+{
+	RingIndexEntry *entry;
+	unsigned long long pos, oldest;
+	unsigned entries;
+	unsigned n;
+
+	if (m_hdr == NULL || m_hdr->type == 0 || size > m_hdr->dataSize)
+		return false;
+	// frames whose index slot or data this one takes leave the ring first
+	entries = m_hdr->indexEntries;
+	oldest = m_hdr->oldest;
+	while (oldest < m_hdr->frames &&
+	       (m_hdr->frames - oldest >= entries ||
+		m_index[oldest % entries].offset + m_hdr->dataSize < m_hdr->head + size))
+		oldest++;
+	if (oldest != m_hdr->oldest) {
+		m_hdr->oldest = oldest;
+		__sync_synchronize();
+	}
+	pos = m_hdr->head % m_hdr->dataSize;
+	n = m_hdr->dataSize - pos < size ? m_hdr->dataSize - pos : size;
+	memcpy(m_data + pos, data, n);
+	memcpy(m_data, data + n, size - n);
+
+	entry = &m_index[m_hdr->frames % entries];
+	entry->offset = m_hdr->head;
+	entry->wallclock = wallclock();
+	entry->timestamp = timestamp.tv_sec * 1000000000ULL + timestamp.tv_usec * 1000ULL;
+	entry->size = size;
+	entry->sequence = sequence;
+	entry->flags = flags;
+	entry->reserved = 0;
+
+	// the frame must be complete before it becomes part of the ring
+	__sync_synchronize();
+	m_hdr->head += size;
+	m_hdr->frames++;
+	return true;
+}
+
+// A header field that write() moves on, read from another thread.
+static inline __u64 shared(const __u64 &field)
+{
+	__u64 v = *(const volatile __u64 *)&field;
+
+	__sync_synchronize();
+	return v;
+}
+
+__u64 RingRecorder::span() const
+{
+	unsigned long long lo, hi;
+	unsigned entries;
+	__u64 first, last;
+
+	if (m_hdr == NULL)
+		return 0;
+	entries = m_hdr->indexEntries;
+	// the oldest frame may leave the ring while its entry is read
+	do {
+		lo = shared(m_hdr->oldest);
+		hi = shared(m_hdr->frames);
+		if (lo >= hi)
+			return 0;
+		first = m_index[lo % entries].wallclock;
+		last = m_index[(hi - 1) % entries].wallclock;
+		__sync_synchronize();
+	} while (shared(m_hdr->oldest) != lo);
+	return last - first;
+}
+
+int RingRecorder::exportRange(const QString &fileName, __u64 from, __u64 to,
+		const volatile bool *cancel, bool *overrun)
+{
+	RawRecorder rec;
+	v4l2_format fmt;
+	unsigned char *frame = NULL;
+	unsigned frameSize = 0;
+	unsigned long long lo, hi, end;
+	int count = 0;
+
+	if (overrun)
+		*overrun = false;
+	if (m_hdr == NULL || m_hdr->type == 0)
+		return -1;
+	lo = shared(m_hdr->oldest);
+	end = hi = shared(m_hdr->frames);
+	while (lo < hi) {
+		unsigned long long mid = lo + (hi - lo) / 2;
+
+		if (m_index[mid % m_hdr->indexEntries].wallclock < from)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = m_hdr->type;
+	memcpy(&fmt.fmt, m_hdr->format, sizeof(m_hdr->format));
+	// exporting must not lose frames to a slow disk
+	rec.writer()->setBlocking(true);
+	if (!rec.open(fileName, false, fmt))
+		return -1;
+	// Each frame is copied out and only kept if oldest has not moved
+	// past it meanwhile, as write() moves oldest before reusing anything.
+	// Until the first frame is out the start of the range may still move
+	// up with the ring, after that a lost frame ends the export.
+	while (lo < end && !(cancel && *cancel)) {
+		RingIndexEntry entry;
+		unsigned long long pos;
+		struct timeval tv;
+		unsigned n;
+
+		if (shared(m_hdr->oldest) > lo) {
+			if (count) {
+				if (overrun)
+					*overrun = true;
+				break;
+			}
+			lo = shared(m_hdr->oldest);
+			continue;
+		}
+		entry = m_index[lo % m_hdr->indexEntries];
+		// a torn entry, checked again above
+		if (entry.size > m_hdr->dataSize)
+			continue;
+		if (entry.size > frameSize) {
+			free(frame);
+			frameSize = entry.size;
+			frame = (unsigned char *)malloc(frameSize);
+			if (frame == NULL)
+				break;
+		}
+		// frames that wrap around are put back together
+		pos = entry.offset % m_hdr->dataSize;
+		n = m_hdr->dataSize - pos < entry.size ? m_hdr->dataSize - pos : entry.size;
+		memcpy(frame, m_data + pos, n);
+		memcpy(frame + n, m_data, entry.size - n);
+		if (shared(m_hdr->oldest) > lo)
+			continue;
+		if (entry.wallclock > to)
+			break;
+		// the recording may span restarts, only the wall clock is steady
+		tv.tv_sec = entry.wallclock / 1000000000;
+		tv.tv_usec = entry.wallclock % 1000000000 / 1000;
+		if (rec.write(frame, entry.size, entry.sequence,
+				entry.flags & ~V4L2_BUF_FLAG_TIMESTAMP_MASK, tv))
+			count++;
+		lo++;
+	}
+	rec.close();
+	free(frame);
+	return count;
+}
+
+RingExporter::RingExporter(QObject *parent) :
+	QThread(parent),
+	m_ring(NULL),
+	m_from(0),
+	m_to(0),
+	m_cancel(false)
+{
+}
+
+void RingExporter::exportRange(RingRecorder *ring, const QString &fileName, __u64 from, __u64 to)
+{
+	cancel();
+	m_ring = ring;
+	m_fileName = fileName;
+	m_from = from;
+	m_to = to;
+	m_cancel = false;
+	start(LowPriority);
+}
+
+void RingExporter::cancel()
+{
+	m_cancel = true;
+	wait();
+}
+
+void RingExporter::run()
+{
+	bool overrun;
+	int frames = m_ring->exportRange(m_fileName, m_from, m_to, &m_cancel, &overrun);
+
+	emit exported(frames, overrun);
+}
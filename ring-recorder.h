@@ -0,0 +1,136 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef RING_RECORDER_H
+#define RING_RECORDER_H
+
+#include <QString>
+#include <QThread>
+#include <sys/time.h>
+#include <linux/videodev2.h>
+
+// Layout of a ring file, all fields in host byte order:
+//
+//	RingHeader, padded to RING_HEADER_SIZE
+//	RingIndexEntry[indexEntries]	circular, one per frame
+//	data[dataSize]			circular frame data
+//
+// head, frames and oldest only move forward: a frame starts at data
+// offset (offset % dataSize) and lives in index slot (number %
+// indexEntries). Before a frame is written, oldest moves past every frame
+// whose data or index slot it reuses; head and frames are advanced after
+// the frame itself is in place. Frames oldest to frames - 1 are whole
+// whenever the process stops.
+
+#define RING_FILE_MAGIC "QV4LRING"
+#define RING_HEADER_SIZE 4096
+
+struct RingHeader {
+	char	magic[8];
+	__u32	type;			// v4l2_format.type, 0 until a format is set
+	__u32	indexEntries;
+	__u8	format[200];		// v4l2_format.fmt
+	__u64	dataSize;
+	__u64	head;			// bytes ever written
+	__u64	frames;			// frames ever written
+	__u64	oldest;			// first frame still in the ring
+};
+
+struct RingIndexEntry {
+	__u64	offset;			// of the frame in bytes ever written
+	__u64	wallclock;		// nsec since the epoch when recorded
+	__u64	timestamp;		// nsec, clock given by the flags
+	__u32	size;
+	__u32	sequence;
+	__u32	flags;
+	__u32	reserved;
+};
+
+// Keeps the most recent frames in a file of fixed size that is mapped
+// into memory, so recording never grows disk use. The file is picked up
+// again after a restart as long as the size and format still match.
+// Any period of wall clock time can be exported to a raw container
+// without touching the frames themselves.
+class RingRecorder
+{
+public:
+	RingRecorder();
+	~RingRecorder() { close(); }
+
+	// size in bytes, used for the frame data
+	bool open(const QString &fileName, unsigned long long size);
+	void close();
+	bool isOpen() const { return m_hdr != NULL; }
+
+	// Starts over if the format differs from the recorded one.
+	void setFormat(const v4l2_format &fmt);
+	bool write(const unsigned char *data, unsigned size, __u32 sequence,
+			__u32 flags, const struct timeval &timestamp);
+
+	// Wall clock nsec, returns the number of frames exported or -1. May
+	// run on another thread than write(): the export stops at the first
+	// frame write() takes the place of, and sets overrun if it does.
+	int exportRange(const QString &fileName, __u64 from, __u64 to,
+			const volatile bool *cancel = NULL, bool *overrun = NULL);
+	static __u64 wallclock();
+	// Wall clock nsec from the oldest to the newest frame in the ring,
+	// from any thread.
+	__u64 span() const;
+
+private:
+	bool init(unsigned long long size, RingHeader &hdr);
+
+	int m_fd;
+	unsigned char *m_map;
+	size_t m_mapSize;
+	RingHeader *m_hdr;
+	RingIndexEntry *m_index;
+	unsigned char *m_data;
+};
+
+// Exports from a ring on its own thread, so that capturing goes on while
+// a long period is written out.
+class RingExporter : public QThread
+{
+	Q_OBJECT
+
+public:
+	RingExporter(QObject *parent = 0);
+	virtual ~RingExporter() { cancel(); }
+
+	// The ring must stay open until exported() is emitted.
+	void exportRange(RingRecorder *ring, const QString &fileName, __u64 from, __u64 to);
+	// Stops an export in progress and waits for it.
+	void cancel();
+
+signals:
+	// frames is -1 if the file could not be written
+	void exported(int frames, bool overrun);
+
+protected:
+	virtual void run();
+
+private:
+	RingRecorder *m_ring;
+	QString m_fileName;
+	__u64 m_from, m_to;
+	volatile bool m_cancel;
+};
+
+#endif
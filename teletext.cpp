@@ -0,0 +1,305 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <string.h>
+
+#include "teletext.h"
+
+// Data bits of a Hamming 8/4 byte, 0xff if not correctable. The data bits
+// are bits 1, 3, 5 and 7 of the byte, first bit received in bit 0.
+const unsigned char TeletextDecoder::hamm84[256] = {
+	0x01, 0xff, 0x01, 0x01, 0xff, 0x00, 0x01, 0xff,
+	0xff, 0x02, 0x01, 0xff, 0x0a, 0xff, 0xff, 0x07,
+	0xff, 0x00, 0x01, 0xff, 0x00, 0x00, 0xff, 0x00,
+	0x06, 0xff, 0xff, 0x0b, 0xff, 0x00, 0x03, 0xff,
+	0xff, 0x0c, 0x01, 0xff, 0x04, 0xff, 0xff, 0x07,
+	0x06, 0xff, 0xff, 0x07, 0xff, 0x07, 0x07, 0x07,
+	0x06, 0xff, 0xff, 0x05, 0xff, 0x00, 0x0d, 0xff,
+	0x06, 0x06, 0x06, 0xff, 0x06, 0xff, 0xff, 0x07,
+	0xff, 0x02, 0x01, 0xff, 0x04, 0xff, 0xff, 0x09,
+	0x02, 0x02, 0xff, 0x02, 0xff, 0x02, 0x03, 0xff,
+	0x08, 0xff, 0xff, 0x05, 0xff, 0x00, 0x03, 0xff,
+	0xff, 0x02, 0x03, 0xff, 0x03, 0xff, 0x03, 0x03,
+	0x04, 0xff, 0xff, 0x05, 0x04, 0x04, 0x04, 0xff,
+	0xff, 0x02, 0x0f, 0xff, 0x04, 0xff, 0xff, 0x07,
+	0xff, 0x05, 0x05, 0x05, 0x04, 0xff, 0xff, 0x05,
+	0x06, 0xff, 0xff, 0x05, 0xff, 0x0e, 0x03, 0xff,
+	0xff, 0x0c, 0x01, 0xff, 0x0a, 0xff, 0xff, 0x09,
+	0x0a, 0xff, 0xff, 0x0b, 0x0a, 0x0a, 0x0a, 0xff,
+	0x08, 0xff, 0xff, 0x0b, 0xff, 0x00, 0x0d, 0xff,
+	0xff, 0x0b, 0x0b, 0x0b, 0x0a, 0xff, 0xff, 0x0b,
+	0x0c, 0x0c, 0xff, 0x0c, 0xff, 0x0c, 0x0d, 0xff,
+	0xff, 0x0c, 0x0f, 0xff, 0x0a, 0xff, 0xff, 0x07,
+	0xff, 0x0c, 0x0d, 0xff, 0x0d, 0xff, 0x0d, 0x0d,
+	0x06, 0xff, 0xff, 0x0b, 0xff, 0x0e, 0x0d, 0xff,
+	0x08, 0xff, 0xff, 0x09, 0xff, 0x09, 0x09, 0x09,
+	0xff, 0x02, 0x0f, 0xff, 0x0a, 0xff, 0xff, 0x09,
+	0x08, 0x08, 0x08, 0xff, 0x08, 0xff, 0xff, 0x09,
+	0x08, 0xff, 0xff, 0x0b, 0xff, 0x0e, 0x03, 0xff,
+	0xff, 0x0c, 0x0f, 0xff, 0x04, 0xff, 0xff, 0x09,
+	0x0f, 0xff, 0x0f, 0x0f, 0xff, 0x0e, 0x0f, 0xff,
+	0x08, 0xff, 0xff, 0x05, 0xff, 0x0e, 0x0d, 0xff,
+	0xff, 0x0e, 0x0f, 0xff, 0x0e, 0x0e, 0xff, 0x0e
+};
+
+// Characters have odd parity. A character received in error leaves the
+// one from an earlier transmission of the page in place.
+static inline void setChar(unsigned char &dst, unsigned char c)
+{
+	if (__builtin_parity(c))
+		dst = c & 0x7f;
+}
+
+TeletextDecoder::TeletextDecoder(unsigned pages) :
+	m_size(pages < 16 ? 16 : pages)
+{
+	m_slots = new Slot[m_size];
+	reset();
+}
+
+TeletextDecoder::~TeletextDecoder()
+{
+	delete [] m_slots;
+}
+
+void TeletextDecoder::reset()
+{
+	for (unsigned i = 0; i < m_size; i++)
+		m_slots[i].next = i + 1 < m_size ? i + 1 : -1;
+	m_free = 0;
+	m_head = m_tail = -1;
+	m_used = 0;
+	for (unsigned i = 0; i < 0x800; i++)
+		m_index[i] = -1;
+	for (unsigned i = 0; i < 8; i++)
+		m_current[i] = -1;
+}
+
+void TeletextDecoder::decode(const v4l2_sliced_vbi_data *data, unsigned lines)
+{
+	for (unsigned i = 0; i < lines; i++)
+		if (data[i].id & V4L2_SLICED_TELETEXT_B)
+			packet(data[i].data);
+}
+
+void TeletextDecoder::packet(const unsigned char *data)
+{
+	int m0 = hamming84(data[0]);
+	int m1 = hamming84(data[1]);
+	unsigned mag, row;
+
+	if (m0 < 0 || m1 < 0)
+		return;
+	mag = m0 & 7;
+	row = (m0 >> 3) | (m1 << 1);
+	if (row == 0)
+		header(mag, data);
+	else if (row < TXT_ROWS)
+		this->row(mag, row, data);
+	// packets 25 to 31 carry no page text
+}
+
+void TeletextDecoder::header(unsigned mag, const unsigned char *data)
+{
+	int units = hamming84(data[2]);
+	int tens = hamming84(data[3]);
+	int s1 = hamming84(data[4]);
+	int s2 = hamming84(data[5]);
+	int s3 = hamming84(data[6]);
+	int s4 = hamming84(data[7]);
+	int c7 = hamming84(data[8]);
+	int c11 = hamming84(data[9]);
+	unsigned pgno, subno;
+	TeletextPage *p;
+	int slot;
+
+	// In serial mode a header ends the pages of all magazines. Any
+	// header ends the page of its own, the rows that follow belong to
+	// the new page, or to none if the header was not readable.
+	if (c11 >= 0 && (c11 & 1))
+		for (unsigned i = 0; i < 8; i++)
+			m_current[i] = -1;
+	m_current[mag] = -1;
+	if (units < 0 || tens < 0 || s1 < 0 || s2 < 0 || s3 < 0 || s4 < 0 ||
+	    c7 < 0 || c11 < 0)
+		return;
+	// page ff only fills time between pages
+	if (tens == 0xf && units == 0xf)
+		return;
+
+	pgno = ((mag ? mag : 8) << 8) | (tens << 4) | units;
+	subno = s1 | ((s2 & 7) << 4) | (s3 << 8) | ((s4 & 3) << 12);
+	slot = find(pgno, subno);
+	if (slot < 0)
+		slot = insert(pgno, subno);
+	else
+		toFront(slot);
+
+	p = &m_slots[slot].page;
+	p->flags = ((s2 & 8) << 1) | ((s4 & 0xc) << 3) | (c7 << 7) | (c11 << 11);
+	if (p->flags & TXT_ERASE) {
+		memset(p->text, ' ', sizeof(p->text));
+		p->rows = 0;
+	}
+	for (unsigned i = 8; i < TXT_COLS; i++)
+		setChar(p->text[0][i], data[i + 2]);
+	p->rows |= 1;
+	p->updates++;
+	m_current[mag] = slot;
+}
+
+void TeletextDecoder::row(unsigned mag, unsigned row, const unsigned char *data)
+{
+	TeletextPage *p;
+
+	if (m_current[mag] < 0)
+		return;
+	p = &m_slots[m_current[mag]].page;
+	for (unsigned i = 0; i < TXT_COLS; i++)
+		setChar(p->text[row][i], data[i + 2]);
+	p->rows |= 1 << row;
+	p->updates++;
+}
+
+int TeletextDecoder::find(unsigned pgno, unsigned subno) const
+{
+	int slot = m_index[pgno & 0x7ff];
+
+	if (subno == TXT_ANY_SUB)
+		return slot;
+	while (slot >= 0 && m_slots[slot].page.subno != subno)
+		slot = m_slots[slot].sub;
+	return slot;
+}
+
+// A new subpage, first in the chain of its page and in LRU order.
+int TeletextDecoder::insert(unsigned pgno, unsigned subno)
+{
+	int *chain = &m_index[pgno & 0x7ff];
+	int last = -1;
+	unsigned count = 0;
+	TeletextPage *p;
+	int slot;
+
+	for (slot = *chain; slot >= 0; slot = m_slots[slot].sub, count++)
+		last = slot;
+	if (count >= TXT_MAX_SUBPAGES)
+		drop(last);
+	if (m_free < 0)
+		drop(m_tail);
+
+	slot = m_free;
+	m_free = m_slots[slot].next;
+	m_used++;
+	p = &m_slots[slot].page;
+	p->pgno = pgno;
+	p->subno = subno;
+	p->flags = 0;
+	p->rows = 0;
+	p->updates = 0;
+	memset(p->text, ' ', sizeof(p->text));
+	m_slots[slot].sub = *chain;
+	*chain = slot;
+	m_slots[slot].prev = -1;
+	m_slots[slot].next = m_head;
+	if (m_head >= 0)
+		m_slots[m_head].prev = slot;
+	m_head = slot;
+	if (m_tail < 0)
+		m_tail = slot;
+	return slot;
+}
+
+void TeletextDecoder::unlink(int slot)
+{
+	Slot &s = m_slots[slot];
+
+	if (s.prev >= 0)
+		m_slots[s.prev].next = s.next;
+	else
+		m_head = s.next;
+	if (s.next >= 0)
+		m_slots[s.next].prev = s.prev;
+	else
+		m_tail = s.prev;
+}
+
+// Most recently used.
+void TeletextDecoder::touch(int slot)
+{
+	if (m_head == slot)
+		return;
+	unlink(slot);
+	m_slots[slot].prev = -1;
+	m_slots[slot].next = m_head;
+	m_slots[m_head].prev = slot;
+	m_head = slot;
+}
+
+// Most recently used, and newest subpage of its page.
+void TeletextDecoder::toFront(int slot)
+{
+	int *chain = &m_index[m_slots[slot].page.pgno & 0x7ff];
+	int *p = chain;
+
+	if (*p != slot) {
+		while (m_slots[*p].sub != slot)
+			p = &m_slots[*p].sub;
+		m_slots[*p].sub = m_slots[slot].sub;
+		m_slots[slot].sub = *chain;
+		*chain = slot;
+	}
+	touch(slot);
+}
+
+void TeletextDecoder::drop(int slot)
+{
+	int *p = &m_index[m_slots[slot].page.pgno & 0x7ff];
+
+	while (*p != slot)
+		p = &m_slots[*p].sub;
+	*p = m_slots[slot].sub;
+	unlink(slot);
+	for (unsigned i = 0; i < 8; i++)
+		if (m_current[i] == slot)
+			m_current[i] = -1;
+	m_slots[slot].next = m_free;
+	m_free = slot;
+	m_used--;
+}
+
+const TeletextPage *TeletextDecoder::page(unsigned pgno, unsigned subno)
+{
+	int slot = find(pgno, subno);
+
+	if (slot < 0)
+		return NULL;
+	// viewing a subpage does not make it the newest one
+	touch(slot);
+	return &m_slots[slot].page;
+}
+
+unsigned TeletextDecoder::subpages(unsigned pgno, unsigned *subnos, unsigned max) const
+{
+	unsigned n = 0;
+
+	for (int slot = m_index[pgno & 0x7ff]; slot >= 0 && n < max; slot = m_slots[slot].sub)
+		subnos[n++] = m_slots[slot].page.subno;
+	return n;
+}
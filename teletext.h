@@ -0,0 +1,117 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef TELETEXT_H
+#define TELETEXT_H
+
+#include <linux/videodev2.h>
+
+#define TXT_ROWS	25
+#define TXT_COLS	40
+// pages kept, a full service has a few hundred
+#define TXT_CACHE_PAGES	1024
+// subpages kept of one page, clock pages count up without end
+#define TXT_MAX_SUBPAGES 64
+// for page(), the most recently received subpage
+#define TXT_ANY_SUB	0xffff
+
+// The control bits of the page header, C4 to C14.
+#define TXT_ERASE		(1 << 4)
+#define TXT_NEWSFLASH		(1 << 5)
+#define TXT_SUBTITLE		(1 << 6)
+#define TXT_SUPPRESS_HEADER	(1 << 7)
+#define TXT_UPDATE		(1 << 8)
+#define TXT_INTERRUPTED		(1 << 9)
+#define TXT_INHIBIT_DISPLAY	(1 << 10)
+#define TXT_SERIAL		(1 << 11)
+#define TXT_CHARSET(flags)	(((flags) >> 12) & 7)
+
+struct TeletextPage {
+	unsigned pgno;		// 0x100 to 0x8ff, hex digits as broadcast
+	unsigned subno;		// subcode, 0 to 0x3f7f
+	unsigned flags;		// header control bits
+	unsigned rows;		// bit n set once row n was received
+	unsigned updates;	// counts the packets that went into the page
+	// 7 bit characters, parity stripped. Row 0 is the header, its first
+	// 8 columns are left for the page number.
+	unsigned char text[TXT_ROWS][TXT_COLS];
+};
+
+// Assembles teletext packets into pages, by magazine, and keeps the
+// pages in a cache that drops the least recently used one when full.
+// Any page is found in constant time through a table of all 2048 page
+// numbers, its subpages are chained from there.
+class TeletextDecoder
+{
+public:
+	TeletextDecoder(unsigned pages = TXT_CACHE_PAGES);
+	~TeletextDecoder();
+
+	void reset();
+	// The lines of one frame, as vbi_parse() fills them in.
+	void decode(const v4l2_sliced_vbi_data *data, unsigned lines);
+	// One packet of 42 bytes.
+	void packet(const unsigned char *data);
+
+	// NULL if the page is not cached. Counts as a use for the cache.
+	const TeletextPage *page(unsigned pgno, unsigned subno = TXT_ANY_SUB);
+	// The subcodes of the cached subpages of a page, newest first.
+	unsigned subpages(unsigned pgno, unsigned *subnos, unsigned max) const;
+	unsigned cached() const { return m_used; }
+
+	// 4 data bits of a Hamming 8/4 protected byte, -1 if it has more
+	// than one bit error.
+	static int hamming84(unsigned char c)
+	{
+		return hamm84[c] == 0xff ? -1 : hamm84[c];
+	}
+	// The teletext page number 0x100-0x8ff of a decimal one, 100-899.
+	static unsigned pgnoOf(unsigned number)
+	{
+		return ((number / 100) << 8) | ((number / 10 % 10) << 4) | (number % 10);
+	}
+
+private:
+	struct Slot {
+		TeletextPage page;
+		int prev, next;		// in LRU order, or in the free list
+		int sub;		// next subpage of the same page
+	};
+
+	int find(unsigned pgno, unsigned subno) const;
+	int insert(unsigned pgno, unsigned subno);
+	void unlink(int slot);
+	void touch(int slot);
+	void toFront(int slot);
+	void drop(int slot);
+	void header(unsigned mag, const unsigned char *data);
+	void row(unsigned mag, unsigned row, const unsigned char *data);
+
+	static const unsigned char hamm84[256];
+
+	Slot *m_slots;
+	unsigned m_size;
+	unsigned m_used;
+	int m_head, m_tail;		// most and least recently used
+	int m_free;
+	int m_index[0x800];		// by magazine 0-7 and page, newest subpage
+	int m_current[8];		// page each magazine is sending, or -1
+};
+
+#endif
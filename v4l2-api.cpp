@@ -23,12 +23,30 @@
 #include <errno.h>
 #include <limits.h>
 #include <libv4l2.h>
+#include <sys/stat.h>
 #include "v4l2-api.h"
+#include "raw-replay.h"
 
 bool v4l2::open(const QString &device, bool useWrapper)
 {
+	struct stat st;
+
 	m_device = device;
 	m_useWrapper = useWrapper;
+	if (!stat(device.toAscii(), &st) && S_ISREG(st.st_mode) &&
+	    RawReplay::isRecording(device)) {
+		m_useWrapper = false;
+		m_replay = new RawReplay;
+		m_fd = m_replay->open(device, m_replayRealtime);
+		if (m_fd < 0) {
+			delete m_replay;
+			m_replay = NULL;
+			error("Cannot replay " + device);
+			return false;
+		}
+		querycap(m_capability);
+		return true;
+	}
 	m_fd = ::open(device.toAscii(), O_RDWR | O_NONBLOCK);
 	if (m_fd < 0) {
 		error("Cannot open " + device);
@@ -54,7 +72,10 @@ bool v4l2::open(const QString &device, bool useWrapper)
 
 void v4l2::close()
 {
-	if (useWrapper())
+	if (m_replay) {
+		delete m_replay;
+		m_replay = NULL;
+	} else if (useWrapper())
 		::v4l2_close(m_fd);
 	else
 		::close(m_fd);
@@ -63,6 +84,8 @@ void v4l2::close()
 
 int v4l2::ioctl(unsigned cmd, void *arg)
 {
+	if (m_replay)
+		return m_replay->ioctl(cmd, arg);
 	if (useWrapper())
 		return v4l2_ioctl(m_fd, cmd, arg);
 	return ::ioctl(m_fd, cmd, arg);
@@ -82,6 +105,8 @@ bool v4l2::ioctl(const QString &descr, unsigned cmd, void *arg)
 
 int v4l2::read(unsigned char *p, int size)
 {
+	if (m_replay)
+		return m_replay->read(p, size);
 	if (useWrapper())
 		return v4l2_read(m_fd, p, size);
 	return ::read(m_fd, p, size);
@@ -89,6 +114,8 @@ int v4l2::read(unsigned char *p, int size)
 
 void *v4l2::mmap(size_t length, int64_t offset)
 {
+	if (m_replay)
+		return m_replay->mmap(length, offset);
 	if (useWrapper())
 		return v4l2_mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, offset);
 	return ::mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, offset);
@@ -96,6 +123,9 @@ void *v4l2::mmap(size_t length, int64_t offset)
 
 int v4l2::munmap(void *start, size_t length)
 {
+	// replay buffers go away with VIDIOC_REQBUFS
+	if (m_replay)
+		return 0;
 	if (useWrapper())
 		return v4l2_munmap(start, length);
 	return ::munmap(start, length);
@@ -473,6 +503,26 @@ bool v4l2::reqbufs_mmap(v4l2_requestbuffers &reqbuf, __u32 buftype, int count)
 	return ioctl(VIDIOC_REQBUFS, &reqbuf) >= 0;
 }
 
+bool v4l2::create_bufs_user(v4l2_create_buffers &cbufs, const v4l2_format &fmt, int count)
+{
+	memset(&cbufs, 0, sizeof(cbufs));
+	cbufs.memory = V4L2_MEMORY_USERPTR;
+	cbufs.format = fmt;
+	cbufs.count = count;
+
+	return ioctl(VIDIOC_CREATE_BUFS, &cbufs) >= 0;
+}
+
+bool v4l2::create_bufs_mmap(v4l2_create_buffers &cbufs, const v4l2_format &fmt, int count)
+{
+	memset(&cbufs, 0, sizeof(cbufs));
+	cbufs.memory = V4L2_MEMORY_MMAP;
+	cbufs.format = fmt;
+	cbufs.count = count;
+
+	return ioctl(VIDIOC_CREATE_BUFS, &cbufs) >= 0;
+}
+
 bool v4l2::dqbuf_mmap(v4l2_buffer &buf, __u32 buftype, bool &again)
 {
 	int res;
@@ -526,6 +576,20 @@ bool v4l2::qbuf_user(int index, __u32 buftype, void *ptr, int length)
 	return qbuf(buf);
 }
 
+bool v4l2::expbuf(__u32 buftype, int index, int &fd)
+{
+	v4l2_exportbuffer expbuf;
+
+	memset(&expbuf, 0, sizeof(expbuf));
+	expbuf.type = buftype;
+	expbuf.index = index;
+	expbuf.flags = O_RDONLY | O_CLOEXEC;
+	if (ioctl(VIDIOC_EXPBUF, &expbuf) < 0)
+		return false;
+	fd = expbuf.fd;
+	return true;
+}
+
 bool v4l2::streamon(__u32 buftype)
 {
 	return ioctl("Start Streaming", VIDIOC_STREAMON, &buftype);
@@ -24,17 +24,22 @@
 #include <linux/videodev2.h>
 #include <libv4lconvert.h>
 
+class RawReplay;
+
 class v4l2
 {
 public:
-	v4l2() : m_fd(-1) {}
+	v4l2() : m_fd(-1), m_replay(NULL), m_replayRealtime(true) {}
 	v4l2(v4l2 &old) :
 		m_fd(old.m_fd),
 		m_device(old.m_device),
 		m_useWrapper(old.m_useWrapper),
-		m_capability(old.m_capability)
+		m_capability(old.m_capability),
+		m_replay(old.m_replay),
+		m_replayRealtime(old.m_replayRealtime)
 	{}
 
+	// A raw recording opened as device is played back by a RawReplay.
 	bool open(const QString &device, bool useWrapper = true);
 	void close();
 	int read(unsigned char *p, int size);
@@ -51,6 +56,9 @@ public:
 		return m_capability.capabilities;
 	}
 	inline const QString &device() const { return m_device; }
+	inline bool isReplay() const { return m_replay != NULL; }
+	// Play recordings back at their recorded pace or as fast as possible.
+	inline void setReplayRealtime(bool realtime) { m_replayRealtime = realtime; }
 	static QString pixfmt2s(unsigned pixelformat);
 
 	virtual void error(const QString &text);
@@ -102,11 +110,14 @@ public:
 
 	bool reqbufs_mmap(v4l2_requestbuffers &reqbuf, __u32 buftype, int count = 0);
 	bool reqbufs_user(v4l2_requestbuffers &reqbuf, __u32 buftype, int count = 0);
+	bool create_bufs_mmap(v4l2_create_buffers &cbufs, const v4l2_format &fmt, int count);
+	bool create_bufs_user(v4l2_create_buffers &cbufs, const v4l2_format &fmt, int count);
 	bool dqbuf_mmap(v4l2_buffer &buf, __u32 buftype, bool &again);
 	bool dqbuf_user(v4l2_buffer &buf, __u32 buftype, bool &again);
 	bool qbuf(v4l2_buffer &buf);
 	bool qbuf_mmap(int index, __u32 buftype);
 	bool qbuf_user(int index, __u32 buftype, void *ptr, int length);
+	bool expbuf(__u32 buftype, int index, int &fd);
 	bool streamon(__u32 buftype);
 	bool streamoff(__u32 buftype);
 
@@ -171,6 +182,8 @@ private:
 	QString 	m_device;
 	bool 		m_useWrapper;		// true if using the libv4l2 wrappers
 	v4l2_capability m_capability;
+	RawReplay	*m_replay;		// only owned by the object that opened it
+	bool		m_replayRealtime;
 };
 
 #endif
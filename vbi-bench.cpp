@@ -0,0 +1,217 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "raw-container.h"
+#include "vbi-slicer.h"
+#include "vbi-bench.h"
+
+#define GEN_FRAMES	50
+
+static double now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// A bttv-like PAL VBI frame of teletext lines, each at its own level,
+// amplitude, phase and noise, so that some lines fail the CRI or FRC.
+// As on air, some lines carry nothing at all.
+static void generate(unsigned char *frame, const v4l2_vbi_format &fmt, unsigned &seed)
+{
+	unsigned lines = fmt.count[0] + fmt.count[1];
+	double spb = (double)fmt.sampling_rate / 6937500;
+
+	for (unsigned y = 0; y < lines; y++) {
+		unsigned char *line = frame + y * fmt.samples_per_line;
+		unsigned char bits[16 + 8 + 42 * 8];
+		unsigned n = 0;
+		int low, high, noise;
+		double start;
+
+		seed = seed * 1103515245 + 12345;
+		low = 16 + (seed >> 16) % 48;
+		high = low + 24 + (seed >> 8) % 160;
+		noise = (seed >> 4) % 24;
+		start = 20 + (seed >> 20) % 200;
+		if (y % 3 == 2)
+			high = low;
+		// clock run-in, framing code 0x27 and the payload, LSB first
+		for (unsigned i = 0; i < 16; i++)
+			bits[n++] = !(i & 1);
+		for (unsigned i = 0; i < 8; i++)
+			bits[n++] = (0x27 >> i) & 1;
+		while (n < sizeof(bits)) {
+			seed = seed * 1103515245 + 12345;
+			bits[n++] = (seed >> 16) & 1;
+		}
+		for (unsigned x = 0; x < fmt.samples_per_line; x++) {
+			double b = (x - start) / spb;
+			int v = low;
+
+			if (b >= 0 && b < n) {
+				unsigned i = b;
+				double f = b - i;
+				int cur = bits[i] ? high : low;
+				int next = i + 1 < n && bits[i + 1] ? high : low;
+
+				// a linear edge over the last quarter of the bit
+				v = f < .75 ? cur : cur + (next - cur) * (f - .75) * 4;
+			}
+			seed = seed * 1103515245 + 12345;
+			v += (int)((seed >> 16) % (2 * noise + 1)) - noise;
+			line[x] = v < 0 ? 0 : v > 255 ? 255 : v;
+		}
+	}
+}
+
+// Slices all frames loops times with a new slicer, returns the seconds
+// per frame.
+static double slice(VbiSlicer &slicer, const v4l2_vbi_format &fmt, v4l2_std_id std,
+		const unsigned char *const *frames, unsigned count,
+		unsigned loops, v4l2_sliced_vbi_data *data, unsigned &found)
+{
+	unsigned lines = fmt.count[0] + fmt.count[1];
+	v4l2_sliced_vbi_format sfmt;
+	double start;
+
+	// every run starts from the same slicer state
+	slicer.prepare(fmt, std);
+	// parse() has to clear the lines it does not slice
+	memset(data, 0xff, count * lines * sizeof(*data));
+	found = 0;
+	start = now();
+	for (unsigned l = 0; l < loops; l++) {
+		for (unsigned f = 0; f < count; f++) {
+			slicer.parse(frames[f], &sfmt, data + f * lines);
+			if (l == loops - 1)
+				for (unsigned y = 0; y < lines; y++)
+					found += data[f * lines + y].id != 0;
+		}
+	}
+	return (now() - start) / (loops * count);
+}
+
+int vbiBenchmark(const char *recording, unsigned loops)
+{
+	RawReader reader;
+	v4l2_vbi_format fmt;
+	v4l2_std_id std;
+	unsigned count, lines, size;
+	const unsigned char **frames;
+	unsigned char *generated = NULL;
+	v4l2_sliced_vbi_data *scalar, *vector, *parallel, *again;
+	VbiSlicer slicer;
+	double scalarUs, vectorUs, parallelUs, learnUs;
+	unsigned scalarFound, vectorFound, parallelFound, learnFound;
+	bool same, stable;
+
+	if (reader.open(recording) && reader.format().type == V4L2_BUF_TYPE_VBI_CAPTURE) {
+		fmt = reader.format().fmt.vbi;
+		count = reader.frames();
+		printf("%u frames of %s\n", count, recording);
+	} else {
+		memset(&fmt, 0, sizeof(fmt));
+		fmt.sampling_rate = 35468950;
+		fmt.offset = 244;
+		fmt.samples_per_line = 2048;
+		fmt.sample_format = V4L2_PIX_FMT_GREY;
+		fmt.start[0] = 7;
+		fmt.count[0] = 16;
+		fmt.start[1] = 320;
+		fmt.count[1] = 16;
+		count = GEN_FRAMES;
+		printf("%u generated PAL teletext frames\n", count);
+	}
+	// the field 2 line numbers tell 625 from 525 line recordings
+	std = fmt.start[1] >= 313 ? V4L2_STD_PAL_BG : V4L2_STD_NTSC_M;
+	lines = fmt.count[0] + fmt.count[1];
+	size = lines * fmt.samples_per_line;
+	if (count == 0 || !slicer.prepare(fmt, std)) {
+		fprintf(stderr, "no VBI service to slice in this format\n");
+		return 1;
+	}
+
+	frames = new const unsigned char *[count];
+	if (reader.isOpen()) {
+		RawFrame frame;
+
+		for (unsigned f = 0; f < count; f++) {
+			if (!reader.frame(f, frame) || frame.size < size) {
+				fprintf(stderr, "frame %u is cut short\n", f);
+				delete [] frames;
+				return 1;
+			}
+			frames[f] = frame.data;
+		}
+	} else {
+		unsigned seed = 1;
+
+		generated = new unsigned char[count * size];
+		for (unsigned f = 0; f < count; f++) {
+			generate(generated + f * size, fmt, seed);
+			frames[f] = generated + f * size;
+		}
+	}
+
+	scalar = new v4l2_sliced_vbi_data[count * lines];
+	vector = new v4l2_sliced_vbi_data[count * lines];
+	parallel = new v4l2_sliced_vbi_data[count * lines];
+	again = new v4l2_sliced_vbi_data[count * lines];
+
+	if (!slicer.handle().simd)
+		printf("no vector slicer on this CPU, timing the scalar one twice\n");
+	slicer.setThreads(1);
+	slicer.setSimd(false);
+	scalarUs = slice(slicer, fmt, std, frames, count, loops, scalar, scalarFound) * 1e6;
+	slicer.setSimd(true);
+	vectorUs = slice(slicer, fmt, std, frames, count, loops, vector, vectorFound) * 1e6;
+	same = !memcmp(scalar, vector, count * lines * sizeof(*scalar));
+	printf("%u lines sliced: scalar %7.1f us/frame  vector %7.1f us/frame  %s\n",
+			scalarFound, scalarUs, vectorUs, same ? "identical" : "DIFFERENT");
+
+	// lines start from the threshold of the frame, so the results may
+	// differ a little from the above, but never from run to run
+	slicer.setThreads(0);
+	parallelUs = slice(slicer, fmt, std, frames, count, loops, parallel, parallelFound) * 1e6;
+	slice(slicer, fmt, std, frames, count, loops, again, parallelFound);
+	stable = !memcmp(parallel, again, count * lines * sizeof(*parallel));
+	printf("%u lines sliced: %u stripes %7.1f us/frame  %s\n",
+			parallelFound, slicer.stripes(), parallelUs,
+			stable ? "deterministic" : "NOT DETERMINISTIC");
+
+	// lines come and go with the probes, count the last loop
+	slicer.setThreads(1);
+	slicer.setLearning(VBI_LEARN_FRAMES);
+	learnUs = slice(slicer, fmt, std, frames, count, loops, parallel, learnFound) * 1e6;
+	printf("%u lines sliced: learning %7.1f us/frame\n", learnFound, learnUs);
+	delete [] scalar;
+	delete [] vector;
+	delete [] parallel;
+	delete [] again;
+	delete [] generated;
+	delete [] frames;
+	return same && stable ? 0 : 1;
+}
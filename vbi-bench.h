@@ -0,0 +1,30 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef VBI_BENCH_H
+#define VBI_BENCH_H
+
+// Slices every frame of a raw VBI recording, or of generated PAL frames
+// if recording is not one, loops times with the scalar and the vector
+// slicer, in parallel stripes and in learning mode. Prints whether the
+// first two found the same data, whether the parallel slicer gave the
+// same data twice, and the time per frame of each.
+int vbiBenchmark(const char *recording, unsigned loops);
+
+#endif
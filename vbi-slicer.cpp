@@ -0,0 +1,181 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <string.h>
+#include <QThread>
+
+#include "vbi-slicer.h"
+
+// covered lines below which a stripe is not worth a thread
+#define VBI_MIN_LINES	4
+
+void VbiStripe::slice()
+{
+	m_slicer->sliceLines(m_y0, m_y1);
+}
+
+void VbiStripe::run()
+{
+	slice();
+	m_slicer->m_done.release();
+}
+
+VbiSlicer::VbiSlicer() :
+	m_simd(true),
+	m_threads(0),
+	m_learn(0),
+	m_stripes(1),
+	m_buf(NULL),
+	m_data(NULL),
+	m_found(NULL),
+	m_thresh(NULL)
+{
+	memset(&m_vh, 0, sizeof(m_vh));
+	// keep the workers around between frames
+	m_pool.setExpiryTimeout(-1);
+}
+
+VbiSlicer::~VbiSlicer()
+{
+	m_pool.waitForDone();
+	delete [] m_found;
+	delete [] m_thresh;
+}
+
+void VbiSlicer::clear()
+{
+	m_pool.waitForDone();
+	memset(&m_vh, 0, sizeof(m_vh));
+	m_stripes = 1;
+}
+
+bool VbiSlicer::prepare(const v4l2_vbi_format &fmt, v4l2_std_id std)
+{
+	unsigned lines, covered = 0;
+	unsigned threads = m_threads;
+	unsigned rows;
+
+	m_pool.waitForDone();
+	m_stripes = 1;
+	if (!vbi_prepare(&m_vh, &fmt, std))
+		return false;
+	if (!m_simd)
+		m_vh.simd = false;
+
+	lines = this->lines();
+	for (unsigned y = 0; y < lines; y++)
+		if (vbi_line_slicers(&m_vh, y))
+			covered++;
+	// after counting, learning has not seen any line yet
+	m_vh.learn = m_learn;
+	if (threads == 0)
+		threads = QThread::idealThreadCount() > 1 ? QThread::idealThreadCount() : 1;
+	m_stripes = covered / VBI_MIN_LINES;
+	if (m_stripes > threads)
+		m_stripes = threads;
+	if (m_stripes > VBI_MAX_STRIPES)
+		m_stripes = VBI_MAX_STRIPES;
+	if (m_stripes < 2) {
+		m_stripes = 1;
+		return true;
+	}
+	delete [] m_found;
+	delete [] m_thresh;
+	m_found = new __u32[VBI_MAX_SERVICES * lines];
+	m_thresh = new unsigned[VBI_MAX_SERVICES * lines];
+
+	// with two stripes, one per field if both have as many lines
+	rows = (lines + m_stripes - 1) / m_stripes;
+	for (unsigned i = 0; i < m_stripes; i++) {
+		unsigned y0 = i * rows;
+		unsigned y1 = y0 + rows;
+
+		if (y0 > lines)
+			y0 = lines;
+		if (y1 > lines)
+			y1 = lines;
+		m_stripe[i].set(this, y0, y1);
+	}
+	m_pool.setMaxThreadCount(m_stripes - 1);
+	return true;
+}
+
+void VbiSlicer::sliceLines(unsigned y0, unsigned y1)
+{
+	unsigned lines = this->lines();
+
+	for (unsigned y = y0; y < y1; y++) {
+		unsigned mask = vbi_line_slicers(&m_vh, y);
+
+		// the services of a line in the order vbi_parse() takes them
+		for (unsigned i = 0; i < m_vh.services; i++) {
+			vbi_bit_slicer bs = m_vh.slicers[i];
+			unsigned k = i * lines + y;
+
+			if (!(mask & (1 << i)))
+				continue;
+			m_found[k] = 0;
+			if (vbi_parse_line(&m_vh, i, &bs, m_buf, y, m_data + y)) {
+				m_found[k] = m_data[y].id;
+				m_thresh[k] = bs.thresh;
+			}
+		}
+	}
+}
+
+void VbiSlicer::parse(const unsigned char *buf, v4l2_sliced_vbi_format *vbi,
+		v4l2_sliced_vbi_data *data)
+{
+	unsigned lines = this->lines();
+
+	if (m_stripes == 1) {
+		vbi_parse(&m_vh, buf, vbi, data);
+		return;
+	}
+	m_buf = buf;
+	m_data = data;
+	// as vbi_parse(), lines that are skipped come out empty
+	memset(data, 0, sizeof(*data) * lines);
+	// the calling thread takes the first stripe itself
+	for (unsigned i = 1; i < m_stripes; i++)
+		m_pool.start(&m_stripe[i]);
+	m_stripe[0].slice();
+	m_done.acquire(m_stripes - 1);
+
+	memset(vbi, 0, sizeof(*vbi));
+	vbi->io_size = sizeof(*data) * lines;
+	for (unsigned y = 0; y < lines; y++) {
+		unsigned mask = vbi_line_slicers(&m_vh, y);
+
+		for (unsigned i = 0; i < m_vh.services; i++) {
+			unsigned k = i * lines + y;
+
+			if (!(mask & (1 << i)))
+				continue;
+			vbi_learn(&m_vh, i, y, m_found[k]);
+			// a later service on the same line may have reset data[y].id
+			if (m_found[k] == 0)
+				continue;
+			vbi->service_set |= m_found[k];
+			vbi->service_lines[data[y].field][data[y].line] = m_found[k];
+			m_vh.slicers[i].thresh = m_thresh[k];
+		}
+	}
+	m_vh.frame++;
+}
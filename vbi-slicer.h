@@ -0,0 +1,113 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef VBI_SLICER_H
+#define VBI_SLICER_H
+
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSemaphore>
+
+#include "raw2sliced.h"
+
+#define VBI_MAX_STRIPES 4
+// frames between probes of a line in learning mode, a second at 25 fps
+#define VBI_LEARN_FRAMES 25
+
+class VbiSlicer;
+
+class VbiStripe : public QRunnable
+{
+public:
+	VbiStripe() : m_slicer(NULL), m_y0(0), m_y1(0) { setAutoDelete(false); }
+
+	void set(VbiSlicer *slicer, unsigned y0, unsigned y1)
+	{
+		m_slicer = slicer;
+		m_y0 = y0;
+		m_y1 = y1;
+	}
+	// Slices the lines of the stripe.
+	void slice();
+	// Slices them from the pool, and tells the slicer it is done.
+	virtual void run();
+
+private:
+	VbiSlicer *m_slicer;
+	unsigned m_y0, m_y1;
+};
+
+// Slices raw VBI frames, splitting the lines of both fields into stripes
+// that are sliced in parallel. vbi_parse() carries the adaptive threshold
+// of each service from line to line; here every line starts from the
+// threshold the frame started with. Afterwards each service takes the
+// threshold of the last line it was found on, in frame order, so the
+// results do not depend on how the threads were scheduled.
+class VbiSlicer
+{
+public:
+	VbiSlicer();
+	~VbiSlicer();
+
+	// Returns false if no service can be sliced, see vbi_prepare().
+	bool prepare(const v4l2_vbi_format &fmt, v4l2_std_id std);
+	// No services, for sliced VBI devices.
+	void clear();
+	// Number of threads, 0 for one per core and 1 for plain vbi_parse().
+	// Takes effect with the next prepare().
+	void setThreads(unsigned threads) { m_threads = threads; }
+	// Learning mode, see vbi_handle: lines are only sliced for the
+	// services seen on them and probed for others every this many
+	// frames, 0 slices every line. Takes effect with the next prepare().
+	void setLearning(unsigned frames) { m_learn = frames; }
+	unsigned stripes() const { return m_stripes; }
+
+	// Lines of a frame, the size of the data array parse() fills in.
+	unsigned lines() const { return m_vh.count[0] + m_vh.count[1]; }
+	const vbi_handle &handle() const { return m_vh; }
+	// Use the vectorized slicer if the CPU has it, takes effect with the
+	// next prepare(). On by default.
+	void setSimd(bool simd) { m_simd = simd; }
+
+	void parse(const unsigned char *buf, v4l2_sliced_vbi_format *vbi,
+			v4l2_sliced_vbi_data *data);
+
+private:
+	friend class VbiStripe;
+	void sliceLines(unsigned y0, unsigned y1);
+
+	vbi_handle m_vh;
+	bool m_simd;
+	unsigned m_threads;
+	unsigned m_learn;
+	unsigned m_stripes;
+	VbiStripe m_stripe[VBI_MAX_STRIPES];
+	QThreadPool m_pool;
+	// released once by each stripe the pool ran; waitForDone() would
+	// end the pool threads as well in Qt 4
+	QSemaphore m_done;
+	const unsigned char *m_buf;
+	v4l2_sliced_vbi_data *m_data;
+	// for each service and line: the service found there or 0, and the
+	// threshold after it
+	__u32 *m_found;
+	unsigned *m_thresh;
+};
+
+#endif
@@ -21,6 +21,11 @@
 #include <stdint.h>
 #include "vbi-tab.h"
 #include <QTableWidget>
+#include <QSpinBox>
+#include <QPlainTextEdit>
+#include <QHBoxLayout>
+#include <QLabel>
+#include <QComboBox>
 
 #include <stdio.h>
 #include <errno.h>
@@ -43,6 +48,58 @@ VbiTab::VbiTab(QWidget *parent) :
 	m_tableF2->setVerticalHeaderLabels(q);
 	addWidget(m_tableF1, 0, 0);
 	addWidget(m_tableF2, 0, 1);
+
+	QHBoxLayout *txt = new QHBoxLayout();
+	QHBoxLayout *cc = new QHBoxLayout();
+	QFont font("Monospace");
+
+	m_txtPage = new QSpinBox(parent);
+	m_txtPage->setRange(100, 899);
+	m_txtSub = new QSpinBox(parent);
+	m_txtSub->setRange(0, 3979);
+	m_txtSub->setSpecialValueText("newest");
+	m_txtStatus = new QLabel(parent);
+	txt->addWidget(new QLabel("Teletext page", parent));
+	txt->addWidget(m_txtPage);
+	txt->addWidget(new QLabel("Subpage", parent));
+	txt->addWidget(m_txtSub);
+	txt->addWidget(m_txtStatus);
+	txt->addStretch();
+	addLayout(txt, 1, 0);
+	m_txtView = new QPlainTextEdit(parent);
+	m_txtView->setReadOnly(true);
+	m_txtView->setLineWrapMode(QPlainTextEdit::NoWrap);
+	font.setStyleHint(QFont::TypeWriter);
+	m_txtView->setFont(font);
+	addWidget(m_txtView, 2, 0);
+
+	m_ccChannel = new QComboBox(parent);
+	for (unsigned i = 1; i <= 4; i++)
+		m_ccChannel->addItem(QString("CC%1").arg(i));
+	cc->addWidget(new QLabel("Captions", parent));
+	cc->addWidget(m_ccChannel);
+	cc->addStretch();
+	addLayout(cc, 1, 1);
+	m_ccView = new QPlainTextEdit(parent);
+	m_ccView->setReadOnly(true);
+	m_ccView->setLineWrapMode(QPlainTextEdit::NoWrap);
+	m_ccView->setFont(font);
+	addWidget(m_ccView, 2, 1);
+	m_ccUpdates = 0;
+	connect(m_ccChannel, SIGNAL(activated(int)), SLOT(ccChannelChanged(int)));
+	m_txtShown = NULL;
+	m_txtUpdates = 0;
+	m_txtCached = 0;
+	connect(m_txtPage, SIGNAL(valueChanged(int)), SLOT(txtPageChanged()));
+	connect(m_txtSub, SIGNAL(valueChanged(int)), SLOT(txtPageChanged()));
+	showPage(true);
+	showCaptions(true);
+}
+
+void VbiTab::setCaptionLog(const QString &fileName)
+{
+	if (!m_captions.openLog(fileName))
+		error(QString("Cannot open caption log %1").arg(fileName));
 }
 
 void VbiTab::tableFormat()
@@ -79,6 +136,10 @@ void VbiTab::rawFormat(const v4l2_vbi_format &fmt)
 	m_startF2 = fmt.start[1];
 	m_offsetF2 = m_startF2 >= 313 ? 313 : 263;
 	tableFormat();
+	m_teletext.reset();
+	m_captions.reset();
+	showPage(true);
+	showCaptions(true);
 }
 
 void VbiTab::slicedFormat(const v4l2_sliced_vbi_format &fmt)
@@ -90,6 +151,10 @@ void VbiTab::slicedFormat(const v4l2_sliced_vbi_format &fmt)
 	m_offsetF2 = is_625 ? 313 : 263;
 	m_countF1 = m_countF2 = is_625 ? 18 : 12;
 	tableFormat();
+	m_teletext.reset();
+	m_captions.reset();
+	showPage(true);
+	showCaptions(true);
 }
 
 static const char *formats[] = {
@@ -372,10 +437,105 @@ static void setItem(QTableWidgetItem *item, const v4l2_sliced_vbi_data *data)
 	}
 }
 
+void VbiTab::txtPageChanged()
+{
+	showPage(true);
+}
+
+// The page as text. Spacing attributes show as blanks, mosaic cells as
+// blocks, and the national characters as their ASCII codes.
+static QString pageText(const TeletextPage *p)
+{
+	QString text;
+
+	for (unsigned r = 0; r < TXT_ROWS; r++) {
+		bool mosaic = false;
+
+		for (unsigned c = 0; c < TXT_COLS; c++) {
+			unsigned char ch = p->text[r][c];
+
+			if (r == 0 && c < 8) {
+				text += QString("P%1    ").arg(p->pgno, 3, 16);
+				c = 7;
+				continue;
+			}
+			if (ch < 0x20) {
+				// alpha and mosaic colour codes
+				if (ch < 0x08)
+					mosaic = false;
+				else if (ch >= 0x10 && ch < 0x18)
+					mosaic = true;
+				text += ' ';
+			} else if (mosaic && (ch & 0x20)) {
+				text += ch == 0x20 ? QChar(' ') : QChar(0x2588);
+			} else {
+				text += QChar((ushort)(ch == 0x7f ? ' ' : ch));
+			}
+		}
+		text += '\n';
+	}
+	return text;
+}
+
+void VbiTab::showPage(bool force)
+{
+	unsigned sub = m_txtSub->value();
+	const TeletextPage *p;
+
+	// the subpage is entered as the decimal digits of its subcode
+	if (sub)
+		sub = ((sub / 1000) << 12) | ((sub / 100 % 10) << 8) |
+			((sub / 10 % 10) << 4) | (sub % 10);
+	else
+		sub = TXT_ANY_SUB;
+	p = m_teletext.page(TeletextDecoder::pgnoOf(m_txtPage->value()), sub);
+	if (m_teletext.cached() != m_txtCached || force) {
+		m_txtCached = m_teletext.cached();
+		m_txtStatus->setText(QString("%1 pages cached").arg(m_txtCached));
+	}
+	if (!force && p == m_txtShown && (p == NULL || p->updates == m_txtUpdates))
+		return;
+	m_txtShown = p;
+	if (p == NULL) {
+		m_txtView->setPlainText("Page not received yet");
+		return;
+	}
+	m_txtUpdates = p->updates;
+	m_txtView->setPlainText(pageText(p));
+}
+
+void VbiTab::ccChannelChanged(int index)
+{
+	m_captions.setChannel(index + 1);
+	showCaptions(true);
+}
+
+void VbiTab::showCaptions(bool force)
+{
+	QString text;
+
+	if (!force && m_captions.updates() == m_ccUpdates)
+		return;
+	m_ccUpdates = m_captions.updates();
+	for (unsigned r = 0; r < CC_ROWS; r++) {
+		const unsigned short *row = m_captions.row(r);
+
+		for (unsigned c = 0; c < CC_COLS; c++)
+			text += row[c] ? QChar(row[c]) : QChar(' ');
+		text += '\n';
+	}
+	m_ccView->setPlainText(text);
+}
+
 void VbiTab::slicedData(const v4l2_sliced_vbi_data *data, unsigned elems)
 {
 	char found[m_countF1 + m_countF2];
 
+	m_teletext.decode(data, elems);
+	m_captions.decode(data, elems);
+	showPage(false);
+	showCaptions(false);
+
 	memset(found, 0, m_countF1 + m_countF2);
 	for (unsigned i = 0; i < elems; i++) {
 		QTableWidgetItem *item;
@@ -23,8 +23,14 @@
 
 #include "qv4l2.h"
 #include "v4l2-api.h"
+#include "teletext.h"
+#include "caption.h"
 
 class QTableWidget;
+class QSpinBox;
+class QLabel;
+class QPlainTextEdit;
+class QComboBox;
 
 class VbiTab: public QGridLayout
 {
@@ -37,6 +43,11 @@ public:
 	void rawFormat(const v4l2_vbi_format &fmt);
 	void slicedFormat(const v4l2_sliced_vbi_format &fmt);
 	void slicedData(const v4l2_sliced_vbi_data *data, unsigned elems);
+	void setCaptionLog(const QString &fileName);
+
+private slots:
+	void txtPageChanged();
+	void ccChannelChanged(int index);
 
 private:
 	void info(const QString &info)
@@ -48,12 +59,28 @@ private:
 		g_mw->error(error);
 	}
 	void tableFormat();
+	void showPage(bool force);
+	void showCaptions(bool force);
 
 	QTableWidget *m_tableF1;
 	QTableWidget *m_tableF2;
 	unsigned m_startF1, m_startF2;
 	unsigned m_countF1, m_countF2;
 	unsigned m_offsetF2;
+
+	TeletextDecoder m_teletext;
+	QSpinBox *m_txtPage;
+	QSpinBox *m_txtSub;
+	QLabel *m_txtStatus;
+	QPlainTextEdit *m_txtView;
+	const TeletextPage *m_txtShown;
+	unsigned m_txtUpdates;
+	unsigned m_txtCached;
+
+	CaptionDecoder m_captions;
+	QComboBox *m_ccChannel;
+	QPlainTextEdit *m_ccView;
+	unsigned m_ccUpdates;
 };
 
 #endif
@@ -0,0 +1,251 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "video-detect.h"
+
+// cells below this are dark, two histogram bins
+#define DETECT_DARK	(2 * 256 / DETECT_BINS)
+// share of dark cells in a black frame, in percent
+#define DETECT_BLACK	98
+// a flat frame this dim is black at the wrong level
+#define DETECT_DIM	48
+#define DETECT_FLAT	4
+// changed cells still taken for the same picture
+#define FREEZE_BITS	(DETECT_CELLS / 64)
+// cells this close to the mean are not compared
+#define FREEZE_MARGIN	6
+
+LumaGrid::LumaGrid() :
+	m_format(0),
+	m_width(0),
+	m_height(0),
+	m_stride(0),
+	m_bpp(0),
+	m_offset(0),
+	m_luma(NULL),
+	m_sum(NULL),
+	m_row(NULL),
+	m_mean(0),
+	m_variance(0)
+{
+	memset(m_cells, 0, sizeof(m_cells));
+	memset(m_hist, 0, sizeof(m_hist));
+}
+
+LumaGrid::~LumaGrid()
+{
+	delete [] m_row;
+}
+
+bool LumaGrid::setFormat(const v4l2_pix_format &pix)
+{
+	unsigned bytes = 1;
+
+	m_format = 0;
+	m_bpp = 0;
+	m_offset = 0;
+	switch (pix.pixelformat) {
+	case V4L2_PIX_FMT_GREY:
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV21:
+	case V4L2_PIX_FMT_NV16:
+	case V4L2_PIX_FMT_NV61:
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+	case V4L2_PIX_FMT_YUV422P:
+		break;
+	case V4L2_PIX_FMT_UYVY:
+	case V4L2_PIX_FMT_VYUY:
+		m_offset = 1;
+		// fall through
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_YVYU:
+		bytes = 2;
+		break;
+	case V4L2_PIX_FMT_RGB24:
+		m_bpp = 3;
+		m_rgb[0] = 0, m_rgb[1] = 1, m_rgb[2] = 2;
+		break;
+	case V4L2_PIX_FMT_BGR24:
+		m_bpp = 3;
+		m_rgb[0] = 2, m_rgb[1] = 1, m_rgb[2] = 0;
+		break;
+	case V4L2_PIX_FMT_RGB32:
+		m_bpp = 4;
+		m_rgb[0] = 1, m_rgb[1] = 2, m_rgb[2] = 3;
+		break;
+	case V4L2_PIX_FMT_BGR32:
+		m_bpp = 4;
+		m_rgb[0] = 2, m_rgb[1] = 1, m_rgb[2] = 0;
+		break;
+	default:
+		return false;
+	}
+	if (pix.width < DETECT_COLS || pix.height < DETECT_ROWS)
+		return false;
+	if (m_bpp)
+		bytes = m_bpp;
+	m_format = pix.pixelformat;
+	m_width = pix.width;
+	m_height = pix.height;
+	m_stride = pix.bytesperline ? pix.bytesperline : pix.width * bytes;
+	simdLumaKernels(m_format, m_luma, m_sum);
+	delete [] m_row;
+	m_row = new unsigned char[m_width];
+	return true;
+}
+
+// The luma of row y, read in place if it is a plane of its own.
+const unsigned char *LumaGrid::row(const unsigned char *data, unsigned y)
+{
+	const unsigned char *src = data + y * m_stride;
+	unsigned x = 0;
+
+	if (m_bpp) {
+		for (; x < m_width; x++, src += m_bpp)
+			m_row[x] = (77 * src[m_rgb[0]] + 150 * src[m_rgb[1]] + 29 * src[m_rgb[2]]) >> 8;
+		return m_row;
+	}
+	switch (m_format) {
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_YVYU:
+	case V4L2_PIX_FMT_UYVY:
+	case V4L2_PIX_FMT_VYUY:
+		if (m_luma)
+			x = m_luma(src, m_row, m_width);
+		for (; x < m_width; x++)
+			m_row[x] = src[2 * x + m_offset];
+		return m_row;
+	default:
+		return src;
+	}
+}
+
+bool LumaGrid::analyze(const unsigned char *data, unsigned size)
+{
+	unsigned total = 0;
+	unsigned var = 0;
+
+	if (m_format == 0 || size < m_stride * m_height)
+		return false;
+	memset(m_hist, 0, sizeof(m_hist));
+	for (unsigned r = 0; r < DETECT_ROWS; r++) {
+		const unsigned char *p = row(data, (2 * r + 1) * m_height / (2 * DETECT_ROWS));
+		unsigned char *cell = m_cells + r * DETECT_COLS;
+
+		for (unsigned c = 0; c < DETECT_COLS; c++) {
+			unsigned x = c * m_width / DETECT_COLS;
+			unsigned end = (c + 1) * m_width / DETECT_COLS;
+			unsigned sum = 0;
+			unsigned i = 0;
+
+			if (m_sum)
+				i = m_sum(p + x, end - x, sum);
+			for (i += x; i < end; i++)
+				sum += p[i];
+			cell[c] = sum / (end - x);
+			total += cell[c];
+			m_hist[cell[c] * DETECT_BINS / 256]++;
+		}
+	}
+	m_mean = total / DETECT_CELLS;
+	for (unsigned i = 0; i < DETECT_CELLS; i++) {
+		int d = m_cells[i] - (int)m_mean;
+
+		var += d * d;
+	}
+	m_variance = var / DETECT_CELLS;
+	return true;
+}
+
+bool BlackDetector::check(const LumaGrid &grid)
+{
+	const unsigned *hist = grid.histogram();
+	unsigned dark = 0;
+
+	for (unsigned i = 0; i < DETECT_DARK * DETECT_BINS / 256; i++)
+		dark += hist[i];
+	m_ratio = (double)dark / DETECT_CELLS;
+	m_black = dark * 100 >= DETECT_BLACK * DETECT_CELLS ||
+		(grid.mean() < DETECT_DIM && grid.variance() <= DETECT_FLAT);
+	return m_black;
+}
+
+void FreezeDetector::reset()
+{
+	m_count = 0;
+	m_next = 0;
+	m_distance = 0;
+	m_still = false;
+}
+
+void FreezeDetector::hash(const LumaGrid &grid, FrameHash &h)
+{
+	const unsigned char *cells = grid.cells();
+	int mean = grid.mean();
+
+	memset(&h, 0, sizeof(h));
+	for (unsigned i = 0; i < DETECT_CELLS; i++) {
+		unsigned long long bit = 1ULL << (i % 64);
+
+		if (cells[i] > mean)
+			h.bits[i / 64] |= bit;
+		if (cells[i] > mean + FREEZE_MARGIN || cells[i] + FREEZE_MARGIN < mean)
+			h.sure[i / 64] |= bit;
+	}
+}
+
+unsigned FreezeDetector::distance(const FrameHash &a, const FrameHash &b)
+{
+	unsigned d = 0;
+
+	for (unsigned i = 0; i < FREEZE_WORDS; i++)
+		d += __builtin_popcountll((a.bits[i] ^ b.bits[i]) & a.sure[i] & b.sure[i]);
+	return d;
+}
+
+bool FreezeDetector::check(const LumaGrid &grid)
+{
+	FrameHash &h = m_history[m_next];
+	unsigned prev = (m_next + FREEZE_HISTORY - 1) % FREEZE_HISTORY;
+
+	// the slot of the new hash holds the oldest one
+	if (m_count == FREEZE_HISTORY) {
+		FrameHash oldest = h;
+
+		hash(grid, h);
+		m_distance = distance(h, oldest);
+		if (m_distance > FREEZE_BITS || distance(h, m_history[prev]) > FREEZE_BITS)
+			m_still = false;
+		else if (!m_still)
+			m_still = true, m_anchor = h;
+		else
+			m_still = distance(h, m_anchor) <= FREEZE_BITS;
+	} else {
+		hash(grid, h);
+		m_count++;
+		m_distance = 0;
+		m_still = false;
+	}
+	m_next = (m_next + 1) % FREEZE_HISTORY;
+	return m_still;
+}
@@ -0,0 +1,126 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (C) 2006 Hans Verkuil <hverkuil@xs4all.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef VIDEO_DETECT_H
+#define VIDEO_DETECT_H
+
+#include <linux/videodev2.h>
+
+#include "conv-simd.h"
+
+#define DETECT_COLS	32
+#define DETECT_ROWS	24
+#define DETECT_BINS	16
+#define DETECT_CELLS	(DETECT_ROWS * DETECT_COLS)
+
+#define FREEZE_WORDS	((DETECT_CELLS + 63) / 64)
+#define FREEZE_HISTORY	16
+
+// The luma of a frame scaled down to a grid of cell averages. Only a few
+// rows of the frame are read, enough for picture-wide statistics.
+class LumaGrid
+{
+public:
+	LumaGrid();
+	~LumaGrid();
+
+	// Returns false for formats without a luma to read, such as MJPEG.
+	bool setFormat(const v4l2_pix_format &pix);
+	bool analyze(const unsigned char *data, unsigned size);
+
+	// Of the last frame analyzed, all in 8 bit luma
+	const unsigned char *cells() const { return m_cells; }
+	unsigned mean() const { return m_mean; }
+	unsigned variance() const { return m_variance; }
+	// Number of cells per 1/DETECT_BINS of the luma range.
+	const unsigned *histogram() const { return m_hist; }
+
+private:
+	const unsigned char *row(const unsigned char *data, unsigned y);
+
+	__u32 m_format;
+	unsigned m_width;
+	unsigned m_height;
+	unsigned m_stride;
+	unsigned m_bpp;		// bytes per pixel of packed RGB, else 0
+	unsigned m_offset;	// of the first luma byte of packed YUV
+	unsigned m_rgb[3];	// of red, green and blue in packed RGB
+	SimdLuma m_luma;
+	SimdSum m_sum;
+	unsigned char *m_row;
+	unsigned char m_cells[DETECT_CELLS];
+	unsigned m_mean;
+	unsigned m_variance;
+	unsigned m_hist[DETECT_BINS];
+};
+
+// A frame is black when nearly all of its cells are dark, so that a logo
+// on black is still black. A dim flat frame, black at the wrong level,
+// is black as well.
+class BlackDetector
+{
+public:
+	BlackDetector() : m_black(false), m_ratio(0) {}
+
+	bool check(const LumaGrid &grid);
+	bool black() const { return m_black; }
+	// Share of dark cells in the last frame, 0-1.
+	double ratio() const { return m_ratio; }
+
+private:
+	bool m_black;
+	double m_ratio;
+};
+
+// One bit per grid cell, set if the cell is brighter than the frame.
+// Cells close to the mean of the frame flip with noise, they are left
+// out of the comparison.
+struct FrameHash {
+	unsigned long long bits[FREEZE_WORDS];
+	unsigned long long sure[FREEZE_WORDS];
+};
+
+// A picture is still when its hash hardly differs from the one before it
+// and from the oldest one kept, so that slow movement is not taken for
+// a frozen picture. While it stays still it is also compared with the
+// first still frame, which catches a drift too slow for the history.
+class FreezeDetector
+{
+public:
+	FreezeDetector() { reset(); }
+
+	void reset();
+	bool check(const LumaGrid &grid);
+	bool still() const { return m_still; }
+	// Bits that changed against the oldest frame kept.
+	unsigned distance() const { return m_distance; }
+
+	static void hash(const LumaGrid &grid, FrameHash &h);
+	static unsigned distance(const FrameHash &a, const FrameHash &b);
+
+private:
+	FrameHash m_history[FREEZE_HISTORY];
+	FrameHash m_anchor;
+	unsigned m_count;
+	unsigned m_next;
+	unsigned m_distance;
+	bool m_still;
+};
+
+#endif